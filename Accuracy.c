@@ -0,0 +1,667 @@
+/*
+    LuminanceDRT - Luminance based image formation
+    Copyright (C) 2022  Ilia Sibiryakov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; strictly version 2 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/*
+Accuracy check of the fast render modes against a double precision reference of
+the same pipeline, for keeping approximations honest:
+
+    accuracy [--modes MODE,...] [--sweep N] [--exr PATH] [--raw PATH W H]
+             [--saturation X] [--slope X] [--smoothness X] [--exposure X]
+             [--lut-resolution N] [--threads N]
+             [--max-code-error N] [--mean-code-error X]
+             [--max-ipt-error X] [--mean-ipt-error X] [--json FILE]
+
+Modes are the direct render at each precision of the IPT curve (high, exact and
+fast), tone (high, with the contrast through the tone table) and lut3d:N (through
+an N^3 3D LUT, at high precision).
+The reference does every step in double with the exact matrices and pow, and
+looks up the paths as they're generated (with the same settings), searching each
+for the luminance as process_data first did. So what's measured includes any
+error of packing the paths for the render, not only of the render itself.
+
+Inputs are a sweep of every combination of N values per channel (0 and then
+-10 to +10 stops around middle grey), plus any EXR or raw float RGB images given.
+Errors are in 8-bit sRGB code values (as process_data would write them, worst
+channel) and as the distance between the two outputs in IPT. Every mode has
+tolerances of its own, the --max/--mean options replace them for all modes. The
+exit code is 1 if any mode is outside them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "EXR.h"
+#include "LuminanceDRT.h"
+#include "Matrix.h"
+#include "PathLUT.h"
+#include "SRGB.h"
+#include "Utilities/Utilities.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+#define MAX_MODES 16
+#define MAX_INPUTS 16
+
+/* Same as the library's */
+static double RGB_to_XYZ[9] = {
+    0.4124564, 0.3575761, 0.1804375,
+    0.2126729, 0.7151522, 0.0721750,
+    0.0193339, 0.1191920, 0.9503041
+};
+
+static double XYZ_to_LMS[9] = {
+    0.4002, 0.7075, -0.0807,
+    -0.2280, 1.1500, 0.0612,
+    0.0000, 0.0000, 0.9184
+};
+
+static double LMS_to_opponent[9] = {
+    0.4000, 0.4000, 0.2000,
+    4.4550, -4.8510, 0.3960,
+    0.8056, 0.3572, -1.1628
+};
+
+#define IPT_POWER 0.43
+#define MIDDLE_GREY 0.18
+
+typedef struct {
+    char name[32];
+    int precision; /* LDRT_PRECISION_... */
+    int tone_table;
+    int lut3d_size; /* 0 to render directly */
+    /* Default tolerances */
+    int max_code_error;
+    double mean_code_error;
+    double max_ipt_error;
+    double mean_ipt_error;
+} accuracy_mode_t;
+
+typedef struct {
+    char name[64];
+    float * pixels; /* Interleaved RGB */
+    size_t num_pixels;
+} input_t;
+
+typedef struct {
+    accuracy_mode_t modes[MAX_MODES];
+    int num_modes;
+    input_t inputs[MAX_INPUTS];
+    int num_inputs;
+    int sweep_steps;
+    LDRT_Parameters_t parameters;
+    /* Overrides of the tolerances of every mode, negative if not given */
+    int max_code_error;
+    double mean_code_error;
+    double max_ipt_error;
+    double mean_ipt_error;
+    char * json_path;
+} accuracy_options_t;
+
+typedef struct {
+    int max_code_error;
+    double mean_code_error;
+    double max_ipt_error;
+    double mean_ipt_error;
+    float worst_pixel[3]; /* Input with the highest code error */
+    int passed;
+} errors_t;
+
+
+/******************************** The reference ********************************/
+
+typedef struct {
+    double RGB_to_LMS[9];
+    double LMS_to_RGB[9];
+    double opponent_to_LMS[9];
+    double LMS_to_Y[3];
+    double highest_saturation;
+    double exposure_factor;
+    double contrast_slope;
+    double saturation_factor;
+    ColourPath_t * paths; /* [r][g], as generated, not packed */
+    int resolution;
+} reference_t;
+
+static double signed_pow(double X, double Power)
+{
+    return (X < 0.0) ? -pow(-X, Power) : pow(X, Power);
+}
+
+static void apply_matrix(double * M, double * In, double * Out)
+{
+    double v[3] = {In[0], In[1], In[2]};
+    for (int i = 0; i < 3; ++i) Out[i] = M[i*3] * v[0] + M[i*3+1] * v[1] + M[i*3+2] * v[2];
+}
+
+static void reference_to_IPT(reference_t * Ref, double * RGB, double * IPT)
+{
+    double lms[3];
+    apply_matrix(Ref->RGB_to_LMS, RGB, lms);
+    for (int c = 0; c < 3; ++c) lms[c] = signed_pow(lms[c], IPT_POWER);
+    apply_matrix(LMS_to_opponent, lms, IPT);
+}
+
+/* Y is the luminance */
+static void reference_from_IPT(reference_t * Ref, double * IPT, double * RGB, double * Y)
+{
+    double lms[3];
+    apply_matrix(Ref->opponent_to_LMS, IPT, lms);
+    for (int c = 0; c < 3; ++c) lms[c] = signed_pow(lms[c], 1.0 / IPT_POWER);
+    *Y = Ref->LMS_to_Y[0] * lms[0] + Ref->LMS_to_Y[1] * lms[1] + Ref->LMS_to_Y[2] * lms[2];
+    apply_matrix(Ref->LMS_to_RGB, lms, RGB);
+}
+
+static double compress_value(double X, double Power)
+{
+    if (X < 0.0) return X;
+    X = pow(X, Power);
+    return pow(X / (1.0 + X), 1.0 / Power);
+}
+
+static double uncompress_value(double X, double Power)
+{
+    if (X >= 1.0) return INFINITY;
+    if (X <= 0.0) return X;
+    X = pow(X, 1.0 / Power);
+    return pow(-(X / (X - 1.0)), Power);
+}
+
+static double contrast_scaled(double X, double Power)
+{
+    if (X < 0.0) return 0.0;
+    if (X < 1.0) return pow(X, Power);
+    return (X - 1.0) * Power + 1.0;
+}
+
+static double do_contrast(double X, double Power)
+{
+    X /= MIDDLE_GREY;
+    return contrast_scaled(X - contrast_scaled(1.0, Power) / Power + 1.0 / Power, Power) * MIDDLE_GREY;
+}
+
+/* A point along a path by luminance, as ColourPathInterpolate does it but in double */
+static void reference_path_value(ColourPath_t * Path, double Y, double * Out)
+{
+    ColourPathPoint_t * points = Path->points;
+    int last = Path->num_points - 1;
+    if (Y >= points[last].distance || Y <= 0.0) {
+        for (int c = 0; c < 3; ++c) Out[c] = points[(Y <= 0.0) ? 0 : last].value[c];
+        return;
+    }
+    int p = 0;
+    while (!(points[p].distance <= Y && points[p+1].distance >= Y)) ++p;
+    double fac = (Y - points[p].distance) / ((double)points[p+1].distance - points[p].distance);
+    for (int c = 0; c < 3; ++c) Out[c] = points[p].value[c] * (1.0 - fac) + points[p+1].value[c] * fac;
+}
+
+/* The lookup process_data used to do, blending the four paths around the
+ * chromaticity, each searched for the luminance */
+static void reference_lookup(reference_t * Ref, double * RGB, double Y, double * Out)
+{
+    int res = Ref->resolution;
+    double sum = RGB[0] + RGB[1] + RGB[2];
+    if (sum == 0.0) sum = 1.0;
+    double r = RGB[0] / sum * (res - 1.0) * 0.999999;
+    double g = RGB[1] / sum * (res - 1.0) * 0.999999;
+    int ir = r, ig = g;
+    double w_r = r - ir, w_g = g - ig;
+
+    double p00[3], p01[3], p10[3], p11[3];
+    reference_path_value(Ref->paths + ir * res + ig, Y, p00);
+    reference_path_value(Ref->paths + (ir+1) * res + ig, Y, p10);
+    reference_path_value(Ref->paths + ir * res + ig+1, Y, p01);
+    reference_path_value(Ref->paths + (ir+1) * res + ig+1, Y, p11);
+    for (int c = 0; c < 3; ++c)
+        Out[c] = (p00[c] * (1.0-w_g) + p01[c] * w_g) * (1.0-w_r) + (p10[c] * (1.0-w_g) + p11[c] * w_g) * w_r;
+}
+
+static void reference_pixel(reference_t * Ref, float * In, double * Out)
+{
+    double rgb[3], ipt[3];
+    for (int c = 0; c < 3; ++c) rgb[c] = MAX(In[c] * Ref->exposure_factor, 0.0);
+    reference_to_IPT(Ref, rgb, ipt);
+
+    /* Step for step the same as the render, including where P and T are relative to I */
+    double I = MAX(ipt[0], 0.0001), P = ipt[1] / I, T = ipt[2] / I;
+    double saturation_before = sqrt(P*P + T*T);
+    double expand = 1.0;
+    if (saturation_before >= 0.00001)
+        expand = uncompress_value(saturation_before / Ref->highest_saturation, 1.0) * Ref->highest_saturation / saturation_before;
+    P *= I * expand;
+    T *= I * expand;
+
+    I = signed_pow(do_contrast(signed_pow(I, 1.0 / IPT_POWER), Ref->contrast_slope), IPT_POWER);
+    P *= Ref->saturation_factor;
+    T *= Ref->saturation_factor;
+
+    if (saturation_before >= 0.00001)
+    {
+        P /= I;
+        T /= I;
+        double saturation_expanded = sqrt(P*P + T*T);
+        double saturation_contracted = compress_value(saturation_expanded / Ref->highest_saturation, 1.0) * Ref->highest_saturation;
+        P *= I * (saturation_contracted / saturation_expanded);
+        T *= I * (saturation_contracted / saturation_expanded);
+    }
+
+    ipt[0] = I;
+    ipt[1] = P;
+    ipt[2] = T;
+    double Y;
+    reference_from_IPT(Ref, ipt, rgb, &Y);
+    Y = compress_value(Y, 1.05);
+    for (int c = 0; c < 3; ++c) rgb[c] = MAX(rgb[c], 0.0);
+    reference_lookup(Ref, rgb, Y, Out);
+}
+
+static int init_reference(reference_t * Ref, LDRT_Parameters_t * Parameters)
+{
+    double XYZ_to_RGB[9], LMS_to_XYZ[9];
+    invertMatrix(RGB_to_XYZ, XYZ_to_RGB);
+    invertMatrix(XYZ_to_LMS, LMS_to_XYZ);
+    invertMatrix(LMS_to_opponent, Ref->opponent_to_LMS);
+    multiplyMatrices(XYZ_to_LMS, RGB_to_XYZ, Ref->RGB_to_LMS);
+    multiplyMatrices(XYZ_to_RGB, LMS_to_XYZ, Ref->LMS_to_RGB);
+    for (int i = 0; i < 3; ++i) Ref->LMS_to_Y[i] = LMS_to_XYZ[3+i];
+
+    Ref->highest_saturation = 0.0;
+    for (int p = 0; p < 3; ++p)
+    {
+        float primary[3];
+        Util_HSVToRGB(p / 3.0, 1.0, 1.0, primary);
+        double rgb[3] = {primary[0], primary[1], primary[2]}, ipt[3];
+        reference_to_IPT(Ref, rgb, ipt);
+        Ref->highest_saturation = MAX(Ref->highest_saturation, sqrt(ipt[1]*ipt[1] + ipt[2]*ipt[2]) / ipt[0]);
+    }
+    Ref->highest_saturation *= 1.03;
+
+    Ref->exposure_factor = pow(2.0, Parameters->exposure);
+    Ref->contrast_slope = Parameters->slope;
+    Ref->saturation_factor = Parameters->saturation * sqrt(Parameters->slope);
+    Ref->resolution = MAX(Parameters->lut_resolution, 2);
+    Ref->paths = PathLUT_BuildPaths(RGB_to_XYZ, Parameters->smoothness, Ref->resolution, Parameters->num_threads);
+    return (Ref->paths == NULL);
+}
+
+/* What process_data writes for Linear, in double */
+static int reference_code_value(double Linear)
+{
+    Linear *= 1.00001;
+    if (!(Linear > 0.0)) return 0;
+    if (Linear >= 1.0) return 255;
+    double encoded = (Linear < 0.0031308) ? Linear * 12.92 : 1.055 * pow(Linear, 1.0 / 2.4) - 0.055;
+    return MIN((int)(encoded * 255.0), 255);
+}
+
+
+/********************************** Measuring **********************************/
+
+/* Pixels per unit of work for the threads */
+#define COMPARE_BAND_PIXELS 4096
+
+typedef struct {
+    reference_t * reference;
+    SRGBTable_t * srgb;
+    input_t * input;
+    float * fast; /* Planar output of the mode */
+    /* Per band */
+    int * max_code_error;
+    double * sum_code_error;
+    double * max_ipt_error;
+    double * sum_ipt_error;
+    size_t * worst_pixel;
+} compare_job_t;
+
+static void compare_band(int Band, void * Data)
+{
+    compare_job_t * job = Data;
+    size_t start = (size_t)Band * COMPARE_BAND_PIXELS;
+    size_t end = MIN(start + COMPARE_BAND_PIXELS, job->input->num_pixels);
+    size_t plane = job->input->num_pixels;
+
+    int max_code = 0;
+    double sum_code = 0.0, max_ipt = 0.0, sum_ipt = 0.0;
+    size_t worst = start;
+    for (size_t i = start; i < end; ++i)
+    {
+        double ref[3], fast[3], ref_ipt[3], fast_ipt[3];
+        reference_pixel(job->reference, job->input->pixels + i * 3, ref);
+        for (int c = 0; c < 3; ++c) fast[c] = job->fast[i + c * plane];
+
+        for (int c = 0; c < 3; ++c)
+        {
+            int error = abs(SRGB_Encode(job->srgb, fast[c]) - reference_code_value(ref[c]));
+            sum_code += error;
+            if (error > max_code) {
+                max_code = error;
+                worst = i;
+            }
+        }
+
+        reference_to_IPT(job->reference, ref, ref_ipt);
+        reference_to_IPT(job->reference, fast, fast_ipt);
+        double ipt_error = 0.0;
+        for (int c = 0; c < 3; ++c) ipt_error += (fast_ipt[c] - ref_ipt[c]) * (fast_ipt[c] - ref_ipt[c]);
+        ipt_error = sqrt(ipt_error);
+        if (!(ipt_error <= max_ipt)) max_ipt = ipt_error; /* NaN counts as worst */
+        sum_ipt += ipt_error;
+    }
+    job->max_code_error[Band] = max_code;
+    job->sum_code_error[Band] = sum_code;
+    job->max_ipt_error[Band] = max_ipt;
+    job->sum_ipt_error[Band] = sum_ipt;
+    job->worst_pixel[Band] = worst;
+}
+
+/* Renders Input with Context and compares it against the reference. Returns 0 on success. */
+static int measure(LDRT_Context_t * Context, reference_t * Reference, SRGBTable_t * SRGB, input_t * Input, int NumThreads, errors_t * Errors)
+{
+    size_t n = Input->num_pixels;
+    int num_bands = (n + COMPARE_BAND_PIXELS - 1) / COMPARE_BAND_PIXELS;
+    compare_job_t job = {
+        .reference = Reference,
+        .srgb = SRGB,
+        .input = Input,
+        .fast = malloc(sizeof(float) * 3 * n),
+        .max_code_error = malloc(sizeof(int) * num_bands),
+        .sum_code_error = malloc(sizeof(double) * num_bands),
+        .max_ipt_error = malloc(sizeof(double) * num_bands),
+        .sum_ipt_error = malloc(sizeof(double) * num_bands),
+        .worst_pixel = malloc(sizeof(size_t) * num_bands)
+    };
+    int error = (job.fast == NULL || job.max_code_error == NULL || job.sum_code_error == NULL
+              || job.max_ipt_error == NULL || job.sum_ipt_error == NULL || job.worst_pixel == NULL);
+
+    if (!error)
+    {
+        float * out[3] = {job.fast, job.fast + n, job.fast + n * 2};
+        LDRT_Image_t in_image = LDRT_InterleavedImage(Input->pixels, n);
+        LDRT_Image_t out_image = LDRT_PlanarImage(out[0], out[1], out[2], n);
+        LDRT_ApplyRect(Context, &in_image, &out_image, 0, 0, n, 1, NumThreads);
+        Util_ParallelFor(num_bands, NumThreads, compare_band, &job);
+
+        *Errors = (errors_t) {0};
+        double sum_code = 0.0, sum_ipt = 0.0;
+        size_t worst = 0;
+        for (int b = 0; b < num_bands; ++b)
+        {
+            if (job.max_code_error[b] > Errors->max_code_error) {
+                Errors->max_code_error = job.max_code_error[b];
+                worst = job.worst_pixel[b];
+            }
+            if (!(job.max_ipt_error[b] <= Errors->max_ipt_error)) Errors->max_ipt_error = job.max_ipt_error[b];
+            sum_code += job.sum_code_error[b];
+            sum_ipt += job.sum_ipt_error[b];
+        }
+        Errors->mean_code_error = sum_code / (3.0 * n);
+        Errors->mean_ipt_error = sum_ipt / n;
+        memcpy(Errors->worst_pixel, Input->pixels + worst * 3, sizeof(float) * 3);
+    }
+
+    free(job.fast);
+    free(job.max_code_error);
+    free(job.sum_code_error);
+    free(job.max_ipt_error);
+    free(job.sum_ipt_error);
+    free(job.worst_pixel);
+    return error;
+}
+
+
+/*********************************** Inputs ***********************************/
+
+static input_t * add_input(accuracy_options_t * Options, char * Name, size_t NumPixels)
+{
+    if (Options->num_inputs == MAX_INPUTS) return NULL;
+    input_t * input = &Options->inputs[Options->num_inputs];
+    snprintf(input->name, sizeof(input->name), "%s", Name);
+    input->num_pixels = NumPixels;
+    input->pixels = malloc(sizeof(float) * 3 * NumPixels);
+    if (input->pixels == NULL) return NULL;
+    ++Options->num_inputs;
+    return input;
+}
+
+/* Every combination of Steps values per channel */
+static int add_sweep(accuracy_options_t * Options, int Steps)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "sweep %i^3", Steps);
+    input_t * input = add_input(Options, name, (size_t)Steps * Steps * Steps);
+    if (input == NULL) return 1;
+
+    float values[Steps];
+    values[0] = 0.0f;
+    for (int v = 1; v < Steps; ++v) values[v] = MIDDLE_GREY * exp2(-10.0 + 20.0 * (v - 1) / MAX(Steps - 2, 1));
+    float * pixel = input->pixels;
+    for (int r = 0; r < Steps; ++r)
+    for (int g = 0; g < Steps; ++g)
+    for (int b = 0; b < Steps; ++b)
+    {
+        pixel[0] = values[r];
+        pixel[1] = values[g];
+        pixel[2] = values[b];
+        pixel += 3;
+    }
+    return 0;
+}
+
+static char * base_name(char * Path)
+{
+    char * slash = strrchr(Path, '/');
+    return (slash != NULL) ? slash + 1 : Path;
+}
+
+static int add_exr(accuracy_options_t * Options, char * Path)
+{
+    EXRImage_t exr;
+    if (EXR_Open(&exr, Path)) return 1;
+    input_t * input = add_input(Options, base_name(Path), (size_t)exr.width * exr.height);
+    int error = (input == NULL);
+    if (!error) {
+        float * p = input->pixels;
+        float * out[3] = {p, p + 1, p + 2};
+        error = EXR_ReadRGB(&exr, 0, exr.height, out, 3, Options->parameters.num_threads);
+    }
+    EXR_Close(&exr);
+    return error;
+}
+
+static int add_raw(accuracy_options_t * Options, char * Path, int Width, int Height)
+{
+    uint64_t size;
+    float * raw = Util_MapFile(Path, &size);
+    if (raw == NULL) return 1;
+    size_t num_pixels = (size_t)Width * Height;
+    input_t * input = NULL;
+    if (Width > 0 && Height > 0 && size >= sizeof(float) * 3 * num_pixels) input = add_input(Options, base_name(Path), num_pixels);
+    if (input != NULL) memcpy(input->pixels, raw, sizeof(float) * 3 * num_pixels);
+    Util_UnmapFile(raw, size);
+    return (input == NULL);
+}
+
+
+/*********************************** Main ***********************************/
+
+static int parse_modes(accuracy_options_t * Options, char * List)
+{
+    Options->num_modes = 0;
+    char * save = NULL;
+    for (char * name = strtok_r(List, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save))
+    {
+        if (Options->num_modes == MAX_MODES) return 1;
+        accuracy_mode_t * mode = &Options->modes[Options->num_modes++];
+        int size;
+        /* Tolerances are just above what each mode measures with the default
+         * parameters and sweep, so any change that makes it worse fails. The paths
+         * are packed exactly, so high and exact are only float rounding, lut3d is for
+         * the default size of 33 (its error depends a lot on the parameters, from
+         * 10 to nearly 40 code values, so other settings need their own). */
+        if (!strcmp(name, "high"))
+            *mode = (accuracy_mode_t) {.name = "high", .max_code_error = 1, .mean_code_error = 0.001, .max_ipt_error = 0.0001, .mean_ipt_error = 0.000001};
+        else if (!strcmp(name, "exact"))
+            *mode = (accuracy_mode_t) {.name = "exact", .precision = LDRT_PRECISION_EXACT, .max_code_error = 1, .mean_code_error = 0.001, .max_ipt_error = 0.0001, .mean_ipt_error = 0.000001};
+        else if (!strcmp(name, "fast"))
+            *mode = (accuracy_mode_t) {.name = "fast", .precision = LDRT_PRECISION_FAST, .max_code_error = 2, .mean_code_error = 0.05, .max_ipt_error = 0.005, .mean_ipt_error = 0.0001};
+        else if (!strcmp(name, "tone"))
+            *mode = (accuracy_mode_t) {.name = "tone", .tone_table = 1, .max_code_error = 1, .mean_code_error = 0.002, .max_ipt_error = 0.0002, .mean_ipt_error = 0.000005};
+        else if (sscanf(name, "lut3d:%d", &size) == 1 && size > 1)
+            *mode = (accuracy_mode_t) {.lut3d_size = size, .max_code_error = 15, .mean_code_error = 0.7, .max_ipt_error = 0.04, .mean_ipt_error = 0.004};
+        else return 1;
+        if (mode->lut3d_size) snprintf(mode->name, sizeof(mode->name), "lut3d:%i", mode->lut3d_size);
+    }
+    return (Options->num_modes == 0);
+}
+
+static void apply_overrides(accuracy_options_t * Options, accuracy_mode_t * Mode)
+{
+    if (Options->max_code_error >= 0) Mode->max_code_error = Options->max_code_error;
+    if (Options->mean_code_error >= 0) Mode->mean_code_error = Options->mean_code_error;
+    if (Options->max_ipt_error >= 0) Mode->max_ipt_error = Options->max_ipt_error;
+    if (Options->mean_ipt_error >= 0) Mode->mean_ipt_error = Options->mean_ipt_error;
+}
+
+int main(int argc, char ** argv)
+{
+    static accuracy_options_t options;
+    options.sweep_steps = 33;
+    options.max_code_error = -1;
+    options.mean_code_error = options.max_ipt_error = options.mean_ipt_error = -1.0;
+    LDRT_DefaultParameters(&options.parameters);
+    char default_modes[] = "high,exact,fast,tone,lut3d:33";
+    if (parse_modes(&options, default_modes)) return 1;
+
+    for (int a = 1; a < argc; ++a)
+    {
+        int error = 0;
+        if (!strcmp(argv[a], "--modes") && a+1 < argc) error = parse_modes(&options, argv[++a]);
+        else if (!strcmp(argv[a], "--sweep") && a+1 < argc) options.sweep_steps = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--exr") && a+1 < argc) error = add_exr(&options, argv[++a]);
+        else if (!strcmp(argv[a], "--raw") && a+3 < argc) {
+            error = add_raw(&options, argv[a+1], atoi(argv[a+2]), atoi(argv[a+3]));
+            a += 3;
+        }
+        else if (!strcmp(argv[a], "--saturation") && a+1 < argc) options.parameters.saturation = atof(argv[++a]);
+        else if (!strcmp(argv[a], "--slope") && a+1 < argc) options.parameters.slope = atof(argv[++a]);
+        else if (!strcmp(argv[a], "--smoothness") && a+1 < argc) options.parameters.smoothness = atof(argv[++a]);
+        else if (!strcmp(argv[a], "--exposure") && a+1 < argc) options.parameters.exposure = atof(argv[++a]);
+        else if (!strcmp(argv[a], "--lut-resolution") && a+1 < argc) options.parameters.lut_resolution = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--threads") && a+1 < argc) options.parameters.num_threads = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--max-code-error") && a+1 < argc) options.max_code_error = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--mean-code-error") && a+1 < argc) options.mean_code_error = atof(argv[++a]);
+        else if (!strcmp(argv[a], "--max-ipt-error") && a+1 < argc) options.max_ipt_error = atof(argv[++a]);
+        else if (!strcmp(argv[a], "--mean-ipt-error") && a+1 < argc) options.mean_ipt_error = atof(argv[++a]);
+        else if (!strcmp(argv[a], "--json") && a+1 < argc) options.json_path = argv[++a];
+        else error = 1;
+        if (error) {
+            printf("Bad argument or unreadable image %s (modes are high, exact, fast, tone and lut3d:N)\n", argv[a]);
+            return 1;
+        }
+    }
+    if (options.sweep_steps > 1 && add_sweep(&options, options.sweep_steps)) {
+        printf("Out of memory for the sweep\n");
+        return 1;
+    }
+    if (options.num_inputs == 0) {
+        printf("Nothing to measure\n");
+        return 1;
+    }
+
+    FILE * json = NULL;
+    if (options.json_path != NULL && (json = fopen(options.json_path, "w")) == NULL) {
+        printf("Could not create %s\n", options.json_path);
+        return 1;
+    }
+
+    reference_t reference;
+    if (init_reference(&reference, &options.parameters)) {
+        printf("Could not build the paths LUT\n");
+        return 1;
+    }
+    SRGBTable_t srgb;
+    init_SRGBTable(&srgb);
+
+    LDRT_Parameters_t * p = &options.parameters;
+    printf("saturation %g, slope %g, smoothness %g, exposure %g, lut resolution %i\n\n",
+           p->saturation, p->slope, p->smoothness, p->exposure, p->lut_resolution);
+    printf("%-12s %-20s %10s %10s %12s %12s  %s\n", "mode", "input", "max code", "mean code", "max IPT", "mean IPT", "result");
+    if (json != NULL) {
+        fprintf(json, "{\n  \"saturation\": %g,\n  \"slope\": %g,\n  \"smoothness\": %g,\n  \"exposure\": %g,\n  \"lut_resolution\": %i,\n  \"results\": [",
+                p->saturation, p->slope, p->smoothness, p->exposure, p->lut_resolution);
+    }
+
+    int num_failed = 0, num_results = 0;
+    for (int m = 0; m < options.num_modes; ++m)
+    {
+        accuracy_mode_t * mode = &options.modes[m];
+        apply_overrides(&options, mode);
+        LDRT_Parameters_t parameters = options.parameters;
+        parameters.precision = mode->precision;
+        parameters.tone_table = mode->tone_table;
+        parameters.lut3d_size = mode->lut3d_size;
+        LDRT_Context_t * context = LDRT_Create(&parameters);
+        if (context == NULL) {
+            printf("Could not create the transform for %s\n", mode->name);
+            return 1;
+        }
+
+        for (int i = 0; i < options.num_inputs; ++i)
+        {
+            input_t * input = &options.inputs[i];
+            errors_t errors;
+            if (measure(context, &reference, &srgb, input, p->num_threads, &errors)) {
+                printf("Out of memory for %s\n", input->name);
+                return 1;
+            }
+            errors.passed = errors.max_code_error <= mode->max_code_error && errors.mean_code_error <= mode->mean_code_error
+                         && errors.max_ipt_error <= mode->max_ipt_error && errors.mean_ipt_error <= mode->mean_ipt_error;
+            num_failed += !errors.passed;
+
+            printf("%-12s %-20s %10i %10.4f %12.6f %12.6f  %s", mode->name, input->name, errors.max_code_error,
+                   errors.mean_code_error, errors.max_ipt_error, errors.mean_ipt_error, errors.passed ? "ok" : "FAIL");
+            if (errors.max_code_error > 0)
+                printf(" (worst at %g %g %g)", errors.worst_pixel[0], errors.worst_pixel[1], errors.worst_pixel[2]);
+            printf("\n");
+
+            if (json != NULL) {
+                fprintf(json, "%s\n    {\"mode\": \"%s\", \"input\": \"%s\", \"pixels\": %zu, \"max_code_error\": %i, \"mean_code_error\": %.6f, "
+                        "\"max_ipt_error\": %.9f, \"mean_ipt_error\": %.9f, \"worst_pixel\": [%g, %g, %g], \"passed\": %s}",
+                        num_results ? "," : "", mode->name, input->name, input->num_pixels, errors.max_code_error, errors.mean_code_error,
+                        errors.max_ipt_error, errors.mean_ipt_error, errors.worst_pixel[0], errors.worst_pixel[1], errors.worst_pixel[2],
+                        errors.passed ? "true" : "false");
+            }
+            ++num_results;
+        }
+        printf("%-12s tolerances: max code %i, mean code %g, max IPT %g, mean IPT %g\n\n", mode->name,
+               mode->max_code_error, mode->mean_code_error, mode->max_ipt_error, mode->mean_ipt_error);
+        LDRT_Destroy(context);
+    }
+
+    if (json != NULL) {
+        fprintf(json, "\n  ],\n  \"failed\": %i\n}\n", num_failed);
+        fclose(json);
+    }
+    free(reference.paths);
+    for (int i = 0; i < options.num_inputs; ++i) free(options.inputs[i].pixels);
+
+    if (num_failed) printf("%i of %i outside tolerance\n", num_failed, num_results);
+    return (num_failed != 0);
+}
@@ -0,0 +1,445 @@
+/*
+    LuminanceDRT - Luminance based image formation
+    Copyright (C) 2022  Ilia Sibiryakov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; strictly version 2 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/*
+Benchmark of the stages of process_data on synthetic images, for catching
+performance regressions:
+
+    benchmark [--sizes WxH,...] [--images NAME,...] [--runs N] [--threads N]
+              [--format EXT] [--bit-depth N] [--lut3d N] [--precision NAME]
+              [--tone-table] [--lut-resolution N]
+              [--output DIR] [--json FILE]
+
+Every stage is run once to warm up and then --runs times, the median is what
+Mpix/s and ns/pixel are worked out from (wall clock, so ns/pixel goes down with
+more threads). The images are made from a fixed seed, so they are the same every
+time and on every machine.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "ImageWriter.h"
+#include "LuminanceDRT.h"
+#include "Utilities/Utilities.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+#define MAX_SIZES 16
+#define MAX_RUNS 1000
+#define BENCHMARK_SEED 0x4C445254
+
+/* Synthetic scene linear images */
+enum {
+    IMAGE_GRADIENT, /* Exposure from -10 to +10 stops across, every hue down */
+    IMAGE_PRIMARIES, /* Blocks of fully saturated primaries and secondaries at 20 exposures */
+    IMAGE_NOISE, /* Every channel random over 2^-12 to 2^12 */
+    IMAGE_FLAT, /* All middle grey */
+    NUM_IMAGES
+};
+
+static char * image_names[NUM_IMAGES] = {"gradient", "primaries", "noise", "flat"};
+
+typedef struct {
+    int sizes[MAX_SIZES][2];
+    int num_sizes;
+    int use_image[NUM_IMAGES];
+    int runs;
+    int num_threads;
+    char * format; /* Extension of the encoded file */
+    int bit_depth;
+    int lut3d_size;
+    int precision; /* LDRT_PRECISION_... */
+    int tone_table;
+    int lut_resolution;
+    char * output_dir; /* Where the encoded files go (and are deleted from) */
+    char * json_path;
+} benchmark_options_t;
+
+/* Seconds for each run of a stage */
+typedef struct {
+    double seconds[MAX_RUNS];
+    int runs;
+} timing_t;
+
+/* xorshift32, so the noise is the same everywhere */
+static uint32_t next_random(uint32_t * State)
+{
+    uint32_t x = *State;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return (*State = x);
+}
+
+static float random_float(uint32_t * State)
+{
+    return (next_random(State) >> 8) * (1.0f / (1 << 24));
+}
+
+/* Interleaved RGB */
+static void generate_image(int Image, float * RGB, int Width, int Height)
+{
+    uint32_t state = BENCHMARK_SEED;
+    for (int y = 0; y < Height; ++y)
+    for (int x = 0; x < Width; ++x)
+    {
+        float * pixel = RGB + ((size_t)y * Width + x) * 3;
+        switch (Image)
+        {
+            case IMAGE_GRADIENT: {
+                float stops = -10.0f + 20.0f * x / MAX(Width - 1, 1);
+                Util_HSVToRGB((float)y / Height, 1.0f, 0.18f * exp2f(stops), pixel);
+                break;
+            }
+            case IMAGE_PRIMARIES: {
+                /* R, Y, G, C, B, M across, exposure down */
+                int block = x * 6 / Width;
+                float stops = -10.0f + (y * 20 / Height);
+                float v = 0.18f * exp2f(stops);
+                pixel[0] = (block <= 1 || block == 5) ? v : 0.0f;
+                pixel[1] = (block >= 1 && block <= 3) ? v : 0.0f;
+                pixel[2] = (block >= 3) ? v : 0.0f;
+                break;
+            }
+            case IMAGE_NOISE:
+                for (int c = 0; c < 3; ++c) pixel[c] = exp2f(-12.0f + 24.0f * random_float(&state));
+                break;
+            case IMAGE_FLAT:
+                pixel[0] = pixel[1] = pixel[2] = 0.18f;
+                break;
+        }
+    }
+}
+
+static int compare_doubles(const void * A, const void * B)
+{
+    double a = *(const double *)A, b = *(const double *)B;
+    return (a > b) - (a < b);
+}
+
+static double timing_median(timing_t * Timing)
+{
+    double sorted[MAX_RUNS];
+    memcpy(sorted, Timing->seconds, sizeof(double) * Timing->runs);
+    qsort(sorted, Timing->runs, sizeof(double), compare_doubles);
+    int middle = Timing->runs / 2;
+    return (Timing->runs & 1) ? sorted[middle] : 0.5 * (sorted[middle-1] + sorted[middle]);
+}
+
+static double timing_min(timing_t * Timing)
+{
+    double min = Timing->seconds[0];
+    for (int r = 1; r < Timing->runs; ++r) min = MIN(min, Timing->seconds[r]);
+    return min;
+}
+
+static double timing_mean(timing_t * Timing)
+{
+    double sum = 0.0;
+    for (int r = 0; r < Timing->runs; ++r) sum += Timing->seconds[r];
+    return sum / Timing->runs;
+}
+
+
+/*********************************** Stages ***********************************/
+
+typedef struct {
+    benchmark_options_t * options;
+    LDRT_Context_t * context;
+    float * in; /* Interleaved */
+    float * out; /* Planar, rendered */
+    int width, height;
+    char path[4096]; /* Of the encoded file */
+    ImageWriter_t writer;
+} stage_t;
+
+/* Rows per unit of work for the threads encoding */
+#define ENCODE_BAND_ROWS 16
+
+static void encode_band(int Band, void * Data)
+{
+    stage_t * stage = Data;
+    size_t plane = (size_t)stage->width * stage->height;
+    int row_end = MIN((Band + 1) * ENCODE_BAND_ROWS, stage->height);
+    for (int y = Band * ENCODE_BAND_ROWS; y < row_end; ++y)
+    {
+        float * row = stage->out + (size_t)y * stage->width;
+        float * rgb[3] = {row, row + plane, row + plane * 2};
+        ImageWriter_Encode(&stage->writer, rgb, y, 0, stage->width);
+    }
+}
+
+static void encode_pixels(void * Writer, float * const * RGB, int X, int Y, int NumPixels)
+{
+    ImageWriter_Encode(Writer, RGB, Y, X, NumPixels);
+}
+
+static int open_output(stage_t * Stage)
+{
+    benchmark_options_t * options = Stage->options;
+    int format = ImageWriter_FormatFromPath(Stage->path);
+    return ImageWriter_Open(&Stage->writer, Stage->path, format, options->bit_depth, Stage->width, Stage->height, Stage->height);
+}
+
+static int close_output(stage_t * Stage)
+{
+    int error = ImageWriter_WriteRows(&Stage->writer, 0, Stage->height);
+    error |= ImageWriter_Close(&Stage->writer);
+    unlink(Stage->path);
+    return error;
+}
+
+/* The render alone, into planar floats */
+static int stage_render(stage_t * Stage)
+{
+    LDRT_Image_t in = LDRT_InterleavedImage(Stage->in, Stage->width);
+    size_t plane = (size_t)Stage->width * Stage->height;
+    LDRT_Image_t out = LDRT_PlanarImage(Stage->out, Stage->out + plane, Stage->out + plane * 2, Stage->width);
+    LDRT_ApplyRect(Stage->context, &in, &out, 0, 0, Stage->width, Stage->height, Stage->options->num_threads);
+    return 0;
+}
+
+/* Encoding the rendered floats and writing the file */
+static int stage_encode(stage_t * Stage)
+{
+    if (open_output(Stage)) return 1;
+    int num_bands = (Stage->height + ENCODE_BAND_ROWS - 1) / ENCODE_BAND_ROWS;
+    Util_ParallelFor(num_bands, Stage->options->num_threads, encode_band, Stage);
+    return close_output(Stage);
+}
+
+/* Both at once, the way process_data does it */
+static int stage_fused(stage_t * Stage)
+{
+    if (open_output(Stage)) return 1;
+    LDRT_Image_t in = LDRT_InterleavedImage(Stage->in, Stage->width);
+    LDRT_ApplyToSink(Stage->context, &in, 0, 0, Stage->width, Stage->height, encode_pixels, &Stage->writer, Stage->options->num_threads);
+    return close_output(Stage);
+}
+
+enum {
+    STAGE_RENDER,
+    STAGE_ENCODE,
+    STAGE_FUSED,
+    NUM_STAGES
+};
+
+static char * stage_names[NUM_STAGES] = {"render", "encode", "render+encode"};
+static int (*stage_functions[NUM_STAGES])(stage_t *) = {stage_render, stage_encode, stage_fused};
+
+/* A warm up run, then the timed ones. Returns 0 on success. */
+static int time_stage(int (*Function)(stage_t *), stage_t * Stage, timing_t * Timing)
+{
+    if (Function(Stage)) return 1;
+    Timing->runs = Stage->options->runs;
+    for (int r = 0; r < Timing->runs; ++r)
+    {
+        double start = Util_GetSeconds();
+        if (Function(Stage)) return 1;
+        Timing->seconds[r] = Util_GetSeconds() - start;
+    }
+    return 0;
+}
+
+
+/*********************************** Main ***********************************/
+
+static int parse_sizes(benchmark_options_t * Options, char * List)
+{
+    Options->num_sizes = 0;
+    for (char * p = List; *p;)
+    {
+        int width, height, length;
+        if (Options->num_sizes == MAX_SIZES || sscanf(p, "%dx%d%n", &width, &height, &length) != 2 || width < 1 || height < 1) return 1;
+        Options->sizes[Options->num_sizes][0] = width;
+        Options->sizes[Options->num_sizes][1] = height;
+        ++Options->num_sizes;
+        p += length;
+        if (*p == ',') ++p;
+        else if (*p) return 1;
+    }
+    return (Options->num_sizes == 0);
+}
+
+static int parse_images(benchmark_options_t * Options, char * List)
+{
+    memset(Options->use_image, 0, sizeof(Options->use_image));
+    int any = 0;
+    char * save = NULL;
+    for (char * name = strtok_r(List, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save))
+    {
+        int i = 0;
+        while (i < NUM_IMAGES && strcmp(name, image_names[i])) ++i;
+        if (i == NUM_IMAGES) return 1;
+        Options->use_image[i] = any = 1;
+    }
+    return !any;
+}
+
+static void write_timing_json(FILE * File, timing_t * Timing, double Pixels)
+{
+    double median = timing_median(Timing);
+    fprintf(File, "\"median_s\": %.9f, \"min_s\": %.9f, \"mean_s\": %.9f", median, timing_min(Timing), timing_mean(Timing));
+    if (Pixels > 0) fprintf(File, ", \"mpix_per_s\": %.3f, \"ns_per_pixel\": %.3f", Pixels / median * 1e-6, median * 1e9 / Pixels);
+}
+
+int main(int argc, char ** argv)
+{
+    benchmark_options_t options = {
+        .sizes = {{256, 256}, {1920, 1080}, {3840, 2160}},
+        .num_sizes = 3,
+        .use_image = {1, 1, 1, 1},
+        .runs = 5,
+        .format = "bmp",
+        .lut_resolution = LDRT_DEFAULT_LUT_RESOLUTION,
+        .output_dir = "/tmp"
+    };
+    for (int a = 1; a < argc; ++a)
+    {
+        int error = 0;
+        if (!strcmp(argv[a], "--sizes") && a+1 < argc) error = parse_sizes(&options, argv[++a]);
+        else if (!strcmp(argv[a], "--images") && a+1 < argc) error = parse_images(&options, argv[++a]);
+        else if (!strcmp(argv[a], "--runs") && a+1 < argc) options.runs = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--threads") && a+1 < argc) options.num_threads = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--format") && a+1 < argc) options.format = argv[++a];
+        else if (!strcmp(argv[a], "--bit-depth") && a+1 < argc) options.bit_depth = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--lut3d") && a+1 < argc) options.lut3d_size = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--precision") && a+1 < argc) {
+            ++a;
+            if (!strcmp(argv[a], "high")) options.precision = LDRT_PRECISION_HIGH;
+            else if (!strcmp(argv[a], "exact")) options.precision = LDRT_PRECISION_EXACT;
+            else if (!strcmp(argv[a], "fast")) options.precision = LDRT_PRECISION_FAST;
+            else error = 1;
+        }
+        else if (!strcmp(argv[a], "--tone-table")) options.tone_table = 1;
+        else if (!strcmp(argv[a], "--lut-resolution") && a+1 < argc) options.lut_resolution = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--output") && a+1 < argc) options.output_dir = argv[++a];
+        else if (!strcmp(argv[a], "--json") && a+1 < argc) options.json_path = argv[++a];
+        else error = 1;
+        if (error) {
+            printf("Bad argument %s (images are gradient, primaries, noise and flat, sizes like 1920x1080,256x256, precisions high, exact and fast)\n", argv[a]);
+            return 1;
+        }
+    }
+    options.runs = MIN(MAX(options.runs, 1), MAX_RUNS);
+    int num_threads = (options.num_threads > 0) ? options.num_threads : Util_GetNumCPUs();
+
+    char probe[64];
+    snprintf(probe, sizeof(probe), "x.%s", options.format);
+    if (ImageWriter_PixelBytes(ImageWriter_FormatFromPath(probe), options.bit_depth) == 0) {
+        printf("Can't write %s at that bit depth\n", options.format);
+        return 1;
+    }
+
+    FILE * json = NULL;
+    if (options.json_path != NULL && (json = fopen(options.json_path, "w")) == NULL) {
+        printf("Could not create %s\n", options.json_path);
+        return 1;
+    }
+
+    LDRT_Parameters_t parameters;
+    LDRT_DefaultParameters(&parameters);
+    parameters.lut_resolution = options.lut_resolution;
+    parameters.lut3d_size = options.lut3d_size;
+    parameters.precision = options.precision;
+    parameters.tone_table = options.tone_table;
+    parameters.num_threads = options.num_threads;
+
+    /* Building the transform (no cache, so the paths are made every time) */
+    timing_t build = {.runs = options.runs};
+    LDRT_Context_t * context = NULL;
+    for (int r = -1; r < options.runs; ++r)
+    {
+        LDRT_Destroy(context);
+        double start = Util_GetSeconds();
+        context = LDRT_Create(&parameters);
+        if (context == NULL) {
+            printf("Could not create the transform\n");
+            return 1;
+        }
+        if (r >= 0) build.seconds[r] = Util_GetSeconds() - start;
+    }
+
+    printf("%i threads, %i runs, median (min)\n\n", num_threads, options.runs);
+    printf("%-28s %10.3f ms (%.3f)\n\n", "build", timing_median(&build) * 1e3, timing_min(&build) * 1e3);
+    printf("%-14s %-10s %-14s %10s %10s %10s\n", "image", "size", "stage", "ms", "Mpix/s", "ns/pixel");
+
+    if (json != NULL) {
+        fprintf(json, "{\n  \"threads\": %i,\n  \"runs\": %i,\n  \"lut_resolution\": %i,\n  \"lut3d\": %i,\n  \"precision\": %i,\n  \"tone_table\": %i,\n  \"format\": \"%s\",\n  \"bit_depth\": %i,\n",
+                num_threads, options.runs, options.lut_resolution, options.lut3d_size, options.precision, options.tone_table, options.format, options.bit_depth);
+        fprintf(json, "  \"build\": {");
+        write_timing_json(json, &build, 0);
+        fprintf(json, "},\n  \"results\": [");
+    }
+
+    int num_results = 0;
+    for (int s = 0; s < options.num_sizes; ++s)
+    {
+        stage_t stage = {.options = &options, .context = context, .width = options.sizes[s][0], .height = options.sizes[s][1]};
+        size_t num_pixels = (size_t)stage.width * stage.height;
+        stage.in = malloc(sizeof(float) * 3 * num_pixels);
+        stage.out = malloc(sizeof(float) * 3 * num_pixels);
+        if (stage.in == NULL || stage.out == NULL) {
+            printf("Out of memory for %ix%i\n", stage.width, stage.height);
+            return 1;
+        }
+        snprintf(stage.path, sizeof(stage.path), "%s/ldrt_benchmark_%i.%s", options.output_dir, (int)getpid(), options.format);
+
+        for (int i = 0; i < NUM_IMAGES; ++i)
+        {
+            if (!options.use_image[i]) continue;
+            generate_image(i, stage.in, stage.width, stage.height);
+
+            for (int t = 0; t < NUM_STAGES; ++t)
+            {
+                timing_t timing;
+                if (time_stage(stage_functions[t], &stage, &timing)) {
+                    printf("Could not write %s\n", stage.path);
+                    return 1;
+                }
+                double median = timing_median(&timing);
+                char size[32];
+                snprintf(size, sizeof(size), "%ix%i", stage.width, stage.height);
+                printf("%-14s %-10s %-14s %10.3f %10.2f %10.2f\n", image_names[i], size, stage_names[t],
+                       median * 1e3, num_pixels / median * 1e-6, median * 1e9 / num_pixels);
+
+                if (json != NULL) {
+                    fprintf(json, "%s\n    {\"image\": \"%s\", \"width\": %i, \"height\": %i, \"stage\": \"%s\", ",
+                            num_results ? "," : "", image_names[i], stage.width, stage.height, stage_names[t]);
+                    write_timing_json(json, &timing, num_pixels);
+                    fprintf(json, "}");
+                }
+                ++num_results;
+            }
+        }
+        free(stage.in);
+        free(stage.out);
+    }
+
+    if (json != NULL) {
+        fprintf(json, "\n  ]\n}\n");
+        fclose(json);
+    }
+    LDRT_Destroy(context);
+    return 0;
+}
@@ -104,4 +104,4 @@ void ColourPathNormaliseDistance(ColourPath_t * Path, float NormaliseValue)
     float multiplier = NormaliseValue / ColourPathGetLength(Path);
     for (int p = 0; p < Path->num_points; ++p)
         Path->points[p].distance *= multiplier;
-}
\ No newline at end of file
+}
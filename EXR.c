@@ -0,0 +1,780 @@
+/*
+    LuminanceDRT - Luminance based image formation
+    Copyright (C) 2022  Ilia Sibiryakov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; strictly version 2 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* EXR is little endian, so is everything this runs on, values are read with memcpy
+ * because nothing in the file is aligned. */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <zlib.h>
+
+#include "EXR.h"
+#include "Half.h"
+#include "Utilities/Utilities.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+#define EXR_MAGIC 20000630
+#define EXR_VERSION_TILED 0x200
+#define EXR_VERSION_DEEP 0x800
+#define EXR_VERSION_MULTIPART 0x1000
+
+enum { EXR_UINT = 0, EXR_HALF = 1, EXR_FLOAT = 2 };
+enum { EXR_NO_COMPRESSION = 0, EXR_RLE = 1, EXR_ZIPS = 2, EXR_ZIP = 3, EXR_PIZ = 4 };
+
+static uint32_t read_u32(uint8_t * P) { uint32_t v; memcpy(&v, P, 4); return v; }
+static uint64_t read_u64(uint8_t * P) { uint64_t v; memcpy(&v, P, 8); return v; }
+static uint16_t read_u16(uint8_t * P) { uint16_t v; memcpy(&v, P, 2); return v; }
+
+/* Length of a string that must end before End, -1 if it doesn't */
+static int string_length(uint8_t * P, uint8_t * End)
+{
+    uint8_t * s = memchr(P, 0, End - P);
+    return (s == NULL) ? -1 : (int)(s - P);
+}
+
+/* Reads the channel list, finds R, G and B */
+static int parse_channels(EXRImage_t * EXR, uint8_t * P, uint8_t * End)
+{
+    int y_channel = -1;
+    for (int c = 0; c < 3; ++c) EXR->rgb_channel[c] = -1;
+
+    /* Count them first */
+    EXR->num_channels = 0;
+    for (uint8_t * p = P; p < End && *p; ++EXR->num_channels) {
+        int len = string_length(p, End);
+        if (len < 0 || p + len + 1 + 16 > End) return 1;
+        p += len + 1 + 16;
+    }
+    if (EXR->num_channels == 0) return 1;
+
+    EXR->channel_type = malloc(sizeof(int) * EXR->num_channels);
+    EXR->channel_offset = malloc(sizeof(int) * EXR->num_channels);
+    if (EXR->channel_type == NULL || EXR->channel_offset == NULL) return 1;
+
+    EXR->bytes_per_pixel = 0;
+    for (int c = 0; c < EXR->num_channels; ++c)
+    {
+        char * name = (char *)P;
+        P += strlen(name) + 1;
+        int type = read_u32(P);
+        int x_sampling = read_u32(P + 8);
+        int y_sampling = read_u32(P + 12);
+        P += 16;
+
+        /* Subsampled channels would change the size of every line */
+        if (type < EXR_UINT || type > EXR_FLOAT || x_sampling != 1 || y_sampling != 1) return 1;
+
+        EXR->channel_type[c] = type;
+        EXR->channel_offset[c] = EXR->bytes_per_pixel;
+        EXR->bytes_per_pixel += (type == EXR_HALF) ? 2 : 4;
+
+        if (!strcmp(name, "R")) EXR->rgb_channel[0] = c;
+        else if (!strcmp(name, "G")) EXR->rgb_channel[1] = c;
+        else if (!strcmp(name, "B")) EXR->rgb_channel[2] = c;
+        else if (!strcmp(name, "Y")) y_channel = c;
+    }
+
+    if (EXR->rgb_channel[0] < 0 || EXR->rgb_channel[1] < 0 || EXR->rgb_channel[2] < 0)
+    {
+        if (y_channel < 0) return 1;
+        for (int c = 0; c < 3; ++c) EXR->rgb_channel[c] = y_channel;
+    }
+    return 0;
+}
+
+int EXR_Open(EXRImage_t * EXR, char * Path)
+{
+    memset(EXR, 0, sizeof(EXRImage_t));
+    EXR->compression = -1;
+
+    EXR->file = Util_MapFile(Path, &EXR->file_size);
+    if (EXR->file == NULL) return 1;
+    uint8_t * end = EXR->file + EXR->file_size;
+
+    if (EXR->file_size < 8 || read_u32(EXR->file) != EXR_MAGIC) goto fail;
+    uint32_t version = read_u32(EXR->file + 4);
+    if (version & (EXR_VERSION_TILED | EXR_VERSION_DEEP | EXR_VERSION_MULTIPART)) goto fail;
+
+    /* Header is a list of attributes: name, type, size, value. Ends with an empty name. */
+    int have_window = 0, have_channels = 0;
+    uint8_t * p = EXR->file + 8;
+    while (p < end && *p)
+    {
+        char * name = (char *)p;
+        int name_length = string_length(p, end);
+        if (name_length < 0) goto fail;
+        p += name_length + 1;
+        int type_length = string_length(p, end);
+        if (type_length < 0 || p + type_length + 1 + 4 > end) goto fail;
+        p += type_length + 1;
+        uint32_t size = read_u32(p);
+        p += 4;
+        if (size > (uint64_t)(end - p)) goto fail;
+
+        if (!strcmp(name, "channels")) {
+            if (parse_channels(EXR, p, p + size)) goto fail;
+            have_channels = 1;
+        }
+        else if (!strcmp(name, "compression") && size >= 1) {
+            EXR->compression = p[0];
+        }
+        else if (!strcmp(name, "dataWindow") && size >= 16) {
+            int32_t window[4];
+            memcpy(window, p, 16);
+            EXR->min_x = window[0];
+            EXR->min_y = window[1];
+            EXR->width = window[2] - window[0] + 1;
+            EXR->height = window[3] - window[1] + 1;
+            have_window = 1;
+        }
+        p += size;
+    }
+    if (p >= end || !have_window || !have_channels || EXR->width < 1 || EXR->height < 1) goto fail;
+    ++p; /* The empty name */
+
+    switch (EXR->compression)
+    {
+        case EXR_NO_COMPRESSION:
+        case EXR_RLE:
+        case EXR_ZIPS: EXR->lines_per_chunk = 1; break;
+        case EXR_ZIP: EXR->lines_per_chunk = 16; break;
+        case EXR_PIZ: EXR->lines_per_chunk = 32; break;
+        default: goto fail;
+    }
+
+    /* Followed by the offset of every chunk */
+    EXR->num_chunks = (EXR->height + EXR->lines_per_chunk - 1) / EXR->lines_per_chunk;
+    if ((uint64_t)(end - p) < (uint64_t)EXR->num_chunks * 8) goto fail;
+    EXR->chunk_table = p;
+    return 0;
+
+fail:
+    EXR_Close(EXR);
+    return 1;
+}
+
+void EXR_Close(EXRImage_t * EXR)
+{
+    Util_UnmapFile(EXR->file, EXR->file_size);
+    free(EXR->channel_type);
+    free(EXR->channel_offset);
+    EXR->file = NULL;
+    EXR->channel_type = NULL;
+    EXR->channel_offset = NULL;
+}
+
+
+/***************************** RLE and ZIP *****************************/
+
+/* Bytes are stored as a signed count, then either count+1 copies of the next byte,
+ * or -count literal bytes */
+static int rle_uncompress(uint8_t * In, int InSize, uint8_t * Out, int OutSize)
+{
+    uint8_t * in_end = In + InSize;
+    uint8_t * out_end = Out + OutSize;
+    while (In < in_end)
+    {
+        int count = (int8_t)*In++;
+        if (count < 0) {
+            count = -count;
+            if (In + count > in_end || Out + count > out_end) return 1;
+            memcpy(Out, In, count);
+            In += count;
+        } else {
+            count += 1;
+            if (In >= in_end || Out + count > out_end) return 1;
+            memset(Out, *In++, count);
+        }
+        Out += count;
+    }
+    return (Out != out_end);
+}
+
+/* RLE and ZIP store bytes delta coded, with the even and odd bytes in two halves */
+static void undo_predictor(uint8_t * In, uint8_t * Out, int Size)
+{
+    for (int i = 1; i < Size; ++i) In[i] = In[i-1] + In[i] - 128;
+
+    uint8_t * first = In;
+    uint8_t * second = In + (Size + 1) / 2;
+    for (int i = 0; i < Size; ++i) Out[i] = (i & 1) ? *second++ : *first++;
+}
+
+
+/******************************** PIZ *********************************/
+
+/* PIZ is: a bitmap of which 16 bit values occur, Huffman coded data in which those
+ * values are numbered 0..n, and under that, a Haar wavelet transform per channel.
+ * It all works on 16 bit words, floats are two words per pixel. */
+
+#define PIZ_BITMAP_SIZE 8192
+#define PIZ_USHORT_RANGE 65536
+
+#define HUF_ENCSIZE ((1 << 16) + 1)
+#define HUF_DECBITS 14
+#define HUF_DECSIZE (1 << HUF_DECBITS)
+#define HUF_DECMASK (HUF_DECSIZE - 1)
+#define HUF_SHORT_ZEROCODE_RUN 59
+#define HUF_LONG_ZEROCODE_RUN 63
+#define HUF_SHORTEST_LONG_RUN (2 + HUF_LONG_ZEROCODE_RUN - HUF_SHORT_ZEROCODE_RUN)
+
+/* Codes are stored as (code << 6) | length */
+#define huf_length(C) ((int)((C) & 63))
+#define huf_code(C) ((C) >> 6)
+
+/* Codes up to HUF_DECBITS long are looked up directly, longer ones are found by
+ * trying every long code that starts with the same HUF_DECBITS bits */
+typedef struct {
+    int len;
+    int lit; /* The symbol, or the number of long codes */
+    int * p; /* The long codes */
+} huf_dec_t;
+
+typedef struct {
+    uint64_t codes[HUF_ENCSIZE];
+    huf_dec_t table[HUF_DECSIZE];
+    int * long_codes;
+} huf_decoder_t;
+
+static uint64_t get_bits(int NumBits, uint64_t * C, int * LC, uint8_t ** In)
+{
+    while (*LC < NumBits) {
+        *C = (*C << 8) | *(*In)++;
+        *LC += 8;
+    }
+    *LC -= NumBits;
+    return (*C >> *LC) & ((1 << NumBits) - 1);
+}
+
+/* Turns code lengths into canonical codes */
+static void huf_canonical_codes(uint64_t * Codes)
+{
+    uint64_t n[59] = {0};
+    for (int i = 0; i < HUF_ENCSIZE; ++i) n[Codes[i]] += 1;
+
+    uint64_t c = 0;
+    for (int i = 58; i > 0; --i) {
+        uint64_t next = (c + n[i]) >> 1;
+        n[i] = c;
+        c = next;
+    }
+
+    for (int i = 0; i < HUF_ENCSIZE; ++i) {
+        int l = Codes[i];
+        if (l > 0) Codes[i] = l | (n[l]++ << 6);
+    }
+}
+
+/* Code lengths are stored as 6 bit values, with runs of zeros packed */
+static int huf_unpack_codes(uint8_t ** In, uint8_t * End, int Min, int Max, uint64_t * Codes)
+{
+    memset(Codes, 0, sizeof(uint64_t) * HUF_ENCSIZE);
+    uint8_t * p = *In;
+    uint64_t c = 0;
+    int lc = 0;
+
+    for (; Min <= Max; ++Min)
+    {
+        /* get_bits reads at most one byte */
+        if (lc < 6 && p >= End) return 1;
+        uint64_t l = Codes[Min] = get_bits(6, &c, &lc, &p);
+
+        if (l >= HUF_SHORT_ZEROCODE_RUN)
+        {
+            if (l == HUF_LONG_ZEROCODE_RUN && lc < 8 && p >= End) return 1;
+            int zero_run = (l == HUF_LONG_ZEROCODE_RUN)
+                         ? (int)get_bits(8, &c, &lc, &p) + HUF_SHORTEST_LONG_RUN
+                         : (int)l - HUF_SHORT_ZEROCODE_RUN + 2;
+            if (Min + zero_run > Max + 1) return 1;
+            while (zero_run--) Codes[Min++] = 0;
+            --Min;
+        }
+    }
+
+    *In = p;
+    huf_canonical_codes(Codes);
+    return 0;
+}
+
+static int huf_build_table(huf_decoder_t * Dec, int Min, int Max)
+{
+    memset(Dec->table, 0, sizeof(Dec->table));
+
+    /* Count the long codes under each entry first, so they can share one array */
+    int num_long = 0;
+    for (int i = Min; i <= Max; ++i)
+    {
+        uint64_t c = huf_code(Dec->codes[i]);
+        int l = huf_length(Dec->codes[i]);
+        if (c >> l) return 1;
+
+        if (l > HUF_DECBITS)
+        {
+            huf_dec_t * entry = Dec->table + (c >> (l - HUF_DECBITS));
+            if (entry->len) return 1;
+            entry->lit++;
+            num_long++;
+        }
+        else if (l)
+        {
+            huf_dec_t * entry = Dec->table + (c << (HUF_DECBITS - l));
+            for (int e = 1 << (HUF_DECBITS - l); e > 0; --e, ++entry) {
+                if (entry->len || entry->lit) return 1;
+                entry->len = l;
+                entry->lit = i;
+            }
+        }
+    }
+
+    Dec->long_codes = malloc(sizeof(int) * (num_long + 1));
+    if (Dec->long_codes == NULL) return 1;
+    int * next = Dec->long_codes;
+    for (int e = 0; e < HUF_DECSIZE; ++e) {
+        if (Dec->table[e].len == 0 && Dec->table[e].lit) {
+            Dec->table[e].p = next;
+            next += Dec->table[e].lit;
+            Dec->table[e].lit = 0;
+        }
+    }
+    for (int i = Min; i <= Max; ++i)
+    {
+        int l = huf_length(Dec->codes[i]);
+        if (l > HUF_DECBITS) {
+            huf_dec_t * entry = Dec->table + (huf_code(Dec->codes[i]) >> (l - HUF_DECBITS));
+            entry->p[entry->lit++] = i;
+        }
+    }
+    return 0;
+}
+
+/* Outputs a symbol, the run length code repeats the previous symbol */
+static int huf_output(int Symbol, int RunCode, uint64_t * C, int * LC, uint8_t ** In, uint8_t * InEnd,
+                      uint16_t ** Out, uint16_t * OutStart, uint16_t * OutEnd)
+{
+    if (Symbol == RunCode)
+    {
+        if (*LC < 8) {
+            if (*In >= InEnd) return 1;
+            *C = (*C << 8) | *(*In)++;
+            *LC += 8;
+        }
+        *LC -= 8;
+        int run = (uint8_t)(*C >> *LC);
+        if (*Out + run > OutEnd || *Out <= OutStart) return 1;
+        uint16_t s = (*Out)[-1];
+        while (run-- > 0) *(*Out)++ = s;
+    }
+    else
+    {
+        if (*Out >= OutEnd) return 1;
+        *(*Out)++ = Symbol;
+    }
+    return 0;
+}
+
+static int huf_decode(huf_decoder_t * Dec, uint8_t * In, int NumBits, int RunCode, uint16_t * Out, int NumOut)
+{
+    uint64_t c = 0;
+    int lc = 0;
+    uint16_t * out = Out, * out_end = Out + NumOut;
+    uint8_t * in_end = In + (NumBits + 7) / 8;
+
+    while (In < in_end)
+    {
+        c = (c << 8) | *In++;
+        lc += 8;
+
+        while (lc >= HUF_DECBITS)
+        {
+            huf_dec_t entry = Dec->table[(c >> (lc - HUF_DECBITS)) & HUF_DECMASK];
+            if (entry.len)
+            {
+                lc -= entry.len;
+                if (huf_output(entry.lit, RunCode, &c, &lc, &In, in_end, &out, Out, out_end)) return 1;
+            }
+            else
+            {
+                if (entry.p == NULL) return 1;
+                int j;
+                for (j = 0; j < entry.lit; ++j)
+                {
+                    uint64_t code = Dec->codes[entry.p[j]];
+                    int l = huf_length(code);
+                    while (lc < l && In < in_end) {
+                        c = (c << 8) | *In++;
+                        lc += 8;
+                    }
+                    if (lc >= l && huf_code(code) == ((c >> (lc - l)) & (((uint64_t)1 << l) - 1)))
+                    {
+                        lc -= l;
+                        if (huf_output(entry.p[j], RunCode, &c, &lc, &In, in_end, &out, Out, out_end)) return 1;
+                        break;
+                    }
+                }
+                if (j == entry.lit) return 1;
+            }
+        }
+    }
+
+    /* Whatever is left in the last byte */
+    int i = (8 - NumBits) & 7;
+    c >>= i;
+    lc -= i;
+    while (lc > 0)
+    {
+        huf_dec_t entry = Dec->table[(c << (HUF_DECBITS - lc)) & HUF_DECMASK];
+        if (!entry.len || entry.len > lc) return 1;
+        lc -= entry.len;
+        if (huf_output(entry.lit, RunCode, &c, &lc, &In, in_end, &out, Out, out_end)) return 1;
+    }
+
+    return (out != out_end);
+}
+
+static int huf_uncompress(uint8_t * In, int InSize, uint16_t * Out, int NumOut)
+{
+    if (InSize == 0) return (NumOut != 0);
+    if (InSize < 20) return 1;
+
+    int min = read_u32(In);
+    int max = read_u32(In + 4);
+    int num_bits = read_u32(In + 12);
+    if (min < 0 || min >= HUF_ENCSIZE || max < 0 || max >= HUF_ENCSIZE || num_bits < 0) return 1;
+
+    uint8_t * p = In + 20;
+    uint8_t * end = In + InSize;
+
+    huf_decoder_t * dec = malloc(sizeof(huf_decoder_t));
+    if (dec == NULL) return 1;
+    dec->long_codes = NULL;
+
+    int error = huf_unpack_codes(&p, end, min, max, dec->codes)
+             || ((uint64_t)(num_bits + 7) / 8 > (uint64_t)(end - p))
+             || huf_build_table(dec, min, max)
+             || huf_decode(dec, p, num_bits, max, Out, NumOut);
+
+    free(dec->long_codes);
+    free(dec);
+    return error;
+}
+
+/* Inverse of the Haar step for values using 14 bits or less, and the modulo version
+ * for the full 16 bits */
+static inline void wdec14(uint16_t L, uint16_t H, uint16_t * A, uint16_t * B)
+{
+    int hi = (int16_t)H;
+    int ai = (int16_t)L + (hi & 1) + (hi >> 1);
+    *A = (int16_t)ai;
+    *B = (int16_t)(ai - hi);
+}
+static inline void wdec16(uint16_t L, uint16_t H, uint16_t * A, uint16_t * B)
+{
+    int m = L, d = H;
+    int bb = (m - (d >> 1)) & 0xffff;
+    int aa = (d + bb - 0x8000) & 0xffff;
+    *B = bb;
+    *A = aa;
+}
+
+static void wav2_decode(uint16_t * In, int NX, int OX, int NY, int OY, uint16_t MaxValue)
+{
+    int w14 = (MaxValue < (1 << 14));
+    int n = (NX > NY) ? NY : NX;
+    int p = 1, p2;
+
+    /* Coarsest level */
+    while (p <= n) p <<= 1;
+    p >>= 1;
+    p2 = p;
+    p >>= 1;
+
+    for (; p >= 1; p2 = p, p >>= 1)
+    {
+        uint16_t * py = In;
+        uint16_t * ey = In + OY * (NY - p2);
+        int oy1 = OY * p, oy2 = OY * p2;
+        int ox1 = OX * p, ox2 = OX * p2;
+        uint16_t i00, i01, i10, i11;
+
+        for (; py <= ey; py += oy2)
+        {
+            uint16_t * px = py;
+            uint16_t * ex = py + OX * (NX - p2);
+
+            for (; px <= ex; px += ox2)
+            {
+                uint16_t * p01 = px + ox1;
+                uint16_t * p10 = px + oy1;
+                uint16_t * p11 = p10 + ox1;
+                if (w14) {
+                    wdec14(*px, *p10, &i00, &i10);
+                    wdec14(*p01, *p11, &i01, &i11);
+                    wdec14(i00, i01, px, p01);
+                    wdec14(i10, i11, p10, p11);
+                } else {
+                    wdec16(*px, *p10, &i00, &i10);
+                    wdec16(*p01, *p11, &i01, &i11);
+                    wdec16(i00, i01, px, p01);
+                    wdec16(i10, i11, p10, p11);
+                }
+            }
+
+            /* Odd column */
+            if (NX & p)
+            {
+                uint16_t * p10 = px + oy1;
+                if (w14) wdec14(*px, *p10, &i00, p10);
+                else wdec16(*px, *p10, &i00, p10);
+                *px = i00;
+            }
+        }
+
+        /* Odd line */
+        if (NY & p)
+        {
+            uint16_t * px = py;
+            uint16_t * ex = py + OX * (NX - p2);
+            for (; px <= ex; px += ox2)
+            {
+                uint16_t * p01 = px + ox1;
+                if (w14) wdec14(*px, *p01, &i00, p01);
+                else wdec16(*px, *p01, &i00, p01);
+                *px = i00;
+            }
+        }
+    }
+}
+
+static int piz_uncompress(EXRImage_t * EXR, uint8_t * In, int InSize, uint8_t * Out, int NumLines)
+{
+    uint8_t * end = In + InSize;
+    int num_words = EXR->width * NumLines * EXR->bytes_per_pixel / 2;
+    uint16_t * words = malloc(sizeof(uint16_t) * (num_words + PIZ_USHORT_RANGE));
+    uint8_t * bitmap = calloc(PIZ_BITMAP_SIZE, 1);
+    if (words == NULL || bitmap == NULL) goto fail;
+    uint16_t * lut = words + num_words;
+
+    /* Which values occur */
+    if (InSize < 4) goto fail;
+    int min_non_zero = read_u16(In);
+    int max_non_zero = read_u16(In + 2);
+    In += 4;
+    if (max_non_zero >= PIZ_BITMAP_SIZE) goto fail;
+    if (min_non_zero <= max_non_zero) {
+        int n = max_non_zero - min_non_zero + 1;
+        if (In + n > end) goto fail;
+        memcpy(bitmap + min_non_zero, In, n);
+        In += n;
+    }
+
+    int k = 0;
+    for (int i = 0; i < PIZ_USHORT_RANGE; ++i)
+        if (i == 0 || (bitmap[i >> 3] & (1 << (i & 7)))) lut[k++] = i;
+    uint16_t max_value = k - 1;
+    while (k < PIZ_USHORT_RANGE) lut[k++] = 0;
+
+    if (In + 4 > end) goto fail;
+    int length = read_u32(In);
+    In += 4;
+    if (length < 0 || length > end - In) goto fail;
+    if (huf_uncompress(In, length, words, num_words)) goto fail;
+
+    /* Each channel is one block, every word of a float is transformed separately */
+    uint16_t * channel = words;
+    for (int c = 0; c < EXR->num_channels; ++c)
+    {
+        int size = (EXR->channel_type[c] == EXR_HALF) ? 1 : 2;
+        for (int j = 0; j < size; ++j)
+            wav2_decode(channel + j, EXR->width, size, NumLines, EXR->width * size, max_value);
+        channel += EXR->width * NumLines * size;
+    }
+
+    for (int i = 0; i < num_words; ++i) words[i] = lut[words[i]];
+
+    /* Back into lines of channels */
+    for (int y = 0; y < NumLines; ++y)
+    {
+        channel = words;
+        for (int c = 0; c < EXR->num_channels; ++c)
+        {
+            int size = (EXR->channel_type[c] == EXR_HALF) ? 1 : 2;
+            int n = EXR->width * size;
+            memcpy(Out, channel + y * n, n * sizeof(uint16_t));
+            Out += n * sizeof(uint16_t);
+            channel += EXR->width * NumLines * size;
+        }
+    }
+
+    free(words);
+    free(bitmap);
+    return 0;
+
+fail:
+    free(words);
+    free(bitmap);
+    return 1;
+}
+
+
+/****************************** Reading ******************************/
+
+/* Converts one line of a channel to float */
+static void convert_line(uint8_t * In, int Type, int Width, float * Out, int Stride)
+{
+    for (int x = 0; x < Width; ++x, Out += Stride)
+    {
+        if (Type == EXR_HALF) *Out = half_to_float(read_u16(In + x*2));
+        else if (Type == EXR_FLOAT) memcpy(Out, In + x*4, 4);
+        else *Out = (float)read_u32(In + x*4);
+    }
+}
+
+/* Copies one line of a half channel */
+static void copy_half_line(uint8_t * In, int Width, uint16_t * Out, int Stride)
+{
+    if (Stride == 1) memcpy(Out, In, Width * 2);
+    else for (int x = 0; x < Width; ++x) Out[x * Stride] = read_u16(In + x*2);
+}
+
+typedef struct {
+    EXRImage_t * exr;
+    int row_start, row_end;
+    float * const * out;
+    uint16_t * const * half_out; /* Instead of out, for EXR_ReadRGBHalf */
+    int stride;
+    atomic_int failed;
+} read_job_t;
+
+static void read_chunk(int Job, void * Data)
+{
+    read_job_t * job = Data;
+    EXRImage_t * exr = job->exr;
+    int Chunk = job->row_start / exr->lines_per_chunk + Job;
+    uint8_t * end = exr->file + exr->file_size;
+    uint8_t * buffer = NULL;
+
+    uint64_t offset = read_u64(exr->chunk_table + Chunk * 8);
+    if (offset > exr->file_size || exr->file_size - offset < 8) goto fail;
+    uint8_t * chunk = exr->file + offset;
+    int y = (int32_t)read_u32(chunk) - exr->min_y;
+    int packed_size = (int32_t)read_u32(chunk + 4);
+    uint8_t * packed = chunk + 8;
+    /* Each chunk has to be the one the table says, or its lines would go in the wrong place */
+    if (y != Chunk * exr->lines_per_chunk || y >= exr->height) goto fail;
+    if (packed_size < 0 || packed_size > end - packed) goto fail;
+
+    /* The decoders count in int, and the buffer is twice the size */
+    int num_lines = MIN(exr->lines_per_chunk, exr->height - y);
+    size_t line_size = (size_t)exr->width * exr->bytes_per_pixel;
+    if (line_size == 0 || line_size > INT_MAX / 2 / num_lines) goto fail;
+    int size = (int)(line_size * num_lines);
+
+    /* Data that doesn't get smaller is stored as it is */
+    uint8_t * lines = packed;
+    if (packed_size < size)
+    {
+        buffer = malloc((size_t)size * 2);
+        if (buffer == NULL) goto fail;
+        lines = buffer;
+        uLongf zip_size = size;
+        switch (exr->compression)
+        {
+            case EXR_RLE:
+                if (rle_uncompress(packed, packed_size, buffer + size, size)) goto fail;
+                undo_predictor(buffer + size, buffer, size);
+                break;
+            case EXR_ZIPS:
+            case EXR_ZIP:
+                if (uncompress(buffer + size, &zip_size, packed, packed_size) != Z_OK || zip_size != (uLongf)size) goto fail;
+                undo_predictor(buffer + size, buffer, size);
+                break;
+            case EXR_PIZ:
+                if (piz_uncompress(exr, packed, packed_size, buffer, num_lines)) goto fail;
+                break;
+            default:
+                goto fail;
+        }
+    }
+    else if (packed_size != size) goto fail;
+
+    /* The first and last chunks can stick out of the rows that were asked for */
+    for (int l = MAX(0, job->row_start - y); l < MIN(num_lines, job->row_end - y); ++l)
+    {
+        uint8_t * line = lines + l * line_size;
+        size_t pixel = ((size_t)(y + l - job->row_start) * exr->width) * job->stride;
+        for (int c = 0; c < 3; ++c)
+        {
+            int ch = exr->rgb_channel[c];
+            uint8_t * in = line + exr->channel_offset[ch] * exr->width;
+            if (job->half_out != NULL) copy_half_line(in, exr->width, job->half_out[c] + pixel, job->stride);
+            else convert_line(in, exr->channel_type[ch], exr->width, job->out[c] + pixel, job->stride);
+        }
+    }
+
+    free(buffer);
+    return;
+
+fail:
+    free(buffer);
+    job->failed = 1;
+}
+
+int EXR_ReadRGB(EXRImage_t * EXR, int RowStart, int RowEnd, float * const * Out, int Stride, int NumThreads)
+{
+    if (RowStart < 0 || RowEnd > EXR->height || RowStart >= RowEnd) return 1;
+    read_job_t job = {
+        .exr = EXR,
+        .row_start = RowStart,
+        .row_end = RowEnd,
+        .out = Out,
+        .stride = Stride,
+        .failed = 0
+    };
+    int first_chunk = RowStart / EXR->lines_per_chunk;
+    int last_chunk = (RowEnd - 1) / EXR->lines_per_chunk;
+    Util_ParallelFor(last_chunk - first_chunk + 1, NumThreads, read_chunk, &job);
+    return job.failed;
+}
+
+int EXR_IsHalf(EXRImage_t * EXR)
+{
+    for (int c = 0; c < 3; ++c)
+        if (EXR->channel_type[EXR->rgb_channel[c]] != EXR_HALF) return 0;
+    return 1;
+}
+
+int EXR_ReadRGBHalf(EXRImage_t * EXR, int RowStart, int RowEnd, uint16_t * const * Out, int Stride, int NumThreads)
+{
+    if (RowStart < 0 || RowEnd > EXR->height || RowStart >= RowEnd || !EXR_IsHalf(EXR)) return 1;
+    read_job_t job = {
+        .exr = EXR,
+        .row_start = RowStart,
+        .row_end = RowEnd,
+        .half_out = Out,
+        .stride = Stride,
+        .failed = 0
+    };
+    int first_chunk = RowStart / EXR->lines_per_chunk;
+    int last_chunk = (RowEnd - 1) / EXR->lines_per_chunk;
+    Util_ParallelFor(last_chunk - first_chunk + 1, NumThreads, read_chunk, &job);
+    return job.failed;
+}
@@ -0,0 +1,68 @@
+/*
+    LuminanceDRT - Luminance based image formation
+    Copyright (C) 2022  Ilia Sibiryakov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; strictly version 2 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* Minimal OpenEXR reader, just enough to get the R, G and B channels out of a normal
+ * single part scanline file. Supports no compression, RLE, ZIPS, ZIP and PIZ, with
+ * half, float or uint pixels. Tiled, deep, multipart and subsampled files are not
+ * supported. If there's no R, G and B, a Y channel is read as grey.
+ *
+ * The file is memory mapped and every chunk is decoded straight into the caller's
+ * buffer, chunks are independent so they're decoded in parallel. */
+
+#ifndef _EXR_h_
+#define _EXR_h_
+
+#include <stdint.h>
+
+typedef struct {
+    int width, height; /* Of the data window */
+    int min_x, min_y; /* Data window origin */
+    int compression;
+    int lines_per_chunk;
+    int num_chunks;
+    int num_channels;
+    int * channel_type; /* Pixel type of each channel, in file order */
+    int * channel_offset; /* Byte offset of each channel within a line, divided by width */
+    int bytes_per_pixel; /* All channels */
+    int rgb_channel[3]; /* Which channels are R, G and B */
+    uint8_t * chunk_table; /* Chunk offsets, in the mapped file */
+    uint8_t * file;
+    uint64_t file_size;
+} EXRImage_t;
+
+/* Opens and checks an EXR file, returns 0 on success */
+int EXR_Open(EXRImage_t * EXR, char * Path);
+void EXR_Close(EXRImage_t * EXR);
+
+/* Decodes rows [RowStart, RowEnd) of the image. Out[0..2] are where the R, G and B
+ * of the first pixel of RowStart go, Stride is the distance between pixels in floats,
+ * so interleaved RGB is {p, p+1, p+2} with Stride 3 and planar is {r, g, b} with
+ * Stride 1. Uses NumThreads threads (0 = all cores). Returns 0 on success.
+ *
+ * Chunks are lines_per_chunk rows, when reading an image in parts, starting each part
+ * on a multiple of that avoids decoding the chunks on the edges twice. */
+int EXR_ReadRGB(EXRImage_t * EXR, int RowStart, int RowEnd, float * const * Out, int Stride, int NumThreads);
+
+/* 1 if R, G and B are all half */
+int EXR_IsHalf(EXRImage_t * EXR);
+
+/* The same for half files, but the halves are copied as they are, so the buffer is
+ * half the size (the library takes half images as input). Fails if EXR_IsHalf is 0. */
+int EXR_ReadRGBHalf(EXRImage_t * EXR, int RowStart, int RowEnd, uint16_t * const * Out, int Stride, int NumThreads);
+
+#endif
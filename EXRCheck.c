@@ -0,0 +1,163 @@
+/*
+    LuminanceDRT - Luminance based image formation
+    Copyright (C) 2022  Ilia Sibiryakov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; strictly version 2 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/*
+Checks the EXR reader against files with known pixels:
+
+    exr_check FILE.exr...
+
+Each FILE.exr needs a FILE.exr.ref next to it, an int width and height and then
+the interleaved RGB floats it should decode to (Tests/EXR has a set of them, for
+every compression, and the script that makes them). Every file is read in strips
+that don't line up with its chunks, interleaved and planar, and half files through
+EXR_ReadRGBHalf as well, and has to come out exactly the same every time. The exit
+code is 1 if any of them doesn't.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "EXR.h"
+#include "Half.h"
+#include "Utilities/Utilities.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+
+/* Rows per read, so strips start and end in the middle of ZIP and PIZ chunks */
+#define STRIP_ROWS 7
+
+/* Reads the whole image into interleaved (Stride 3) or planar (Stride 1) RGB */
+static int read_image(EXRImage_t * EXR, float * RGB, int Stride, int Half)
+{
+    size_t num_pixels = (size_t)EXR->width * EXR->height;
+    size_t plane = (Stride == 1) ? num_pixels : 1;
+    uint16_t * half = NULL;
+    if (Half && (half = malloc(num_pixels * 3 * sizeof(uint16_t))) == NULL) return 1;
+
+    int error = 0;
+    for (int row = 0; row < EXR->height && !error; row += STRIP_ROWS)
+    {
+        int row_end = MIN(row + STRIP_ROWS, EXR->height);
+        size_t first = (size_t)row * EXR->width * Stride;
+        if (Half) {
+            uint16_t * out[3] = {half + first, half + first + plane, half + first + plane*2};
+            error = EXR_ReadRGBHalf(EXR, row, row_end, out, Stride, 0);
+        }
+        else {
+            float * out[3] = {RGB + first, RGB + first + plane, RGB + first + plane*2};
+            error = EXR_ReadRGB(EXR, row, row_end, out, Stride, 0);
+        }
+    }
+    if (Half && !error)
+        for (size_t i = 0; i < num_pixels * 3; ++i) RGB[i] = half_to_float(half[i]);
+    free(half);
+    return error;
+}
+
+/* Planar to interleaved, in Temp */
+static void interleave(float * RGB, float * Temp, size_t NumPixels)
+{
+    for (size_t i = 0; i < NumPixels; ++i)
+        for (int c = 0; c < 3; ++c) Temp[i*3 + c] = RGB[c * NumPixels + i];
+    memcpy(RGB, Temp, NumPixels * 3 * sizeof(float));
+}
+
+/* Returns 0 if the file decodes to its .ref every way it's read */
+static int check_file(char * Path)
+{
+    char ref_path[4096];
+    snprintf(ref_path, sizeof(ref_path), "%s.ref", Path);
+    uint64_t ref_size = 0;
+    uint8_t * ref = Util_MapFile(ref_path, &ref_size);
+    if (ref == NULL || ref_size < 8) {
+        printf("%s: can't read %s\n", Path, ref_path);
+        Util_UnmapFile(ref, ref_size);
+        return 1;
+    }
+
+    EXRImage_t exr;
+    if (EXR_Open(&exr, Path)) {
+        printf("%s: can't open\n", Path);
+        Util_UnmapFile(ref, ref_size);
+        return 1;
+    }
+
+    int ref_width, ref_height;
+    memcpy(&ref_width, ref, 4);
+    memcpy(&ref_height, ref + 4, 4);
+    size_t num_pixels = (size_t)exr.width * exr.height;
+    int error = 0;
+    if (ref_width != exr.width || ref_height != exr.height || ref_size != 8 + num_pixels * 3 * sizeof(float)) {
+        printf("%s: is %dx%d, %s says %dx%d\n", Path, exr.width, exr.height, ref_path, ref_width, ref_height);
+        error = 1;
+    }
+
+    float * rgb = malloc(num_pixels * 3 * sizeof(float));
+    float * temp = malloc(num_pixels * 3 * sizeof(float));
+    if (!error && (rgb == NULL || temp == NULL)) {
+        printf("%s: out of memory\n", Path);
+        error = 1;
+    }
+
+    const char * ways[4] = {"interleaved", "planar", "half interleaved", "half planar"};
+    int num_ways = EXR_IsHalf(&exr) ? 4 : 2;
+    for (int w = 0; w < num_ways && !error; ++w)
+    {
+        int stride = (w & 1) ? 1 : 3;
+        memset(rgb, 0xff, num_pixels * 3 * sizeof(float));
+        if (read_image(&exr, rgb, stride, w >= 2)) {
+            printf("%s: %s read failed\n", Path, ways[w]);
+            error = 1;
+            break;
+        }
+        if (stride == 1) interleave(rgb, temp, num_pixels);
+
+        /* Bit for bit, no decoder should change a value */
+        for (size_t i = 0; i < num_pixels * 3; ++i)
+        {
+            if (memcmp(rgb + i, ref + 8 + i * sizeof(float), sizeof(float))) {
+                float expected;
+                memcpy(&expected, ref + 8 + i * sizeof(float), sizeof(float));
+                printf("%s: %s pixel %zu,%zu channel %zu is %g, should be %g\n", Path, ways[w],
+                       i/3 % exr.width, i/3 / exr.width, i%3, rgb[i], expected);
+                error = 1;
+                break;
+            }
+        }
+    }
+
+    if (!error) printf("%s: ok\n", Path);
+    free(rgb);
+    free(temp);
+    EXR_Close(&exr);
+    Util_UnmapFile(ref, ref_size);
+    return error;
+}
+
+int main(int argc, char ** argv)
+{
+    if (argc < 2) {
+        printf("usage: exr_check FILE.exr...\n");
+        return 1;
+    }
+
+    int error = 0;
+    for (int a = 1; a < argc; ++a) error |= check_file(argv[a]);
+    return error;
+}
@@ -0,0 +1,406 @@
+/*
+    LuminanceDRT - Luminance based image formation
+    Copyright (C) 2022  Ilia Sibiryakov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; strictly version 2 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* Polynomial pow() approximation (the classic cephes logf/expf polynomials), in
+ * scalar, SSE4.1 and AVX2 versions. All three do exactly the same operations in the
+ * same order (no FMA), so they give bit-identical results and it doesn't matter
+ * which one the CPU ends up running. Relative error is within a few float ulps
+ * times |P * ln(X)|, which is ~1e-6 for the range of values IPT sees.
+ *
+ * Inputs below FLT_MIN (including denormals) are treated as zero.
+ *
+ * The _fast versions are a cheaper pow for when ~1e-4 is enough: log2 from the
+ * exponent bits and a cubic (minimax, mantissa reduced to 0.75-1.5, max error
+ * 1.14e-4), exp2 from the exponent bits and a quadratic (minimax on -0.5 to 0.5,
+ * max relative error 1.02e-4, exact at 0). The relative error of X^P is within
+ * 1.02e-4 + 7.9e-5 * |P|, so 1.4e-4 for the IPT curve and 2.9e-4 for its inverse.
+ * They're bit-identical between scalar and SIMD too. */
+
+#ifndef _FastMath_h_
+#define _FastMath_h_
+
+#include <stdint.h>
+#include <float.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FASTMATH_X86 1
+#include <immintrin.h>
+#endif
+
+#define FASTMATH_SQRTHF 0.707106781186547524f
+#define FASTMATH_LOG_P0 7.0376836292E-2f
+#define FASTMATH_LOG_P1 -1.1514610310E-1f
+#define FASTMATH_LOG_P2 1.1676998740E-1f
+#define FASTMATH_LOG_P3 -1.2420140846E-1f
+#define FASTMATH_LOG_P4 1.4249322787E-1f
+#define FASTMATH_LOG_P5 -1.6668057665E-1f
+#define FASTMATH_LOG_P6 2.0000714765E-1f
+#define FASTMATH_LOG_P7 -2.4999993993E-1f
+#define FASTMATH_LOG_P8 3.3333331174E-1f
+#define FASTMATH_LOG_Q1 -2.12194440e-4f
+#define FASTMATH_LOG_Q2 0.693359375f
+
+#define FASTMATH_EXP_HI 88.3762626647949f
+#define FASTMATH_EXP_LO -88.3762626647949f
+#define FASTMATH_LOG2EF 1.44269504088896341f
+#define FASTMATH_EXP_C1 0.693359375f
+#define FASTMATH_EXP_C2 -2.12194440e-4f
+#define FASTMATH_EXP_P0 1.9875691500E-4f
+#define FASTMATH_EXP_P1 1.3981999507E-3f
+#define FASTMATH_EXP_P2 8.3334519073E-3f
+#define FASTMATH_EXP_P3 4.1665795894E-2f
+#define FASTMATH_EXP_P4 1.6666665459E-1f
+#define FASTMATH_EXP_P5 5.0000001201E-1f
+
+#define FASTMATH_LOG2_MANTISSA_LOW 0x3f400000 /* 0.75 */
+#define FASTMATH_LOG2_Q0 1.4425003526f
+#define FASTMATH_LOG2_Q1 -7.2827309283e-1f
+#define FASTMATH_LOG2_Q2 4.9646071407e-1f
+#define FASTMATH_LOG2_Q3 -2.6225145667e-1f
+#define FASTMATH_EXP2_HI 127.0f
+#define FASTMATH_EXP2_LO -126.0f
+#define FASTMATH_EXP2_R0 6.9328292711e-1f
+#define FASTMATH_EXP2_R1 2.4221095928e-1f
+#define FASTMATH_EXP2_R2 5.5008931100e-2f
+
+/*************************************** Scalar ***************************************/
+
+typedef union { float f; int32_t i; } fastmath_bits_t;
+
+/* Natural log, X must be a positive normal number */
+static inline float fastmath_ln(float X)
+{
+    fastmath_bits_t u = {.f = X};
+    float e = (float)(((u.i >> 23) & 0xff) - 126);
+    u.i = (u.i & 0x007fffff) | 0x3f000000; /* Mantissa, 0.5 to 1 */
+    float x = u.f;
+
+    float t = (x < FASTMATH_SQRTHF) ? x : 0.0f;
+    e = e - ((x < FASTMATH_SQRTHF) ? 1.0f : 0.0f);
+    x = (x - 1.0f) + t;
+
+    float z = x * x;
+    float y = FASTMATH_LOG_P0;
+    y = y * x + FASTMATH_LOG_P1;
+    y = y * x + FASTMATH_LOG_P2;
+    y = y * x + FASTMATH_LOG_P3;
+    y = y * x + FASTMATH_LOG_P4;
+    y = y * x + FASTMATH_LOG_P5;
+    y = y * x + FASTMATH_LOG_P6;
+    y = y * x + FASTMATH_LOG_P7;
+    y = y * x + FASTMATH_LOG_P8;
+    y = (y * x) * z;
+    y = y + e * FASTMATH_LOG_Q1;
+    y = y - z * 0.5f;
+    x = x + y;
+    return x + e * FASTMATH_LOG_Q2;
+}
+
+static inline float fastmath_exp(float X)
+{
+    float x = X;
+    x = (x < FASTMATH_EXP_HI) ? x : FASTMATH_EXP_HI;
+    x = (x > FASTMATH_EXP_LO) ? x : FASTMATH_EXP_LO;
+
+    /* exp(x) = exp(g + n*ln2) */
+    float fx = x * FASTMATH_LOG2EF + 0.5f;
+    float n = (float)(int32_t)fx;
+    n = (n > fx) ? n - 1.0f : n; /* floor */
+    x = x - n * FASTMATH_EXP_C1;
+    x = x - n * FASTMATH_EXP_C2;
+
+    float z = x * x;
+    float y = FASTMATH_EXP_P0;
+    y = y * x + FASTMATH_EXP_P1;
+    y = y * x + FASTMATH_EXP_P2;
+    y = y * x + FASTMATH_EXP_P3;
+    y = y * x + FASTMATH_EXP_P4;
+    y = y * x + FASTMATH_EXP_P5;
+    y = y * z + x;
+    y = y + 1.0f;
+
+    fastmath_bits_t pow2n = {.i = ((int32_t)n + 127) << 23};
+    return y * pow2n.f;
+}
+
+/* sign(X) * |X|^P */
+static inline float fastmath_signed_pow(float X, float P)
+{
+    float a = (X < 0.0f) ? -X : X;
+    float r = (a >= FLT_MIN) ? fastmath_exp(P * fastmath_ln(a)) : 0.0f;
+    return (X < 0.0f) ? -r : r;
+}
+
+/* log2, X must be a positive normal number */
+static inline float fastmath_log2_fast(float X)
+{
+    fastmath_bits_t u = {.f = X};
+    int32_t e = (u.i - FASTMATH_LOG2_MANTISSA_LOW) >> 23;
+    u.i -= e << 23; /* Mantissa, 0.75 to 1.5 */
+    float t = u.f - 1.0f;
+
+    float q = FASTMATH_LOG2_Q3;
+    q = q * t + FASTMATH_LOG2_Q2;
+    q = q * t + FASTMATH_LOG2_Q1;
+    q = q * t + FASTMATH_LOG2_Q0;
+    return (float)e + t * q;
+}
+
+static inline float fastmath_exp2_fast(float X)
+{
+    float x = (X < FASTMATH_EXP2_HI) ? X : FASTMATH_EXP2_HI;
+    x = (x > FASTMATH_EXP2_LO) ? x : FASTMATH_EXP2_LO;
+
+    float n = rintf(x);
+    float f = x - n;
+    float r = FASTMATH_EXP2_R2;
+    r = r * f + FASTMATH_EXP2_R1;
+    r = r * f + FASTMATH_EXP2_R0;
+    r = r * f + 1.0f;
+
+    fastmath_bits_t pow2n = {.i = ((int32_t)n + 127) << 23};
+    return r * pow2n.f;
+}
+
+static inline float fastmath_signed_pow_fast(float X, float P)
+{
+    float a = (X < 0.0f) ? -X : X;
+    float r = (a >= FLT_MIN) ? fastmath_exp2_fast(P * fastmath_log2_fast(a)) : 0.0f;
+    return (X < 0.0f) ? -r : r;
+}
+
+/************************************** SSE4.1 ***************************************/
+
+#ifdef FASTMATH_X86
+
+__attribute__((target("sse4.1")))
+static inline __m128 fastmath_ln_sse(__m128 X)
+{
+    __m128i xi = _mm_castps_si128(X);
+    __m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(xi, 23), _mm_set1_epi32(0xff)), _mm_set1_epi32(126)));
+    __m128 x = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(xi, _mm_set1_epi32(0x007fffff)), _mm_set1_epi32(0x3f000000)));
+
+    __m128 mask = _mm_cmplt_ps(x, _mm_set1_ps(FASTMATH_SQRTHF));
+    __m128 t = _mm_and_ps(x, mask);
+    e = _mm_sub_ps(e, _mm_and_ps(_mm_set1_ps(1.0f), mask));
+    x = _mm_add_ps(_mm_sub_ps(x, _mm_set1_ps(1.0f)), t);
+
+    __m128 z = _mm_mul_ps(x, x);
+    __m128 y = _mm_set1_ps(FASTMATH_LOG_P0);
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(FASTMATH_LOG_P1));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(FASTMATH_LOG_P2));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(FASTMATH_LOG_P3));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(FASTMATH_LOG_P4));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(FASTMATH_LOG_P5));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(FASTMATH_LOG_P6));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(FASTMATH_LOG_P7));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(FASTMATH_LOG_P8));
+    y = _mm_mul_ps(_mm_mul_ps(y, x), z);
+    y = _mm_add_ps(y, _mm_mul_ps(e, _mm_set1_ps(FASTMATH_LOG_Q1)));
+    y = _mm_sub_ps(y, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+    x = _mm_add_ps(x, y);
+    return _mm_add_ps(x, _mm_mul_ps(e, _mm_set1_ps(FASTMATH_LOG_Q2)));
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128 fastmath_exp_sse(__m128 X)
+{
+    __m128 x = _mm_min_ps(X, _mm_set1_ps(FASTMATH_EXP_HI));
+    x = _mm_max_ps(x, _mm_set1_ps(FASTMATH_EXP_LO));
+
+    __m128 fx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(FASTMATH_LOG2EF)), _mm_set1_ps(0.5f));
+    __m128 n = _mm_floor_ps(fx);
+    x = _mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(FASTMATH_EXP_C1)));
+    x = _mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(FASTMATH_EXP_C2)));
+
+    __m128 z = _mm_mul_ps(x, x);
+    __m128 y = _mm_set1_ps(FASTMATH_EXP_P0);
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(FASTMATH_EXP_P1));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(FASTMATH_EXP_P2));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(FASTMATH_EXP_P3));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(FASTMATH_EXP_P4));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(FASTMATH_EXP_P5));
+    y = _mm_add_ps(_mm_mul_ps(y, z), x);
+    y = _mm_add_ps(y, _mm_set1_ps(1.0f));
+
+    __m128i pow2n = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(n), _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(y, _mm_castsi128_ps(pow2n));
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128 fastmath_signed_pow_sse(__m128 X, __m128 P)
+{
+    __m128 sign = _mm_and_ps(X, _mm_castsi128_ps(_mm_set1_epi32(0x80000000)));
+    __m128 a = _mm_xor_ps(X, sign);
+    __m128 r = fastmath_exp_sse(_mm_mul_ps(P, fastmath_ln_sse(a)));
+    r = _mm_and_ps(r, _mm_cmpge_ps(a, _mm_set1_ps(FLT_MIN)));
+    return _mm_or_ps(r, sign);
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128 fastmath_log2_fast_sse(__m128 X)
+{
+    __m128i xi = _mm_castps_si128(X);
+    __m128i e = _mm_srai_epi32(_mm_sub_epi32(xi, _mm_set1_epi32(FASTMATH_LOG2_MANTISSA_LOW)), 23);
+    __m128 t = _mm_sub_ps(_mm_castsi128_ps(_mm_sub_epi32(xi, _mm_slli_epi32(e, 23))), _mm_set1_ps(1.0f));
+
+    __m128 q = _mm_set1_ps(FASTMATH_LOG2_Q3);
+    q = _mm_add_ps(_mm_mul_ps(q, t), _mm_set1_ps(FASTMATH_LOG2_Q2));
+    q = _mm_add_ps(_mm_mul_ps(q, t), _mm_set1_ps(FASTMATH_LOG2_Q1));
+    q = _mm_add_ps(_mm_mul_ps(q, t), _mm_set1_ps(FASTMATH_LOG2_Q0));
+    return _mm_add_ps(_mm_cvtepi32_ps(e), _mm_mul_ps(t, q));
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128 fastmath_exp2_fast_sse(__m128 X)
+{
+    __m128 x = _mm_min_ps(X, _mm_set1_ps(FASTMATH_EXP2_HI));
+    x = _mm_max_ps(x, _mm_set1_ps(FASTMATH_EXP2_LO));
+
+    __m128 n = _mm_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m128 f = _mm_sub_ps(x, n);
+    __m128 r = _mm_set1_ps(FASTMATH_EXP2_R2);
+    r = _mm_add_ps(_mm_mul_ps(r, f), _mm_set1_ps(FASTMATH_EXP2_R1));
+    r = _mm_add_ps(_mm_mul_ps(r, f), _mm_set1_ps(FASTMATH_EXP2_R0));
+    r = _mm_add_ps(_mm_mul_ps(r, f), _mm_set1_ps(1.0f));
+
+    __m128i pow2n = _mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(r, _mm_castsi128_ps(pow2n));
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128 fastmath_signed_pow_fast_sse(__m128 X, __m128 P)
+{
+    __m128 sign = _mm_and_ps(X, _mm_castsi128_ps(_mm_set1_epi32(0x80000000)));
+    __m128 a = _mm_xor_ps(X, sign);
+    __m128 r = fastmath_exp2_fast_sse(_mm_mul_ps(P, fastmath_log2_fast_sse(a)));
+    r = _mm_and_ps(r, _mm_cmpge_ps(a, _mm_set1_ps(FLT_MIN)));
+    return _mm_or_ps(r, sign);
+}
+
+/*************************************** AVX2 ****************************************/
+
+__attribute__((target("avx2")))
+static inline __m256 fastmath_ln_avx2(__m256 X)
+{
+    __m256i xi = _mm256_castps_si256(X);
+    __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_and_si256(_mm256_srli_epi32(xi, 23), _mm256_set1_epi32(0xff)), _mm256_set1_epi32(126)));
+    __m256 x = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(xi, _mm256_set1_epi32(0x007fffff)), _mm256_set1_epi32(0x3f000000)));
+
+    __m256 mask = _mm256_cmp_ps(x, _mm256_set1_ps(FASTMATH_SQRTHF), _CMP_LT_OQ);
+    __m256 t = _mm256_and_ps(x, mask);
+    e = _mm256_sub_ps(e, _mm256_and_ps(_mm256_set1_ps(1.0f), mask));
+    x = _mm256_add_ps(_mm256_sub_ps(x, _mm256_set1_ps(1.0f)), t);
+
+    __m256 z = _mm256_mul_ps(x, x);
+    __m256 y = _mm256_set1_ps(FASTMATH_LOG_P0);
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(FASTMATH_LOG_P1));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(FASTMATH_LOG_P2));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(FASTMATH_LOG_P3));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(FASTMATH_LOG_P4));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(FASTMATH_LOG_P5));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(FASTMATH_LOG_P6));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(FASTMATH_LOG_P7));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(FASTMATH_LOG_P8));
+    y = _mm256_mul_ps(_mm256_mul_ps(y, x), z);
+    y = _mm256_add_ps(y, _mm256_mul_ps(e, _mm256_set1_ps(FASTMATH_LOG_Q1)));
+    y = _mm256_sub_ps(y, _mm256_mul_ps(z, _mm256_set1_ps(0.5f)));
+    x = _mm256_add_ps(x, y);
+    return _mm256_add_ps(x, _mm256_mul_ps(e, _mm256_set1_ps(FASTMATH_LOG_Q2)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256 fastmath_exp_avx2(__m256 X)
+{
+    __m256 x = _mm256_min_ps(X, _mm256_set1_ps(FASTMATH_EXP_HI));
+    x = _mm256_max_ps(x, _mm256_set1_ps(FASTMATH_EXP_LO));
+
+    __m256 fx = _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(FASTMATH_LOG2EF)), _mm256_set1_ps(0.5f));
+    __m256 n = _mm256_floor_ps(fx);
+    x = _mm256_sub_ps(x, _mm256_mul_ps(n, _mm256_set1_ps(FASTMATH_EXP_C1)));
+    x = _mm256_sub_ps(x, _mm256_mul_ps(n, _mm256_set1_ps(FASTMATH_EXP_C2)));
+
+    __m256 z = _mm256_mul_ps(x, x);
+    __m256 y = _mm256_set1_ps(FASTMATH_EXP_P0);
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(FASTMATH_EXP_P1));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(FASTMATH_EXP_P2));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(FASTMATH_EXP_P3));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(FASTMATH_EXP_P4));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(FASTMATH_EXP_P5));
+    y = _mm256_add_ps(_mm256_mul_ps(y, z), x);
+    y = _mm256_add_ps(y, _mm256_set1_ps(1.0f));
+
+    __m256i pow2n = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(n), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(y, _mm256_castsi256_ps(pow2n));
+}
+
+__attribute__((target("avx2")))
+static inline __m256 fastmath_signed_pow_avx2(__m256 X, __m256 P)
+{
+    __m256 sign = _mm256_and_ps(X, _mm256_castsi256_ps(_mm256_set1_epi32(0x80000000)));
+    __m256 a = _mm256_xor_ps(X, sign);
+    __m256 r = fastmath_exp_avx2(_mm256_mul_ps(P, fastmath_ln_avx2(a)));
+    r = _mm256_and_ps(r, _mm256_cmp_ps(a, _mm256_set1_ps(FLT_MIN), _CMP_GE_OQ));
+    return _mm256_or_ps(r, sign);
+}
+
+__attribute__((target("avx2")))
+static inline __m256 fastmath_log2_fast_avx2(__m256 X)
+{
+    __m256i xi = _mm256_castps_si256(X);
+    __m256i e = _mm256_srai_epi32(_mm256_sub_epi32(xi, _mm256_set1_epi32(FASTMATH_LOG2_MANTISSA_LOW)), 23);
+    __m256 t = _mm256_sub_ps(_mm256_castsi256_ps(_mm256_sub_epi32(xi, _mm256_slli_epi32(e, 23))), _mm256_set1_ps(1.0f));
+
+    __m256 q = _mm256_set1_ps(FASTMATH_LOG2_Q3);
+    q = _mm256_add_ps(_mm256_mul_ps(q, t), _mm256_set1_ps(FASTMATH_LOG2_Q2));
+    q = _mm256_add_ps(_mm256_mul_ps(q, t), _mm256_set1_ps(FASTMATH_LOG2_Q1));
+    q = _mm256_add_ps(_mm256_mul_ps(q, t), _mm256_set1_ps(FASTMATH_LOG2_Q0));
+    return _mm256_add_ps(_mm256_cvtepi32_ps(e), _mm256_mul_ps(t, q));
+}
+
+__attribute__((target("avx2")))
+static inline __m256 fastmath_exp2_fast_avx2(__m256 X)
+{
+    __m256 x = _mm256_min_ps(X, _mm256_set1_ps(FASTMATH_EXP2_HI));
+    x = _mm256_max_ps(x, _mm256_set1_ps(FASTMATH_EXP2_LO));
+
+    __m256 n = _mm256_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 f = _mm256_sub_ps(x, n);
+    __m256 r = _mm256_set1_ps(FASTMATH_EXP2_R2);
+    r = _mm256_add_ps(_mm256_mul_ps(r, f), _mm256_set1_ps(FASTMATH_EXP2_R1));
+    r = _mm256_add_ps(_mm256_mul_ps(r, f), _mm256_set1_ps(FASTMATH_EXP2_R0));
+    r = _mm256_add_ps(_mm256_mul_ps(r, f), _mm256_set1_ps(1.0f));
+
+    __m256i pow2n = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(r, _mm256_castsi256_ps(pow2n));
+}
+
+__attribute__((target("avx2")))
+static inline __m256 fastmath_signed_pow_fast_avx2(__m256 X, __m256 P)
+{
+    __m256 sign = _mm256_and_ps(X, _mm256_castsi256_ps(_mm256_set1_epi32(0x80000000)));
+    __m256 a = _mm256_xor_ps(X, sign);
+    __m256 r = fastmath_exp2_fast_avx2(_mm256_mul_ps(P, fastmath_log2_fast_avx2(a)));
+    r = _mm256_and_ps(r, _mm256_cmp_ps(a, _mm256_set1_ps(FLT_MIN), _CMP_GE_OQ));
+    return _mm256_or_ps(r, sign);
+}
+
+#endif /* FASTMATH_X86 */
+
+#endif
@@ -0,0 +1,59 @@
+/*
+    LuminanceDRT - Luminance based image formation
+    Copyright (C) 2022  Ilia Sibiryakov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; strictly version 2 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "Half.h"
+
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HALF_X86 1
+#include <immintrin.h>
+#endif
+
+static void to_float_scalar(const uint16_t * In, float * Out, size_t N)
+{
+    for (size_t i = 0; i < N; ++i) Out[i] = half_to_float(In[i]);
+}
+
+#ifdef HALF_X86
+__attribute__((target("avx,f16c")))
+static void to_float_f16c(const uint16_t * In, float * Out, size_t N)
+{
+    size_t i = 0;
+    for (; i + 8 <= N; i += 8)
+        _mm256_storeu_ps(Out + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(In + i))));
+    to_float_scalar(In + i, Out + i, N - i);
+}
+#endif
+
+static void (*to_float)(const uint16_t * In, float * Out, size_t N) = to_float_scalar;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static void init_Half()
+{
+#ifdef HALF_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c")) to_float = to_float_f16c;
+#endif
+}
+
+void Half_ToFloat(const uint16_t * In, float * Out, size_t N)
+{
+    pthread_once(&init_once, init_Half);
+    to_float(In, Out, N);
+}
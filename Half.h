@@ -0,0 +1,51 @@
+/*
+    LuminanceDRT - Luminance based image formation
+    Copyright (C) 2022  Ilia Sibiryakov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; strictly version 2 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* Half (16 bit) float to float. half_to_float is exact for every half, including
+ * denormals and infinities. Half_ToFloat converts a buffer of them with F16C when
+ * the CPU has it, which gives the same floats (NaNs can come out quiet). */
+
+#ifndef _Half_h_
+#define _Half_h_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+static inline float half_to_float(uint16_t H)
+{
+    uint32_t sign = (uint32_t)(H & 0x8000) << 16;
+    uint32_t exponent = (H >> 10) & 0x1f;
+    uint32_t mantissa = H & 0x3ff;
+    uint32_t bits;
+
+    if (exponent == 0) { /* Zero or denormal */
+        float f = mantissa * (1.0f / 16777216.0f);
+        return sign ? -f : f;
+    }
+    else if (exponent == 31) bits = sign | 0x7f800000 | (mantissa << 13);
+    else bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+
+    float f;
+    memcpy(&f, &bits, 4);
+    return f;
+}
+
+void Half_ToFloat(const uint16_t * In, float * Out, size_t N);
+
+#endif
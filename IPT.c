@@ -21,8 +21,12 @@
 #include "IPT.h"
 
 #include <math.h>
+#include <stddef.h>
+#include <pthread.h>
 
 #include "Matrix.h"
+#include "FastMath.h"
+#include "Utilities/Utilities.h"
 
 static double XYZ_to_LMS_D65_HPE[9] = {
     0.4002, 0.7075, -0.0807,
@@ -36,6 +40,12 @@ static double opponency_matrix[9] = {
     0.8056, 0.3572, -1.1628
 };
 
+/* Inverses of the above, calculated once by init_IPT() */
+static double opponent_to_LMS[9];
+static double LMS_to_XYZ_D65_HPE[9];
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static void init_IPT();
+
 #define IPT_POWER 0.43f
 
 static inline float nonlinearity(float x)
@@ -71,11 +81,7 @@ void XYZ_to_IPT(float * In, float * Out, uint64_t N)
 
 void IPT_to_XYZ(float * In, float * Out, uint64_t N)
 {
-    double opponent_to_LMS[9];
-    invertMatrix(opponency_matrix, opponent_to_LMS);
-
-    double LMS_to_XYZ[9];
-    invertMatrix(XYZ_to_LMS_D65_HPE, LMS_to_XYZ);
+    pthread_once(&init_once, init_IPT);
 
     for (uint64_t i = 0; i < N; ++i)
     {
@@ -85,7 +91,7 @@ void IPT_to_XYZ(float * In, float * Out, uint64_t N)
         for (int j = 0; j < 3; ++j)
             values[j] = nonlinearity_inverse(values[j]);
 
-        applyMatrix_f(values, LMS_to_XYZ);
+        applyMatrix_f(values, LMS_to_XYZ_D65_HPE);
 
         for (int j = 0; j < 3; ++j) Out[j] = values[j];
 
@@ -102,4 +108,253 @@ float IPT_curve(float X)
 float IPT_curve_inverse(float X)
 {
     return nonlinearity_inverse(X);
-}
\ No newline at end of file
+}
+
+/* One at a time the polynomial isn't much faster than powf, so HIGH is powf here */
+float IPT_curve_precision(float X, int Precision)
+{
+    if (Precision == IPT_PRECISION_FAST) return fastmath_signed_pow_fast(X, IPT_POWER);
+    return nonlinearity(X);
+}
+
+float IPT_curve_inverse_precision(float X, int Precision)
+{
+    if (Precision == IPT_PRECISION_FAST) return fastmath_signed_pow_fast(X, 1.0f / IPT_POWER);
+    return nonlinearity_inverse(X);
+}
+
+
+
+/************************************* Batch kernels *************************************/
+
+/* Matrix -> signed power -> matrix, on planar data. If Y is not NULL, the dot product
+ * of Y_row and the powered values is also written to it. Every version of a precision
+ * does the same float operations in the same order so they all give identical results. */
+typedef void (*ipt_kernel_t)(const float * M_in, float Power, const float * M_out, const float * Y_row,
+                             float * const * In, float * const * Out, float * Y, size_t N);
+
+static inline float exact_signed_pow(float X, float Power)
+{
+    return (X < 0.0f) ? -powf(-X, Power) : powf(X, Power);
+}
+
+/* The kernels for each precision are made from these, with Pow the signed power
+ * function and Tail the kernel for the pixels left over at the end */
+#define IPT_KERNEL_SCALAR(Name, Pow) \
+static void Name(const float * M_in, float Power, const float * M_out, const float * Y_row, \
+                 float * const * In, float * const * Out, float * Y, size_t N) \
+{ \
+    const float * M = M_in; \
+    for (size_t i = 0; i < N; ++i) \
+    { \
+        float a = In[0][i], b = In[1][i], c = In[2][i]; \
+        float v0 = Pow(M[0] * a + M[1] * b + M[2] * c, Power); \
+        float v1 = Pow(M[3] * a + M[4] * b + M[5] * c, Power); \
+        float v2 = Pow(M[6] * a + M[7] * b + M[8] * c, Power); \
+        Out[0][i] = M_out[0] * v0 + M_out[1] * v1 + M_out[2] * v2; \
+        Out[1][i] = M_out[3] * v0 + M_out[4] * v1 + M_out[5] * v2; \
+        Out[2][i] = M_out[6] * v0 + M_out[7] * v1 + M_out[8] * v2; \
+        if (Y != NULL) Y[i] = Y_row[0] * v0 + Y_row[1] * v1 + Y_row[2] * v2; \
+    } \
+}
+
+IPT_KERNEL_SCALAR(ipt_kernel_exact, exact_signed_pow)
+IPT_KERNEL_SCALAR(ipt_kernel_scalar, fastmath_signed_pow)
+IPT_KERNEL_SCALAR(ipt_kernel_fast_scalar, fastmath_signed_pow_fast)
+
+#ifdef FASTMATH_X86
+
+__attribute__((target("sse4.1")))
+static inline __m128 mat_row_sse(const float * Row, __m128 A, __m128 B, __m128 C)
+{
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(Row[0]), A), _mm_mul_ps(_mm_set1_ps(Row[1]), B)), _mm_mul_ps(_mm_set1_ps(Row[2]), C));
+}
+
+#define IPT_KERNEL_SSE41(Name, Pow, Tail) \
+__attribute__((target("sse4.1"))) \
+static void Name(const float * M_in, float Power, const float * M_out, const float * Y_row, \
+                 float * const * In, float * const * Out, float * Y, size_t N) \
+{ \
+    __m128 power = _mm_set1_ps(Power); \
+    size_t i = 0; \
+    for (; i + 4 <= N; i += 4) \
+    { \
+        __m128 a = _mm_loadu_ps(In[0]+i), b = _mm_loadu_ps(In[1]+i), c = _mm_loadu_ps(In[2]+i); \
+        __m128 v0 = Pow(mat_row_sse(M_in, a, b, c), power); \
+        __m128 v1 = Pow(mat_row_sse(M_in+3, a, b, c), power); \
+        __m128 v2 = Pow(mat_row_sse(M_in+6, a, b, c), power); \
+        _mm_storeu_ps(Out[0]+i, mat_row_sse(M_out, v0, v1, v2)); \
+        _mm_storeu_ps(Out[1]+i, mat_row_sse(M_out+3, v0, v1, v2)); \
+        _mm_storeu_ps(Out[2]+i, mat_row_sse(M_out+6, v0, v1, v2)); \
+        if (Y != NULL) _mm_storeu_ps(Y+i, mat_row_sse(Y_row, v0, v1, v2)); \
+    } \
+    float * in_tail[3] = {In[0]+i, In[1]+i, In[2]+i}; \
+    float * out_tail[3] = {Out[0]+i, Out[1]+i, Out[2]+i}; \
+    Tail(M_in, Power, M_out, Y_row, in_tail, out_tail, (Y != NULL) ? Y+i : NULL, N-i); \
+}
+
+IPT_KERNEL_SSE41(ipt_kernel_sse41, fastmath_signed_pow_sse, ipt_kernel_scalar)
+IPT_KERNEL_SSE41(ipt_kernel_fast_sse41, fastmath_signed_pow_fast_sse, ipt_kernel_fast_scalar)
+
+__attribute__((target("avx2")))
+static inline __m256 mat_row_avx2(const float * Row, __m256 A, __m256 B, __m256 C)
+{
+    return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(Row[0]), A), _mm256_mul_ps(_mm256_set1_ps(Row[1]), B)), _mm256_mul_ps(_mm256_set1_ps(Row[2]), C));
+}
+
+#define IPT_KERNEL_AVX2(Name, Pow, Tail) \
+__attribute__((target("avx2"))) \
+static void Name(const float * M_in, float Power, const float * M_out, const float * Y_row, \
+                 float * const * In, float * const * Out, float * Y, size_t N) \
+{ \
+    __m256 power = _mm256_set1_ps(Power); \
+    size_t i = 0; \
+    for (; i + 8 <= N; i += 8) \
+    { \
+        __m256 a = _mm256_loadu_ps(In[0]+i), b = _mm256_loadu_ps(In[1]+i), c = _mm256_loadu_ps(In[2]+i); \
+        __m256 v0 = Pow(mat_row_avx2(M_in, a, b, c), power); \
+        __m256 v1 = Pow(mat_row_avx2(M_in+3, a, b, c), power); \
+        __m256 v2 = Pow(mat_row_avx2(M_in+6, a, b, c), power); \
+        _mm256_storeu_ps(Out[0]+i, mat_row_avx2(M_out, v0, v1, v2)); \
+        _mm256_storeu_ps(Out[1]+i, mat_row_avx2(M_out+3, v0, v1, v2)); \
+        _mm256_storeu_ps(Out[2]+i, mat_row_avx2(M_out+6, v0, v1, v2)); \
+        if (Y != NULL) _mm256_storeu_ps(Y+i, mat_row_avx2(Y_row, v0, v1, v2)); \
+    } \
+    float * in_tail[3] = {In[0]+i, In[1]+i, In[2]+i}; \
+    float * out_tail[3] = {Out[0]+i, Out[1]+i, Out[2]+i}; \
+    Tail(M_in, Power, M_out, Y_row, in_tail, out_tail, (Y != NULL) ? Y+i : NULL, N-i); \
+}
+
+IPT_KERNEL_AVX2(ipt_kernel_avx2, fastmath_signed_pow_avx2, ipt_kernel_sse41)
+IPT_KERNEL_AVX2(ipt_kernel_fast_avx2, fastmath_signed_pow_fast_avx2, ipt_kernel_fast_sse41)
+
+#endif /* FASTMATH_X86 */
+
+/* The kernel of each precision for this CPU, and an XYZ 'working space' transform
+ * for the plain XYZ batch functions, both set up by init_IPT() */
+static ipt_kernel_t ipt_kernels[IPT_NUM_PRECISIONS];
+static IPTTransform_t XYZ_transform;
+
+static void build_transform(IPTTransform_t * Transform, double * RGB_to_XYZ, int Precision)
+{
+    Transform->precision = Precision;
+    double XYZ_to_RGB[9];
+    invertMatrix(RGB_to_XYZ, XYZ_to_RGB);
+
+    /* Skip the XYZ hop, go straight between RGB and LMS */
+    double RGB_to_LMS[9], LMS_to_RGB[9];
+    multiplyMatrices(XYZ_to_LMS_D65_HPE, RGB_to_XYZ, RGB_to_LMS);
+    multiplyMatrices(XYZ_to_RGB, LMS_to_XYZ_D65_HPE, LMS_to_RGB);
+
+    matrixToFloat(RGB_to_LMS, Transform->RGB_to_LMS);
+    matrixToFloat(opponency_matrix, Transform->LMS_to_opponent);
+    matrixToFloat(opponent_to_LMS, Transform->opponent_to_LMS);
+    matrixToFloat(LMS_to_RGB, Transform->LMS_to_RGB);
+    for (int i = 0; i < 3; ++i) Transform->LMS_to_Y[i] = LMS_to_XYZ_D65_HPE[3+i];
+
+    /* Find the highest saturation distance of the gamut in IPT */
+    float highest_saturation = 0.0;
+    for (int p = 0; p < 3; ++p) {
+        float value[3];
+        Util_HSVToRGB(p / 3.0, 1.0, 1.0, value);
+        applyMatrix_f(value, RGB_to_XYZ);
+        XYZ_to_IPT(value, value, 1);
+        value[1] /= value[0];
+        value[2] /= value[0];
+        float saturation = sqrt(value[1]*value[1] + value[2]*value[2]);
+        if (saturation > highest_saturation) highest_saturation = saturation;
+    }
+    Transform->highest_saturation = highest_saturation * 1.03; /* A little safety margin */
+}
+
+static void init_IPT()
+{
+    invertMatrix(opponency_matrix, opponent_to_LMS);
+    invertMatrix(XYZ_to_LMS_D65_HPE, LMS_to_XYZ_D65_HPE);
+
+    ipt_kernels[IPT_PRECISION_EXACT] = ipt_kernel_exact;
+    ipt_kernels[IPT_PRECISION_HIGH] = ipt_kernel_scalar;
+    ipt_kernels[IPT_PRECISION_FAST] = ipt_kernel_fast_scalar;
+#ifdef FASTMATH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        ipt_kernels[IPT_PRECISION_HIGH] = ipt_kernel_avx2;
+        ipt_kernels[IPT_PRECISION_FAST] = ipt_kernel_fast_avx2;
+    }
+    else if (__builtin_cpu_supports("sse4.1")) {
+        ipt_kernels[IPT_PRECISION_HIGH] = ipt_kernel_sse41;
+        ipt_kernels[IPT_PRECISION_FAST] = ipt_kernel_fast_sse41;
+    }
+#endif
+
+    double identity[9] = {1,0,0, 0,1,0, 0,0,1};
+    build_transform(&XYZ_transform, identity, IPT_PRECISION_HIGH);
+}
+
+void init_IPTTransform(IPTTransform_t * Transform, double * RGB_to_XYZ, int Precision)
+{
+    pthread_once(&init_once, init_IPT);
+    build_transform(Transform, RGB_to_XYZ, Precision);
+}
+
+void RGB_to_IPT_planar(IPTTransform_t * Transform, float * const * In, float * const * Out, uint64_t N)
+{
+    ipt_kernels[Transform->precision](Transform->RGB_to_LMS, IPT_POWER, Transform->LMS_to_opponent, NULL, In, Out, NULL, N);
+}
+
+void IPT_to_RGB_planar(IPTTransform_t * Transform, float * const * In, float * const * Out, float * Y, uint64_t N)
+{
+    ipt_kernels[Transform->precision](Transform->opponent_to_LMS, 1.0f / IPT_POWER, Transform->LMS_to_RGB, Transform->LMS_to_Y, In, Out, Y, N);
+}
+
+/* Pixels per chunk when going through the planar kernels from interleaved data */
+#define IPT_BATCH_CHUNK 256
+
+static void run_interleaved(int Inverse, IPTTransform_t * Transform, float * In, float * Out, float * Y, uint64_t N)
+{
+    float buf[3][IPT_BATCH_CHUNK];
+    float * planes[3] = {buf[0], buf[1], buf[2]};
+
+    while (N > 0)
+    {
+        int n = (N < IPT_BATCH_CHUNK) ? N : IPT_BATCH_CHUNK;
+        for (int i = 0; i < n; ++i) {
+            buf[0][i] = In[i*3];
+            buf[1][i] = In[i*3+1];
+            buf[2][i] = In[i*3+2];
+        }
+        if (Inverse) IPT_to_RGB_planar(Transform, planes, planes, Y, n);
+        else RGB_to_IPT_planar(Transform, planes, planes, n);
+        for (int i = 0; i < n; ++i) {
+            Out[i*3] = buf[0][i];
+            Out[i*3+1] = buf[1][i];
+            Out[i*3+2] = buf[2][i];
+        }
+        In += n*3;
+        Out += n*3;
+        if (Y != NULL) Y += n;
+        N -= n;
+    }
+}
+
+void RGB_to_IPT_batch(IPTTransform_t * Transform, float * In, float * Out, uint64_t N)
+{
+    run_interleaved(0, Transform, In, Out, NULL, N);
+}
+
+void IPT_to_RGB_batch(IPTTransform_t * Transform, float * In, float * Out, float * Y, uint64_t N)
+{
+    run_interleaved(1, Transform, In, Out, Y, N);
+}
+
+void XYZ_to_IPT_batch(float * In, float * Out, uint64_t N)
+{
+    pthread_once(&init_once, init_IPT);
+    run_interleaved(0, &XYZ_transform, In, Out, NULL, N);
+}
+
+void IPT_to_XYZ_batch(float * In, float * Out, uint64_t N)
+{
+    pthread_once(&init_once, init_IPT);
+    run_interleaved(1, &XYZ_transform, In, Out, NULL, N);
+}
@@ -24,7 +24,55 @@
 void XYZ_to_IPT(float * In, float * Out, uint64_t N);
 void IPT_to_XYZ(float * In, float * Out, uint64_t N);
 
+/* How the 0.43 power (and its inverse) is worked out, by the batch functions and
+ * IPT_curve_precision. The maximum relative errors are of X^0.43 / X^(1/0.43):
+ *   HIGH: polynomial log and exp (FastMath.h), ~1e-6 over the range IPT sees
+ *         (IPT_curve_precision uses powf)
+ *   EXACT: powf, scalar only
+ *   FAST: exponent bits and short minimax polynomials, 1.4e-4 / 2.9e-4
+ * HIGH is 0 so that it's what zeroed parameters get. */
+enum {
+    IPT_PRECISION_HIGH,
+    IPT_PRECISION_EXACT,
+    IPT_PRECISION_FAST,
+    IPT_NUM_PRECISIONS
+};
+
+/* Everything needed to go between an RGB working space and IPT, precalculated once
+ * so the per pixel work is only two matrices and the power curve each way. */
+typedef struct {
+    float RGB_to_LMS[9]; /* RGB -> XYZ -> LMS in one */
+    float LMS_to_opponent[9];
+    float opponent_to_LMS[9];
+    float LMS_to_RGB[9]; /* LMS -> XYZ -> RGB in one */
+    float LMS_to_Y[3]; /* The luminance row of LMS -> XYZ */
+    float highest_saturation; /* Furthest the gamut's primaries reach from I in IPT (+3%) */
+    int precision; /* Of the batch and planar functions, IPT_PRECISION_... */
+} IPTTransform_t;
+
+void init_IPTTransform(IPTTransform_t * Transform, double * RGB_to_XYZ, int Precision);
+
+/* Faster versions for big arrays of pixels (whole rows or tiles), using SIMD where
+ * the CPU has it. The power function is a polynomial approximation (see FastMath.h)
+ * so results differ from the above by ~1e-6 relative. In and Out may be the same. */
+void XYZ_to_IPT_batch(float * In, float * Out, uint64_t N);
+void IPT_to_XYZ_batch(float * In, float * Out, uint64_t N);
+
+/* Same but to/from the RGB space of a transform, at its precision. IPT_to_RGB also outputs luminance
+ * (XYZ Y) to Y if it's not NULL. */
+void RGB_to_IPT_batch(IPTTransform_t * Transform, float * In, float * Out, uint64_t N);
+void IPT_to_RGB_batch(IPTTransform_t * Transform, float * In, float * Out, float * Y, uint64_t N);
+
+/* Planar versions of the above, In and Out are arrays of three channel pointers */
+void RGB_to_IPT_planar(IPTTransform_t * Transform, float * const * In, float * const * Out, uint64_t N);
+void IPT_to_RGB_planar(IPTTransform_t * Transform, float * const * In, float * const * Out, float * Y, uint64_t N);
+
+/* The power curve on its own, with powf */
 float IPT_curve(float X);
 float IPT_curve_inverse(float X);
 
+/* And at any precision */
+float IPT_curve_precision(float X, int Precision);
+float IPT_curve_inverse_precision(float X, int Precision);
+
 #endif
\ No newline at end of file
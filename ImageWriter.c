@@ -0,0 +1,540 @@
+/*
+    LuminanceDRT - Luminance based image formation
+    Copyright (C) 2022  Ilia Sibiryakov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; strictly version 2 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <zlib.h>
+
+#include "ImageWriter.h"
+#include "Utilities/Utilities.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+/* Only defined with _XOPEN_SOURCE, it's 1024 on Linux */
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+static void put_u16_be(uint8_t * P, uint16_t V) { P[0] = V >> 8; P[1] = V; }
+static void put_u32_be(uint8_t * P, uint32_t V) { P[0] = V >> 24; P[1] = V >> 16; P[2] = V >> 8; P[3] = V; }
+/* Little endian, which is also what this runs on */
+static void put_u16(uint8_t * P, uint16_t V) { memcpy(P, &V, 2); }
+static void put_u32(uint8_t * P, uint32_t V) { memcpy(P, &V, 4); }
+static void put_u64(uint8_t * P, uint64_t V) { memcpy(P, &V, 8); }
+
+/* Rounds to nearest even, overflows to infinity, keeps NaNs */
+static uint16_t float_to_half(float F)
+{
+    uint32_t bits;
+    memcpy(&bits, &F, 4);
+    uint32_t sign = (bits >> 16) & 0x8000;
+    bits &= 0x7fffffff;
+
+    if (bits >= (uint32_t)(127 + 16) << 23) /* Too big, infinity or NaN */
+        return sign | ((bits > 0x7f800000) ? 0x7e00 : 0x7c00);
+
+    if (bits < (uint32_t)(127 - 14) << 23) {
+        /* Denormal, adding 0.5 lines the half's mantissa up with the bottom bits of the
+         * float's, and the float add does the rounding */
+        float f, magic;
+        uint32_t magic_bits = (uint32_t)(127 - 1) << 23;
+        memcpy(&f, &bits, 4);
+        memcpy(&magic, &magic_bits, 4);
+        f += magic;
+        memcpy(&bits, &f, 4);
+        return sign | (bits - magic_bits);
+    }
+
+    /* Rebias the exponent and round the mantissa, a carry goes into the exponent */
+    uint32_t odd = (bits >> 13) & 1;
+    bits += ((uint32_t)(15 - 127) << 23) + 0xfff + odd;
+    return sign | (bits >> 13);
+}
+
+int ImageWriter_FormatFromPath(char * Path)
+{
+    char * extension = strrchr(Path, '.');
+    if (extension == NULL) return -1;
+    if (!strcasecmp(extension, ".bmp")) return IMAGE_BMP;
+    if (!strcasecmp(extension, ".ppm")) return IMAGE_PPM;
+    if (!strcasecmp(extension, ".png")) return IMAGE_PNG;
+    if (!strcasecmp(extension, ".tif") || !strcasecmp(extension, ".tiff")) return IMAGE_TIFF;
+    if (!strcasecmp(extension, ".pfm")) return IMAGE_PFM;
+    if (!strcasecmp(extension, ".exr")) return IMAGE_EXR;
+    return -1;
+}
+
+/* The bit depth to use, 0 if the format can't */
+static int resolve_bit_depth(int Format, int BitDepth)
+{
+    switch (Format)
+    {
+        case IMAGE_BMP: return (BitDepth == 0 || BitDepth == 8) ? 8 : 0;
+        case IMAGE_PPM:
+        case IMAGE_PNG:
+        case IMAGE_TIFF: return (BitDepth == 0) ? 8 : (BitDepth == 8 || BitDepth == 16) ? BitDepth : 0;
+        case IMAGE_PFM: return (BitDepth == 0 || BitDepth == 32) ? 32 : 0;
+        case IMAGE_EXR: return (BitDepth == 0) ? 16 : (BitDepth == 16 || BitDepth == 32) ? BitDepth : 0;
+        default: return 0;
+    }
+}
+
+int ImageWriter_PixelBytes(int Format, int BitDepth)
+{
+    return resolve_bit_depth(Format, BitDepth) / 8 * 3;
+}
+
+static uint8_t * row_pointer(ImageWriter_t * Writer, int Y)
+{
+    if (Writer->format == IMAGE_PNG)
+        return Writer->strip + (size_t)(Y - Writer->rows_written) * Writer->row_step + 1;
+    return Writer->rows + (ptrdiff_t)Y * Writer->row_step;
+}
+
+
+/***************************** Mapped formats *****************************/
+
+/* Header of an uncompressed single strip RGB TIFF, the pixels follow it */
+#define TIFF_NUM_TAGS 12
+#define TIFF_HEADER_SIZE (8 + 2 + TIFF_NUM_TAGS*12 + 4 + 6 + 8 + 8)
+
+static uint8_t * tiff_tag(uint8_t * P, int Tag, int Type, int Count, uint32_t Value)
+{
+    put_u16(P, Tag);
+    put_u16(P + 2, Type);
+    put_u32(P + 4, Count);
+    put_u32(P + 8, 0);
+    if (Type == 3 && Count == 1) put_u16(P + 8, Value);
+    else put_u32(P + 8, Value);
+    return P + 12;
+}
+
+static int tiff_header(ImageWriter_t * Writer, uint8_t * Header)
+{
+    enum { SHORT = 3, LONG = 4, RATIONAL = 5 };
+    uint64_t data_size = (uint64_t)Writer->width * Writer->height * Writer->pixel_bytes;
+    if (data_size > UINT32_MAX - TIFF_HEADER_SIZE) return -1;
+
+    /* Values that don't fit in a tag go after the tags */
+    int bits_offset = 8 + 2 + TIFF_NUM_TAGS*12 + 4;
+    int x_resolution_offset = bits_offset + 6;
+    int y_resolution_offset = x_resolution_offset + 8;
+
+    memcpy(Header, "II", 2);
+    put_u16(Header + 2, 42);
+    put_u32(Header + 4, 8); /* First directory */
+    put_u16(Header + 8, TIFF_NUM_TAGS);
+    uint8_t * p = Header + 10;
+    p = tiff_tag(p, 256, LONG, 1, Writer->width);
+    p = tiff_tag(p, 257, LONG, 1, Writer->height);
+    p = tiff_tag(p, 258, SHORT, 3, bits_offset); /* BitsPerSample */
+    p = tiff_tag(p, 259, SHORT, 1, 1); /* No compression */
+    p = tiff_tag(p, 262, SHORT, 1, 2); /* RGB */
+    p = tiff_tag(p, 273, LONG, 1, TIFF_HEADER_SIZE); /* Strip offset */
+    p = tiff_tag(p, 277, SHORT, 1, 3); /* Samples per pixel */
+    p = tiff_tag(p, 278, LONG, 1, Writer->height); /* Rows per strip */
+    p = tiff_tag(p, 279, LONG, 1, data_size); /* Strip size */
+    p = tiff_tag(p, 282, RATIONAL, 1, x_resolution_offset);
+    p = tiff_tag(p, 283, RATIONAL, 1, y_resolution_offset);
+    p = tiff_tag(p, 296, SHORT, 1, 2); /* Resolution in inches */
+    put_u32(p, 0); /* No more directories */
+
+    for (int c = 0; c < 3; ++c) put_u16(Header + bits_offset + c*2, Writer->bit_depth);
+    put_u32(Header + x_resolution_offset, 72);
+    put_u32(Header + x_resolution_offset + 4, 1);
+    put_u32(Header + y_resolution_offset, 72);
+    put_u32(Header + y_resolution_offset + 4, 1);
+    return TIFF_HEADER_SIZE;
+}
+
+static uint8_t * exr_attribute(uint8_t * P, char * Name, char * Type, void * Value, int Size)
+{
+    P = (uint8_t *)stpcpy((char *)P, Name) + 1;
+    P = (uint8_t *)stpcpy((char *)P, Type) + 1;
+    put_u32(P, Size);
+    memcpy(P + 4, Value, Size);
+    return P + 4 + Size;
+}
+
+/* Scanline header for B, G and R, uncompressed. Returns the size. */
+static int exr_header(ImageWriter_t * Writer, uint8_t * Header)
+{
+    uint8_t channels[3*18 + 1], * c = channels;
+    int type = (Writer->bit_depth == 16) ? 1 : 2;
+    for (char * name = "B\0G\0R"; c < channels + 3*18; name += 2) {
+        *c++ = name[0];
+        *c++ = 0;
+        put_u32(c, type);
+        memset(c + 4, 0, 4); /* pLinear and reserved */
+        put_u32(c + 8, 1); /* Sampling */
+        put_u32(c + 12, 1);
+        c += 16;
+    }
+    *c = 0;
+
+    int32_t window[4] = {0, 0, Writer->width - 1, Writer->height - 1};
+    uint8_t compression = 0, line_order = 0;
+    float aspect = 1.0f, centre[2] = {0.0f, 0.0f}, screen_width = 1.0f;
+
+    put_u32(Header, 20000630);
+    put_u32(Header + 4, 2);
+    uint8_t * p = Header + 8;
+    p = exr_attribute(p, "channels", "chlist", channels, sizeof(channels));
+    p = exr_attribute(p, "compression", "compression", &compression, 1);
+    p = exr_attribute(p, "dataWindow", "box2i", window, 16);
+    p = exr_attribute(p, "displayWindow", "box2i", window, 16);
+    p = exr_attribute(p, "lineOrder", "lineOrder", &line_order, 1);
+    p = exr_attribute(p, "pixelAspectRatio", "float", &aspect, 4);
+    p = exr_attribute(p, "screenWindowCenter", "v2f", centre, 8);
+    p = exr_attribute(p, "screenWindowWidth", "float", &screen_width, 4);
+    *p++ = 0;
+    return p - Header;
+}
+
+static int open_mapped(ImageWriter_t * Writer, char * Path)
+{
+    if (Writer->format == IMAGE_BMP)
+    {
+        Util_Bitmap_t bmp;
+        if (Util_CreateBitmap(&bmp, Path, Writer->width, Writer->height)) return 1;
+        Writer->file = bmp.data;
+        Writer->file_size = bmp.size;
+        Writer->rows = Util_BitmapRow(&bmp, 0);
+        Writer->row_step = -(ptrdiff_t)bmp.row_bytes;
+        return 0;
+    }
+
+    uint8_t header[512];
+    int header_size = 0;
+    size_t line_bytes = (size_t)Writer->width * Writer->pixel_bytes;
+    size_t row_prefix = 0; /* Bytes before each row */
+    size_t table_size = 0; /* After the header */
+    int bottom_up = 0;
+    switch (Writer->format)
+    {
+        case IMAGE_PPM:
+            header_size = sprintf((char *)header, "P6\n%i %i\n%i\n", Writer->width, Writer->height, (1 << Writer->bit_depth) - 1);
+            break;
+        case IMAGE_PFM:
+            /* Negative scale is little endian, rows are bottom up */
+            header_size = sprintf((char *)header, "PF\n%i %i\n-1.0\n", Writer->width, Writer->height);
+            bottom_up = 1;
+            break;
+        case IMAGE_TIFF:
+            header_size = tiff_header(Writer, header);
+            break;
+        case IMAGE_EXR:
+            /* Every line is a chunk, with its y and size first, and the offset of
+             * each is in a table after the header */
+            header_size = exr_header(Writer, header);
+            row_prefix = 8;
+            table_size = (size_t)Writer->height * 8;
+            break;
+    }
+    if (header_size <= 0) return 1;
+
+    size_t data_start = header_size + table_size;
+    size_t row_bytes = row_prefix + line_bytes;
+    Writer->file_size = data_start + row_bytes * Writer->height;
+    Writer->file = Util_CreateMappedFile(Path, Writer->file_size);
+    if (Writer->file == NULL) return 1;
+    memcpy(Writer->file, header, header_size);
+
+    for (size_t y = 0; y < table_size / 8; ++y)
+        put_u64(Writer->file + header_size + y*8, data_start + y * row_bytes);
+
+    if (bottom_up) {
+        Writer->rows = Writer->file + data_start + (Writer->height - 1) * row_bytes + row_prefix;
+        Writer->row_step = -(ptrdiff_t)row_bytes;
+    } else {
+        Writer->rows = Writer->file + data_start + row_prefix;
+        Writer->row_step = row_bytes;
+    }
+    return 0;
+}
+
+static int write_mapped_rows(ImageWriter_t * Writer, int RowStart, int NumRows)
+{
+    /* EXR line headers are filled in here, so that creating the file doesn't touch
+     * all of it */
+    if (Writer->format == IMAGE_EXR)
+        for (int y = RowStart; y < RowStart + NumRows; ++y) {
+            uint8_t * line = row_pointer(Writer, y) - 8;
+            put_u32(line, y);
+            put_u32(line + 4, Writer->row_step - 8);
+        }
+
+    uint8_t * first = row_pointer(Writer, RowStart);
+    uint8_t * last = row_pointer(Writer, RowStart + NumRows - 1);
+    uint8_t * start = MIN(first, last) - ((Writer->format == IMAGE_EXR) ? 8 : 0);
+    size_t step = (Writer->row_step < 0) ? -Writer->row_step : Writer->row_step;
+    Util_ReleaseMappedRange(start, step * NumRows);
+    return 0;
+}
+
+
+/***************************** PNG *****************************/
+
+/* Stored deflate blocks can be at most this big */
+#define PNG_BLOCK_SIZE 65535
+/* Blocks in each IDAT chunk, which is written with one writev */
+#define PNG_BLOCKS_PER_CHUNK 256
+
+/* Writes all of the vectors, which it changes */
+static int write_vectors(int FD, struct iovec * Vectors, int Count)
+{
+    while (Count > 0)
+    {
+        ssize_t written = writev(FD, Vectors, MIN(Count, IOV_MAX));
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return 1;
+        }
+        while (Count > 0 && (size_t)written >= Vectors->iov_len) {
+            written -= Vectors->iov_len;
+            ++Vectors;
+            --Count;
+        }
+        if (Count > 0) {
+            Vectors->iov_base = (uint8_t *)Vectors->iov_base + written;
+            Vectors->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+static int png_chunk(ImageWriter_t * Writer, char * Type, uint8_t * Data, uint32_t Size)
+{
+    uint8_t start[8], end[4];
+    put_u32_be(start, Size);
+    memcpy(start + 4, Type, 4);
+    uint32_t crc = crc32(0, start + 4, 4);
+    if (Size > 0) crc = crc32(crc, Data, Size); /* zlib gives 0 for no data */
+    put_u32_be(end, crc);
+    struct iovec vectors[3] = {{start, 8}, {Data, Size}, {end, 4}};
+    return write_vectors(Writer->fd, vectors, 3);
+}
+
+/* Writes Data as stored deflate blocks, in as many IDAT chunks as it needs */
+static int png_write_data(ImageWriter_t * Writer, uint8_t * Data, size_t Size)
+{
+    while (Size > 0)
+    {
+        size_t chunk_size = MIN(Size, (size_t)PNG_BLOCK_SIZE * PNG_BLOCKS_PER_CHUNK);
+        int num_blocks = (chunk_size + PNG_BLOCK_SIZE - 1) / PNG_BLOCK_SIZE;
+
+        uint8_t start[8], end[4], blocks[PNG_BLOCKS_PER_CHUNK][5];
+        struct iovec vectors[2 + PNG_BLOCKS_PER_CHUNK*2];
+        int num_vectors = 0;
+
+        put_u32_be(start, chunk_size + num_blocks*5);
+        memcpy(start + 4, "IDAT", 4);
+        uint32_t crc = crc32(0, start + 4, 4);
+        vectors[num_vectors++] = (struct iovec){start, 8};
+
+        for (int b = 0; b < num_blocks; ++b)
+        {
+            uint16_t length = MIN((size_t)PNG_BLOCK_SIZE, chunk_size - (size_t)b * PNG_BLOCK_SIZE);
+            uint8_t * data = Data + (size_t)b * PNG_BLOCK_SIZE;
+            blocks[b][0] = 0; /* Not final, stored */
+            blocks[b][1] = length;
+            blocks[b][2] = length >> 8;
+            blocks[b][3] = ~length;
+            blocks[b][4] = ~length >> 8;
+            crc = crc32(crc32(crc, blocks[b], 5), data, length);
+            vectors[num_vectors++] = (struct iovec){blocks[b], 5};
+            vectors[num_vectors++] = (struct iovec){data, length};
+        }
+
+        put_u32_be(end, crc);
+        vectors[num_vectors++] = (struct iovec){end, 4};
+        if (write_vectors(Writer->fd, vectors, num_vectors)) return 1;
+
+        Data += chunk_size;
+        Size -= chunk_size;
+    }
+    return 0;
+}
+
+static int open_png(ImageWriter_t * Writer, char * Path, int MaxRows)
+{
+    Writer->row_step = 1 + (size_t)Writer->width * Writer->pixel_bytes;
+    Writer->max_rows = MaxRows;
+    /* Filter bytes are all 0 (none), and never written over */
+    Writer->strip = calloc((size_t)MaxRows, Writer->row_step);
+    if (Writer->strip == NULL) return 1;
+    Writer->fd = open(Path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (Writer->fd < 0) return 1;
+
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    uint8_t header[13];
+    put_u32_be(header, Writer->width);
+    put_u32_be(header + 4, Writer->height);
+    header[8] = Writer->bit_depth;
+    header[9] = 2; /* RGB */
+    header[10] = 0; /* Deflate */
+    header[11] = 0; /* Filtering per row */
+    header[12] = 0; /* Not interlaced */
+    uint8_t srgb_intent = 0; /* Perceptual */
+    uint8_t zlib_header[2] = {0x78, 0x01}; /* 32K window, no dictionary */
+
+    struct iovec vectors[1] = {{(void *)signature, 8}};
+    if (write_vectors(Writer->fd, vectors, 1)) return 1;
+    if (png_chunk(Writer, "IHDR", header, 13)) return 1;
+    if (png_chunk(Writer, "sRGB", &srgb_intent, 1)) return 1;
+    if (png_chunk(Writer, "IDAT", zlib_header, 2)) return 1;
+    Writer->adler = adler32(0, NULL, 0);
+    return 0;
+}
+
+static int write_png_rows(ImageWriter_t * Writer, int RowStart, int NumRows)
+{
+    if (RowStart != Writer->rows_written || NumRows > Writer->max_rows) return 1;
+
+    size_t size = (size_t)NumRows * Writer->row_step;
+    for (size_t done = 0; done < size;) {
+        uInt part = MIN(size - done, (size_t)1 << 30);
+        Writer->adler = adler32(Writer->adler, Writer->strip + done, part);
+        done += part;
+    }
+    return png_write_data(Writer, Writer->strip, size);
+}
+
+static int close_png(ImageWriter_t * Writer)
+{
+    /* An empty final block, then the checksum of everything */
+    int error = (Writer->fd < 0 || Writer->rows_written != Writer->height);
+    if (!error) {
+        uint8_t end[9] = {1, 0, 0, 0xff, 0xff};
+        put_u32_be(end + 5, Writer->adler);
+        error = png_chunk(Writer, "IDAT", end, 9) || png_chunk(Writer, "IEND", NULL, 0);
+    }
+    if (Writer->sync && !error && fsync(Writer->fd)) error = 1;
+    if (Writer->fd >= 0 && close(Writer->fd)) error = 1;
+    free(Writer->strip);
+    Writer->strip = NULL;
+    Writer->fd = -1;
+    return error;
+}
+
+
+/***************************** Writer *****************************/
+
+int ImageWriter_Open(ImageWriter_t * Writer, char * Path, int Format, int BitDepth, int Width, int Height, int MaxRows)
+{
+    memset(Writer, 0, sizeof(ImageWriter_t));
+    Writer->fd = -1;
+    Writer->format = Format;
+    Writer->bit_depth = resolve_bit_depth(Format, BitDepth);
+    Writer->pixel_bytes = ImageWriter_PixelBytes(Format, BitDepth);
+    Writer->width = Width;
+    Writer->height = Height;
+    if (Writer->bit_depth == 0 || Width < 1 || Height < 1 || MaxRows < 1) return 1;
+    init_SRGBTable(&Writer->srgb);
+
+    if (Format == IMAGE_PNG) {
+        if (open_png(Writer, Path, MaxRows)) {
+            close_png(Writer);
+            return 1;
+        }
+        return 0;
+    }
+    return open_mapped(Writer, Path);
+}
+
+void ImageWriter_Encode(ImageWriter_t * Writer, float * const * RGB, int Y, int X, int NumPixels)
+{
+    SRGBTable_t * srgb = &Writer->srgb;
+    uint8_t * out = row_pointer(Writer, Y);
+
+    /* EXR lines are all of B, then G, then R */
+    if (Writer->format == IMAGE_EXR)
+    {
+        int size = Writer->pixel_bytes / 3;
+        for (int c = 0; c < 3; ++c)
+        {
+            uint8_t * channel = out + ((size_t)(2-c) * Writer->width + X) * size;
+            if (size == 4) memcpy(channel, RGB[c], sizeof(float) * NumPixels);
+            else for (int i = 0; i < NumPixels; ++i) put_u16(channel + i*2, float_to_half(RGB[c][i]));
+        }
+        return;
+    }
+
+    out += (size_t)X * Writer->pixel_bytes;
+    if (Writer->format == IMAGE_PFM)
+    {
+        for (int i = 0; i < NumPixels; ++i)
+            for (int c = 0; c < 3; ++c) memcpy(out + i*12 + c*4, &RGB[c][i], 4);
+    }
+    else if (Writer->bit_depth == 16)
+    {
+        /* TIFF is little endian, the rest big */
+        int big_endian = (Writer->format != IMAGE_TIFF);
+        for (int i = 0; i < NumPixels; ++i)
+            for (int c = 0; c < 3; ++c) {
+                uint16_t value = SRGB_Encode16(srgb, RGB[c][i]);
+                if (big_endian) put_u16_be(out + i*6 + c*2, value);
+                else put_u16(out + i*6 + c*2, value);
+            }
+    }
+    else
+    {
+        /* BMP is BGR */
+        int r = (Writer->format == IMAGE_BMP) ? 2 : 0, b = 2 - r;
+        if (Writer->dither) {
+            /* Callers go in whole 8 rows, so the pattern carries on across calls */
+            float * dither = srgb->dither[Y & 7];
+            for (int i = 0; i < NumPixels; ++i) {
+                float d = dither[(X + i) & 7];
+                out[i*3+r] = SRGB_EncodeDithered(srgb, RGB[0][i], d);
+                out[i*3+1] = SRGB_EncodeDithered(srgb, RGB[1][i], d);
+                out[i*3+b] = SRGB_EncodeDithered(srgb, RGB[2][i], d);
+            }
+        }
+        else for (int i = 0; i < NumPixels; ++i) {
+            out[i*3+r] = SRGB_Encode(srgb, RGB[0][i]);
+            out[i*3+1] = SRGB_Encode(srgb, RGB[1][i]);
+            out[i*3+b] = SRGB_Encode(srgb, RGB[2][i]);
+        }
+    }
+}
+
+int ImageWriter_WriteRows(ImageWriter_t * Writer, int RowStart, int NumRows)
+{
+    if (NumRows < 1) return 0;
+    int error = (Writer->format == IMAGE_PNG) ? write_png_rows(Writer, RowStart, NumRows)
+                                              : write_mapped_rows(Writer, RowStart, NumRows);
+    if (!error) Writer->rows_written += NumRows;
+    return error;
+}
+
+int ImageWriter_Close(ImageWriter_t * Writer)
+{
+    if (Writer->format == IMAGE_PNG) return close_png(Writer);
+    int error = Util_CloseMappedFile(Writer->file, Writer->file_size, Writer->sync);
+    Writer->file = NULL;
+    return error || (Writer->rows_written != Writer->height);
+}
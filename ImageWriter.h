@@ -0,0 +1,93 @@
+/*
+    LuminanceDRT - Luminance based image formation
+    Copyright (C) 2022  Ilia Sibiryakov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; strictly version 2 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* Writes the rendered image, encoding it from planar float RGB as it comes out of
+ * the render, a run of pixels at a time, from any number of threads at once.
+ *
+ *   BMP         8 bit sRGB
+ *   PPM         8 or 16 bit sRGB (binary P6)
+ *   PNG         8 or 16 bit sRGB, deflate with stored (uncompressed) blocks
+ *   TIFF        8 or 16 bit sRGB, uncompressed
+ *   PFM         32 bit float, linear
+ *   EXR         16 (half) or 32 bit float, linear, uncompressed
+ *
+ * Everything except PNG has a fixed layout, those files are created at full size
+ * and mapped, and pixels are encoded straight into them. PNG needs its checksums
+ * done in order, so rows are encoded into a buffer and written out a strip at a
+ * time with vectored writes, wrapped in the deflate blocks without copying. */
+
+#ifndef _ImageWriter_h_
+#define _ImageWriter_h_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "SRGB.h"
+
+enum {
+    IMAGE_BMP,
+    IMAGE_PPM,
+    IMAGE_PNG,
+    IMAGE_TIFF,
+    IMAGE_PFM,
+    IMAGE_EXR
+};
+
+typedef struct {
+    int format;
+    int bit_depth;
+    int width, height;
+    int dither; /* Ordered dither 8 bit output, can be set any time */
+    int sync; /* Wait for the file to reach the disk on close, can be set any time */
+    int pixel_bytes;
+    uint8_t * rows; /* Row Y of a mapped file is at rows + Y * row_step */
+    ptrdiff_t row_step; /* Negative for bottom up formats */
+    uint8_t * file; /* Mapped formats */
+    uint64_t file_size;
+    /* PNG */
+    int fd;
+    uint8_t * strip; /* Rows from rows_written on, each with its filter byte first */
+    int max_rows;
+    int rows_written;
+    uint32_t adler;
+    SRGBTable_t srgb;
+} ImageWriter_t;
+
+/* Format from the file extension, -1 if it isn't one of the above */
+int ImageWriter_FormatFromPath(char * Path);
+
+/* Bytes per pixel in the file, for a bit depth (0 = the format's default, 8 or
+ * float). Returns 0 if the format doesn't do that depth. */
+int ImageWriter_PixelBytes(int Format, int BitDepth);
+
+/* Creates the file, returns 0 on success. MaxRows is the most rows that will be
+ * given to ImageWriter_WriteRows at once. */
+int ImageWriter_Open(ImageWriter_t * Writer, char * Path, int Format, int BitDepth, int Width, int Height, int MaxRows);
+
+/* Encodes NumPixels pixels of row Y starting at X, from RGB[0..2] */
+void ImageWriter_Encode(ImageWriter_t * Writer, float * const * RGB, int Y, int X, int NumPixels);
+
+/* Finishes rows [RowStart, RowStart+NumRows), which must all have been encoded.
+ * Rows have to be finished in order, top to bottom. Returns 0 on success. */
+int ImageWriter_WriteRows(ImageWriter_t * Writer, int RowStart, int NumRows);
+
+/* Closes the file, returns 0 if the whole image was written (and with sync set,
+ * got to the disk) */
+int ImageWriter_Close(ImageWriter_t * Writer);
+
+#endif
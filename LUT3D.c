@@ -0,0 +1,105 @@
+/*
+    LuminanceDRT - Luminance based image formation
+    Copyright (C) 2022  Ilia Sibiryakov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; strictly version 2 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "LUT3D.h"
+#include "FastMath.h"
+
+/* Gets constant folded */
+#define SHAPER_RANGE logf(1.0f + LUT3D_SHAPER_MAX / LUT3D_SHAPER_TOE)
+
+int init_LUT3D(LUT3D_t * LUT, int Size)
+{
+    LUT->size = Size;
+    LUT->data = malloc(sizeof(float) * 3 * Size * Size * Size);
+    return (LUT->data == NULL);
+}
+
+void uninit_LUT3D(LUT3D_t * LUT)
+{
+    free(LUT->data);
+    LUT->data = NULL;
+}
+
+float LUT3D_Shaper(float X)
+{
+    if (!(X > 0.0f)) return 0.0f; /* Also catches NaN */
+    if (X >= LUT3D_SHAPER_MAX) return 1.0f;
+    return fastmath_ln(1.0f + X / LUT3D_SHAPER_TOE) / SHAPER_RANGE;
+}
+
+float LUT3D_ShaperInverse(float T)
+{
+    return (expf(T * SHAPER_RANGE) - 1.0f) * LUT3D_SHAPER_TOE;
+}
+
+void LUT3D_GetInputs(LUT3D_t * LUT, float * const * Out)
+{
+    int size = LUT->size;
+    int i = 0;
+    for (int b = 0; b < size; ++b)
+    for (int g = 0; g < size; ++g)
+    for (int r = 0; r < size; ++r, ++i)
+    {
+        Out[0][i] = LUT3D_ShaperInverse(r / (size-1.0f));
+        Out[1][i] = LUT3D_ShaperInverse(g / (size-1.0f));
+        Out[2][i] = LUT3D_ShaperInverse(b / (size-1.0f));
+    }
+}
+
+void LUT3D_Apply(LUT3D_t * LUT, float * const * In, float * const * Out, uint64_t N)
+{
+    int size = LUT->size;
+    float scale = size - 1.0f;
+    /* Offsets to neighbouring points along each axis */
+    int dr = 3, dg = 3 * size, db = 3 * size * size;
+
+    for (uint64_t i = 0; i < N; ++i)
+    {
+        float r = LUT3D_Shaper(In[0][i]) * scale;
+        float g = LUT3D_Shaper(In[1][i]) * scale;
+        float b = LUT3D_Shaper(In[2][i]) * scale;
+
+        /* Cell index, points on the top edge use the last cell */
+        int ir = (r < scale) ? (int)r : size - 2;
+        int ig = (g < scale) ? (int)g : size - 2;
+        int ib = (b < scale) ? (int)b : size - 2;
+        float fr = r - ir, fg = g - ig, fb = b - ib;
+
+        float * c000 = LUT->data + ib*db + ig*dg + ir*dr;
+        float * c111 = c000 + dr + dg + db;
+
+        /* Pick the tetrahedron the point is in, walk along its three edges */
+        float * c1, * c2;
+        float f0, f1, f2;
+        if (fr > fg) {
+            if (fg > fb)      { c1 = c000+dr;    c2 = c000+dr+dg; f0 = fr; f1 = fg; f2 = fb; }
+            else if (fr > fb) { c1 = c000+dr;    c2 = c000+dr+db; f0 = fr; f1 = fb; f2 = fg; }
+            else              { c1 = c000+db;    c2 = c000+dr+db; f0 = fb; f1 = fr; f2 = fg; }
+        } else {
+            if (fb > fg)      { c1 = c000+db;    c2 = c000+dg+db; f0 = fb; f1 = fg; f2 = fr; }
+            else if (fb > fr) { c1 = c000+dg;    c2 = c000+dg+db; f0 = fg; f1 = fb; f2 = fr; }
+            else              { c1 = c000+dg;    c2 = c000+dr+dg; f0 = fg; f1 = fr; f2 = fb; }
+        }
+
+        for (int c = 0; c < 3; ++c)
+            Out[c][i] = c000[c] + f0 * (c1[c] - c000[c]) + f1 * (c2[c] - c1[c]) + f2 * (c111[c] - c2[c]);
+    }
+}
@@ -0,0 +1,56 @@
+/*
+    LuminanceDRT - Luminance based image formation
+    Copyright (C) 2022  Ilia Sibiryakov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; strictly version 2 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* A 3D LUT with a log shaper in front of it, for baking the whole image formation
+ * into one table lookup. The shaper is the same on all three channels:
+ *
+ *     t = log2(1 + x/LUT3D_SHAPER_TOE) / log2(1 + LUT3D_SHAPER_MAX/LUT3D_SHAPER_TOE)
+ *
+ * so it's linear near black and logarithmic above the toe. Values above
+ * LUT3D_SHAPER_MAX are clamped, negative values go to zero (same as the DRT does). */
+
+#ifndef _LUT3D_h_
+#define _LUT3D_h_
+
+#include <stdint.h>
+
+#define LUT3D_SHAPER_TOE (1.0f/256.0f)
+#define LUT3D_SHAPER_MAX 65504.0f /* Biggest half float */
+
+typedef struct {
+    int size; /* Points along each axis */
+    float * data; /* size^3 RGB values, red changes fastest */
+} LUT3D_t;
+
+/* Allocates a LUT with Size^3 points, returns 0 on success */
+int init_LUT3D(LUT3D_t * LUT, int Size);
+void uninit_LUT3D(LUT3D_t * LUT);
+
+/* Linear value <-> 0-1 shaper coordinate */
+float LUT3D_Shaper(float X);
+float LUT3D_ShaperInverse(float T);
+
+/* Writes the linear input values of every LUT point as planar RGB (size^3 pixels,
+ * same order as data), to be run through the transform and stored in data */
+void LUT3D_GetInputs(LUT3D_t * LUT, float * const * Out);
+
+/* Shaper + tetrahedral interpolation on N planar RGB pixels, In and Out are arrays of
+ * three channel pointers and can be the same */
+void LUT3D_Apply(LUT3D_t * LUT, float * const * In, float * const * Out, uint64_t N);
+
+#endif
@@ -0,0 +1,715 @@
+/*
+    LuminanceDRT - Luminance based image formation
+    Copyright (C) 2022  Ilia Sibiryakov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; strictly version 2 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "LuminanceDRT.h"
+#include "FastMath.h"
+#include "Half.h"
+#include "IPT.h"
+#include "LUT3D.h"
+#include "PathLUT.h"
+#include "Profile.h"
+#include "ToneTable.h"
+#include "Utilities/Utilities.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+static double do_contrast(double X, double Power, double Scale);
+
+/* Compresses a value from 0-infinity to 0-1
+ * Passing 1 to power = very smooth, higher values = sharper roll off. The powers
+ * are worked out at an IPT_PRECISION_... */
+static inline float compress_value(float x, float power, float inverse_power, int precision);
+
+/* Rec709 is the RGB space */
+static double RGB_to_XYZ[9] = {
+    0.4124564, 0.3575761, 0.1804375,
+    0.2126729, 0.7151522, 0.0721750,
+    0.0193339, 0.1191920, 0.9503041
+};
+
+typedef struct render_job render_job_t;
+
+/* Renders pixels [Start, End) of a job */
+typedef void (*render_kernel_t)(render_job_t * Job, size_t Start, size_t End);
+
+struct LDRT_Context {
+    float exposure_factor;
+    float contrast_slope;
+    float saturation_factor;
+    float compression_smoothness;
+    float compression_inverse; /* 1 / compression_smoothness */
+    IPTTransform_t ipt;
+    PathLUT_t paths;
+    LUT3D_t lut3d;
+    int has_lut3d; /* If set, images are rendered through lut3d instead */
+    ToneTable_t tone; /* The contrast on I, if values isn't NULL */
+    /* Measured when it was baked */
+    double lut3d_max_error, lut3d_mean_error;
+    int lut3d_max_code_error;
+    /* Picked for the parameters when the context is made */
+    render_kernel_t render_kernel;
+    render_kernel_t bake_kernel; /* Without exposure or the 3D LUT */
+};
+
+/* One apply call, shared read-only between threads. Pixels are numbered along the
+ * rows of the rectangle, and the work is split up by pixel number, so a 1 row
+ * buffer of any length is spread across threads as well as a tall image is. */
+struct render_job {
+    LDRT_Context_t * context;
+    render_kernel_t kernel;
+    float exposure_factor;
+    LDRT_Image_t in;
+    LDRT_Image_t out;
+    LDRT_Sink_t sink; /* If not NULL, rendered pixels go to this instead of out */
+    void * sink_user;
+    int x, y; /* Of the rectangle */
+    size_t width;
+    size_t num_pixels;
+};
+
+/* Pixels per pass through each stage, small enough that a chunk stays in L1 */
+#define RENDER_CHUNK_PIXELS 256
+/* Pixels per unit of work handed to a thread */
+#define RENDER_BAND_PIXELS (RENDER_CHUNK_PIXELS * 64)
+
+static void run_job(render_job_t * Job, int NumThreads);
+
+/* Kernel for a context's parameters, ExposureFactor is the one it'll be used with */
+static render_kernel_t pick_kernel(LDRT_Context_t * Context, float ExposureFactor);
+
+/* The contrast on I as one function, for the tone table */
+static double contrast_curve(double I, void * Context);
+
+/* Bakes the DRT (minus exposure) into the context's 3D LUT and measures how far off it is, 0 on success */
+static int bake_lut3d(LDRT_Context_t * Context, int NumThreads);
+
+
+void LDRT_DefaultParameters(LDRT_Parameters_t * Parameters)
+{
+    *Parameters = (LDRT_Parameters_t) {
+        .saturation = 1.0,
+        .slope = 1.7,
+        .smoothness = 0.4,
+        .exposure = 0.0,
+        .lut_resolution = LDRT_DEFAULT_LUT_RESOLUTION
+    };
+}
+
+LDRT_Context_t * LDRT_Create(LDRT_Parameters_t * Parameters)
+{
+    LDRT_Context_t * context = calloc(1, sizeof(LDRT_Context_t));
+    if (context == NULL) return NULL;
+
+    float contrast_slope = Parameters->slope;
+    float corner_smoothness = Parameters->smoothness;
+    int lut_resolution = MAX(Parameters->lut_resolution, 2);
+    context->contrast_slope = contrast_slope;
+    context->saturation_factor = Parameters->saturation * sqrt(contrast_slope);
+    context->compression_smoothness = 1.05; /* 1 = smoothest, higher values are sharper */
+    context->compression_inverse = 1.0f / context->compression_smoothness;
+    context->exposure_factor = pow(2.0, Parameters->exposure);
+
+    /* Matrices for going between the RGB space and IPT */
+    int precision = IPT_PRECISION_HIGH;
+    if (Parameters->precision == LDRT_PRECISION_EXACT) precision = IPT_PRECISION_EXACT;
+    else if (Parameters->precision == LDRT_PRECISION_FAST) precision = IPT_PRECISION_FAST;
+    init_IPTTransform(&context->ipt, RGB_to_XYZ, precision);
+
+
+    /***********************************************************/
+    /***************** Create the LUT now... *******************/
+    /***********************************************************/
+
+    /* Generate paths, or load them from the cache if they've been made before */
+    PROFILE_BEGIN(PROFILE_LUT_BUILD);
+    uint64_t cache_key = PathLUT_CacheKey(RGB_to_XYZ, corner_smoothness, lut_resolution);
+    if (Parameters->cache_dir == NULL || PathLUT_LoadCache(&context->paths, Parameters->cache_dir, cache_key))
+    {
+        if (PathLUT_Build(&context->paths, RGB_to_XYZ, corner_smoothness, lut_resolution, Parameters->num_threads)) {
+            free(context);
+            return NULL;
+        }
+        if (Parameters->cache_dir != NULL) PathLUT_SaveCache(&context->paths, Parameters->cache_dir, cache_key);
+    }
+    PROFILE_END(PROFILE_LUT_BUILD);
+
+    if (Parameters->tone_table && init_ToneTable(&context->tone, contrast_curve, context)) {
+        LDRT_Destroy(context);
+        return NULL;
+    }
+
+    context->bake_kernel = pick_kernel(context, 1.0f);
+    if (Parameters->lut3d_size > 1) {
+        if (init_LUT3D(&context->lut3d, Parameters->lut3d_size)) {
+            LDRT_Destroy(context);
+            return NULL;
+        }
+        PROFILE_BEGIN(PROFILE_LUT3D_BAKE);
+        int error = bake_lut3d(context, Parameters->num_threads);
+        PROFILE_END(PROFILE_LUT3D_BAKE);
+        if (error) {
+            LDRT_Destroy(context);
+            return NULL;
+        }
+        context->has_lut3d = 1;
+    }
+    context->render_kernel = pick_kernel(context, context->exposure_factor);
+    return context;
+}
+
+void LDRT_Destroy(LDRT_Context_t * Context)
+{
+    if (Context == NULL) return;
+    uninit_PathLUT(&Context->paths);
+    if (Context->lut3d.data != NULL) uninit_LUT3D(&Context->lut3d);
+    if (Context->tone.values != NULL) uninit_ToneTable(&Context->tone);
+    free(Context);
+}
+
+int LDRT_BuildCache(LDRT_Parameters_t * Parameters)
+{
+    if (Parameters->cache_dir == NULL) return 1;
+    int lut_resolution = MAX(Parameters->lut_resolution, 2);
+    PathLUT_t path_lut;
+    if (PathLUT_Build(&path_lut, RGB_to_XYZ, Parameters->smoothness, lut_resolution, Parameters->num_threads)) return 1;
+    int error = PathLUT_SaveCache(&path_lut, Parameters->cache_dir, PathLUT_CacheKey(RGB_to_XYZ, Parameters->smoothness, lut_resolution));
+    uninit_PathLUT(&path_lut);
+    return error;
+}
+
+int LDRT_GetLUT3DError(LDRT_Context_t * Context, double * MaxError, double * MeanError, int * MaxCodeError)
+{
+    if (!Context->has_lut3d) return 1;
+    *MaxError = Context->lut3d_max_error;
+    *MeanError = Context->lut3d_mean_error;
+    *MaxCodeError = Context->lut3d_max_code_error;
+    return 0;
+}
+
+int LDRT_GetToneTableError(LDRT_Context_t * Context, double * MaxError, double * MaxRelativeError, double * MeanError)
+{
+    if (Context->tone.values == NULL) return 1;
+    *MaxError = Context->tone.max_error;
+    *MaxRelativeError = Context->tone.max_relative_error;
+    *MeanError = Context->tone.mean_error;
+    return 0;
+}
+
+LDRT_Image_t LDRT_InterleavedImage(float * Pixels, int Width)
+{
+    return (LDRT_Image_t) {
+        .channel = {Pixels, Pixels + 1, Pixels + 2},
+        .pixel_stride = 3,
+        .row_stride = (ptrdiff_t)Width * 3
+    };
+}
+
+LDRT_Image_t LDRT_PlanarImage(float * R, float * G, float * B, int Width)
+{
+    return (LDRT_Image_t) {
+        .channel = {R, G, B},
+        .pixel_stride = 1,
+        .row_stride = Width
+    };
+}
+
+LDRT_Image_t LDRT_InterleavedHalfImage(uint16_t * Pixels, int Width)
+{
+    return (LDRT_Image_t) {
+        .half_channel = {Pixels, Pixels + 1, Pixels + 2},
+        .pixel_stride = 3,
+        .row_stride = (ptrdiff_t)Width * 3,
+        .is_half = 1
+    };
+}
+
+LDRT_Image_t LDRT_PlanarHalfImage(uint16_t * R, uint16_t * G, uint16_t * B, int Width)
+{
+    return (LDRT_Image_t) {
+        .half_channel = {R, G, B},
+        .pixel_stride = 1,
+        .row_stride = Width,
+        .is_half = 1
+    };
+}
+
+static int apply_rect(LDRT_Context_t * Context, LDRT_Image_t * In, LDRT_Image_t * Out,
+                      int X, int Y, int Width, int Height, float ExposureFactor, int NumThreads)
+{
+    if (Out->is_half) return 1; /* Only read as halves */
+    if (Width < 1 || Height < 1) return 0;
+    render_job_t job = {
+        .context = Context,
+        .kernel = pick_kernel(Context, ExposureFactor),
+        .exposure_factor = ExposureFactor,
+        .in = *In,
+        .out = *Out,
+        .x = X, .y = Y,
+        .width = Width,
+        .num_pixels = (size_t)Width * Height
+    };
+    run_job(&job, NumThreads);
+    return 0;
+}
+
+static void apply_to_sink(LDRT_Context_t * Context, LDRT_Image_t * In, int X, int Y, int Width, int Height,
+                          LDRT_Sink_t Sink, void * User, float ExposureFactor, int NumThreads)
+{
+    if (Width < 1 || Height < 1) return;
+    render_job_t job = {
+        .context = Context,
+        .kernel = pick_kernel(Context, ExposureFactor),
+        .exposure_factor = ExposureFactor,
+        .in = *In,
+        .sink = Sink,
+        .sink_user = User,
+        .x = X, .y = Y,
+        .width = Width,
+        .num_pixels = (size_t)Width * Height
+    };
+    run_job(&job, NumThreads);
+}
+
+int LDRT_ApplyRect(LDRT_Context_t * Context, LDRT_Image_t * In, LDRT_Image_t * Out,
+                   int X, int Y, int Width, int Height, int NumThreads)
+{
+    return apply_rect(Context, In, Out, X, Y, Width, Height, Context->exposure_factor, NumThreads);
+}
+
+int LDRT_ApplyRectAtExposure(LDRT_Context_t * Context, LDRT_Image_t * In, LDRT_Image_t * Out,
+                             int X, int Y, int Width, int Height, double Exposure, int NumThreads)
+{
+    return apply_rect(Context, In, Out, X, Y, Width, Height, pow(2.0, Exposure), NumThreads);
+}
+
+void LDRT_ApplyToSink(LDRT_Context_t * Context, LDRT_Image_t * In, int X, int Y, int Width, int Height,
+                      LDRT_Sink_t Sink, void * User, int NumThreads)
+{
+    apply_to_sink(Context, In, X, Y, Width, Height, Sink, User, Context->exposure_factor, NumThreads);
+}
+
+void LDRT_ApplyToSinkAtExposure(LDRT_Context_t * Context, LDRT_Image_t * In, int X, int Y, int Width, int Height,
+                                LDRT_Sink_t Sink, void * User, double Exposure, int NumThreads)
+{
+    apply_to_sink(Context, In, X, Y, Width, Height, Sink, User, pow(2.0, Exposure), NumThreads);
+}
+
+/* A buffer is one long row */
+static void apply_row(LDRT_Context_t * Context, LDRT_Image_t * In, LDRT_Image_t * Out, size_t NumPixels, int NumThreads)
+{
+    if (NumPixels == 0) return;
+    render_job_t job = {
+        .context = Context,
+        .kernel = Context->render_kernel,
+        .exposure_factor = Context->exposure_factor,
+        .in = *In,
+        .out = *Out,
+        .width = NumPixels,
+        .num_pixels = NumPixels
+    };
+    run_job(&job, NumThreads);
+}
+
+void LDRT_ApplyInterleaved(LDRT_Context_t * Context, float * In, float * Out, size_t NumPixels, int NumThreads)
+{
+    LDRT_Image_t in = LDRT_InterleavedImage(In, 0);
+    LDRT_Image_t out = LDRT_InterleavedImage(Out, 0);
+    apply_row(Context, &in, &out, NumPixels, NumThreads);
+}
+
+void LDRT_ApplyPlanar(LDRT_Context_t * Context, float * const * In, float * const * Out, size_t NumPixels, int NumThreads)
+{
+    LDRT_Image_t in = LDRT_PlanarImage(In[0], In[1], In[2], 0);
+    LDRT_Image_t out = LDRT_PlanarImage(Out[0], Out[1], Out[2], 0);
+    apply_row(Context, &in, &out, NumPixels, NumThreads);
+}
+
+
+/* Half input is gathered into a run of halves per channel (unless it's planar
+ * already) and converted all at once, then exposed in the tile */
+static void load_half_run(render_job_t * Job, uint16_t * In, float * Tile, int Run, const int Exposure)
+{
+    ptrdiff_t stride = Job->in.pixel_stride;
+    if (stride == 1) Half_ToFloat(In, Tile, Run);
+    else {
+        uint16_t halves[RENDER_CHUNK_PIXELS];
+        for (int j = 0; j < Run; ++j) halves[j] = In[j * stride];
+        Half_ToFloat(halves, Tile, Run);
+    }
+    if (Exposure) for (int j = 0; j < Run; ++j) Tile[j] *= Job->exposure_factor;
+}
+
+/* Copies a chunk (starting at pixel Chunk of the job) into a planar tile with the
+ * exposure applied, if Exposure is set. The chunk can cross rows. */
+static inline void load_chunk(render_job_t * Job, size_t Chunk, float (*Tile)[RENDER_CHUNK_PIXELS], int NumPixels, const int Exposure)
+{
+    ptrdiff_t stride = Job->in.pixel_stride;
+    for (int i = 0; i < NumPixels;)
+    {
+        size_t y = (Chunk + i) / Job->width;
+        size_t x = (Chunk + i) % Job->width;
+        int run = MIN((size_t)(NumPixels - i), Job->width - x);
+        ptrdiff_t offset = (ptrdiff_t)(Job->y + y) * Job->in.row_stride + (ptrdiff_t)(Job->x + x) * stride;
+        if (Job->in.is_half) {
+            for (int c = 0; c < 3; ++c) load_half_run(Job, Job->in.half_channel[c] + offset, Tile[c] + i, run, Exposure);
+            i += run;
+            continue;
+        }
+        for (int c = 0; c < 3; ++c)
+        {
+            float * in = Job->in.channel[c] + offset;
+            float * tile = Tile[c] + i;
+            if (Exposure) for (int j = 0; j < run; ++j) tile[j] = in[j * stride] * Job->exposure_factor;
+            else for (int j = 0; j < run; ++j) tile[j] = in[j * stride];
+        }
+        i += run;
+    }
+}
+
+/* Puts a rendered chunk where the job wants it, either the out image or the sink */
+static void store_chunk(render_job_t * Job, size_t Chunk, float (*Tile)[RENDER_CHUNK_PIXELS], int NumPixels)
+{
+    ptrdiff_t stride = Job->out.pixel_stride;
+    for (int i = 0; i < NumPixels;)
+    {
+        size_t y = (Chunk + i) / Job->width;
+        size_t x = (Chunk + i) % Job->width;
+        int run = MIN((size_t)(NumPixels - i), Job->width - x);
+        if (Job->sink != NULL) {
+            float * rgb[3] = {Tile[0] + i, Tile[1] + i, Tile[2] + i};
+            Job->sink(Job->sink_user, rgb, Job->x + x, Job->y + y, run);
+        }
+        else {
+            ptrdiff_t offset = (ptrdiff_t)(Job->y + y) * Job->out.row_stride + (ptrdiff_t)(Job->x + x) * stride;
+            for (int c = 0; c < 3; ++c)
+            {
+                float * out = Job->out.channel[c] + offset;
+                if (stride == 1) memcpy(out, Tile[c] + i, sizeof(float) * run);
+                else for (int j = 0; j < run; ++j) out[j * stride] = Tile[c][i + j];
+            }
+        }
+        i += run;
+    }
+}
+
+/* Pixels are independent, so any number of these can run at once, the context is
+ * only read from here. Each chunk of pixels is copied into a planar tile on the
+ * stack and goes through all the stages there, the IPT conversions through the
+ * batch (SIMD) kernels, the rest per pixel.
+ *
+ * This is a template for the kernels below, Exposure, Saturation and ToneTable are
+ * constants in each, so the stages they turn off are compiled out rather than checked. */
+static inline __attribute__((always_inline))
+void render_pixels(render_job_t * Job, size_t Start, size_t End, const int Exposure, const int Saturation, const int ToneTable)
+{
+    LDRT_Context_t * context = Job->context;
+    IPTTransform_t * ipt = &context->ipt;
+
+    float tile[3][RENDER_CHUNK_PIXELS];
+    float * planes[3] = {tile[0], tile[1], tile[2]};
+    float * I = tile[0], * P = tile[1], * T = tile[2];
+
+    for (size_t chunk = Start; chunk < End; chunk += RENDER_CHUNK_PIXELS)
+    {
+        int chunk_pixels = MIN(RENDER_CHUNK_PIXELS, End - chunk);
+
+        /* Apply exposure */
+        PROFILE_BEGIN(PROFILE_EXPOSURE);
+        load_chunk(Job, chunk, tile, chunk_pixels, Exposure);
+
+        /* Unfortunately, I must do this due to negative blue  */
+        for (int c = 0; c < 3; ++c)
+            for (int i = 0; i < chunk_pixels; ++i) tile[c][i] = (tile[c][i] < 0.0) ? 0.0 : tile[c][i];
+        PROFILE_END(PROFILE_EXPOSURE);
+
+        {
+            PROFILE_BEGIN(PROFILE_IPT);
+            RGB_to_IPT_planar(ipt, planes, planes, chunk_pixels);
+            PROFILE_END(PROFILE_IPT);
+        }
+
+        PROFILE_BEGIN(PROFILE_CONTRAST_SATURATION);
+        float saturation_factor = context->saturation_factor;
+        float inverse_highest_saturation = 1.0f / ipt->highest_saturation;
+        float minimum_x = 0.00001f * inverse_highest_saturation; /* Greyer than this has no footprint */
+        for (int i = 0; i < chunk_pixels; ++i)
+        {
+            /* Saturation is expanded from the (very approximate) footprint boundary
+             * with uncompress(x) = x/(1-x), where x is P/T's distance from I (relative
+             * to I) over highest_saturation, then multiplied by the saturation factor
+             * and the relative change in I from the contrast, and contracted back with
+             * compress(y) = y/(1+y). Those cancel out to one gain on P and T,
+             *     saturation_factor / (1 + (m-1) x), m = saturation_factor * I/I'
+             * so there's no expanded saturation (which goes to infinity at the
+             * boundary) to work out, and only one square root. Outside the footprint
+             * x is held at 1, which keeps the saturation on the boundary. */
+            if (I[i] < 0.0001f) I[i] = 0.0001f; /* For safety */
+            float I_before = I[i];
+            float x = MIN(sqrtf(P[i]*P[i] + T[i]*T[i]) / I_before * inverse_highest_saturation, 1.0f);
+
+            /* Do the slope contrast */
+            if (ToneTable && I[i] < TONETABLE_MAX_INPUT) I[i] = ToneTable_Lookup(&context->tone, I[i]);
+            else I[i] = IPT_curve_precision(do_contrast(IPT_curve_inverse_precision(I[i], ipt->precision), context->contrast_slope, 1.0), ipt->precision);
+
+            /* Do saturation, inside the footprint. The gain multiplied through by I'
+             * is one division, and without a saturation factor it's 1 outside */
+            if (Saturation) {
+                float gain = saturation_factor;
+                if (x >= minimum_x) gain = saturation_factor * I[i] / (I[i] + (saturation_factor * I_before - I[i]) * x);
+                P[i] *= gain;
+                T[i] *= gain;
+            }
+            else if (x >= minimum_x) {
+                float gain = I[i] / (I[i] + (I_before - I[i]) * x);
+                P[i] *= gain;
+                T[i] *= gain;
+            }
+        }
+        PROFILE_END(PROFILE_CONTRAST_SATURATION);
+
+        float luminance[RENDER_CHUNK_PIXELS];
+        {
+            PROFILE_BEGIN(PROFILE_IPT);
+            IPT_to_RGB_planar(ipt, planes, planes, luminance, chunk_pixels);
+            PROFILE_END(PROFILE_IPT);
+        }
+
+        PROFILE_BEGIN(PROFILE_PATH_LOOKUP);
+        for (int i = 0; i < chunk_pixels; ++i)
+        {
+            /* Grab the luminance */
+            float Y = compress_value(luminance[i], context->compression_smoothness, context->compression_inverse, ipt->precision);
+
+            /* Clip negative channels, as footprint compression. This is a todo. */
+            float pix[3];
+            for (int c = 0; c < 3; ++c) pix[c] = (tile[c][i] < 0.0) ? 0.0 : tile[c][i];
+
+            /* Find the colour along the path to white */
+            PathLUT_Lookup(&context->paths, pix, Y, pix);
+            for (int c = 0; c < 3; ++c) tile[c][i] = pix[c];
+        }
+        PROFILE_END(PROFILE_PATH_LOOKUP);
+
+        PROFILE_BEGIN(PROFILE_ENCODE);
+        store_chunk(Job, chunk, tile, chunk_pixels);
+        PROFILE_END(PROFILE_ENCODE);
+    }
+}
+
+/* The same thing through a baked LUT */
+static inline __attribute__((always_inline))
+void render_pixels_lut3d(render_job_t * Job, size_t Start, size_t End, const int Exposure)
+{
+    float tile[3][RENDER_CHUNK_PIXELS];
+    float * planes[3] = {tile[0], tile[1], tile[2]};
+
+    for (size_t chunk = Start; chunk < End; chunk += RENDER_CHUNK_PIXELS)
+    {
+        int chunk_pixels = MIN(RENDER_CHUNK_PIXELS, End - chunk);
+        PROFILE_BEGIN(PROFILE_EXPOSURE);
+        load_chunk(Job, chunk, tile, chunk_pixels, Exposure);
+        PROFILE_END(PROFILE_EXPOSURE);
+
+        PROFILE_BEGIN(PROFILE_LUT3D);
+        LUT3D_Apply(&Job->context->lut3d, planes, planes, chunk_pixels);
+        PROFILE_END(PROFILE_LUT3D);
+
+        PROFILE_BEGIN(PROFILE_ENCODE);
+        store_chunk(Job, chunk, tile, chunk_pixels);
+        PROFILE_END(PROFILE_ENCODE);
+    }
+}
+
+/* Every combination of the stages that can be left out or swapped. Exposure is off
+ * for an exposure of 0 stops, saturation when the saturation factor comes to 1, and
+ * the tone table replaces working out the contrast. */
+#define RENDER_KERNEL(Name, Exposure, Saturation, ToneTable) \
+static void Name(render_job_t * Job, size_t Start, size_t End) \
+{ \
+    render_pixels(Job, Start, End, Exposure, Saturation, ToneTable); \
+}
+#define RENDER_KERNEL_LUT3D(Name, Exposure) \
+static void Name(render_job_t * Job, size_t Start, size_t End) \
+{ \
+    render_pixels_lut3d(Job, Start, End, Exposure); \
+}
+
+RENDER_KERNEL(render_plain, 0, 0, 0)
+RENDER_KERNEL(render_saturation, 0, 1, 0)
+RENDER_KERNEL(render_exposure, 1, 0, 0)
+RENDER_KERNEL(render_exposure_saturation, 1, 1, 0)
+RENDER_KERNEL(render_tone, 0, 0, 1)
+RENDER_KERNEL(render_tone_saturation, 0, 1, 1)
+RENDER_KERNEL(render_tone_exposure, 1, 0, 1)
+RENDER_KERNEL(render_tone_exposure_saturation, 1, 1, 1)
+RENDER_KERNEL_LUT3D(render_lut3d, 0)
+RENDER_KERNEL_LUT3D(render_lut3d_exposure, 1)
+
+/* [tone table][exposure][saturation] */
+static render_kernel_t render_kernels[2][2][2] = {
+    {{render_plain, render_saturation}, {render_exposure, render_exposure_saturation}},
+    {{render_tone, render_tone_saturation}, {render_tone_exposure, render_tone_exposure_saturation}}
+};
+
+static render_kernel_t pick_kernel(LDRT_Context_t * Context, float ExposureFactor)
+{
+    int exposure = (ExposureFactor != 1.0f);
+    int saturation = (Context->saturation_factor != 1.0f);
+    if (Context->has_lut3d) return exposure ? render_lut3d_exposure : render_lut3d;
+    return render_kernels[Context->tone.values != NULL][exposure][saturation];
+}
+
+static void render_band(int Band, void * Data)
+{
+    render_job_t * job = Data;
+    size_t start = (size_t)Band * RENDER_BAND_PIXELS;
+    size_t end = MIN(start + RENDER_BAND_PIXELS, job->num_pixels);
+    job->kernel(job, start, end);
+}
+
+static void run_job(render_job_t * Job, int NumThreads)
+{
+    int num_bands = (Job->num_pixels + RENDER_BAND_PIXELS - 1) / RENDER_BAND_PIXELS;
+    Util_ParallelFor(num_bands, NumThreads, render_band, Job);
+}
+
+/* How many points per axis to check the baked LUT's error at. They are put in the
+ * middle of cells, which is where interpolation is worst. */
+#define LUT3D_CHECK_SIZE 64
+
+/* Shaper coordinate of check point I along an axis */
+static float check_coordinate(LUT3D_t * LUT, int I)
+{
+    int cells = LUT->size - 1;
+    int cell = (cells <= LUT3D_CHECK_SIZE) ? (I % cells) : (I * cells / LUT3D_CHECK_SIZE);
+    return (cell + 0.5f) / cells;
+}
+
+/* Renders planar points exactly, with no exposure */
+static void render_exact(LDRT_Context_t * Context, float * const * Points, size_t NumPoints, int NumThreads)
+{
+    LDRT_Image_t points = LDRT_PlanarImage(Points[0], Points[1], Points[2], 0);
+    render_job_t job = {
+        .context = Context,
+        .kernel = Context->bake_kernel,
+        .exposure_factor = 1.0,
+        .in = points,
+        .out = points,
+        .width = NumPoints,
+        .num_pixels = NumPoints
+    };
+    run_job(&job, NumThreads);
+}
+
+static int bake_lut3d(LDRT_Context_t * Context, int NumThreads)
+{
+    LUT3D_t * LUT = &Context->lut3d;
+
+    /* Every LUT point is rendered exactly */
+    int num_points = LUT->size * LUT->size * LUT->size;
+    float * points = malloc(num_points * 3 * sizeof(float));
+    if (points == NULL) return 1;
+    float * point_planes[3] = {points, points + num_points, points + num_points*2};
+    LUT3D_GetInputs(LUT, point_planes);
+    render_exact(Context, point_planes, num_points, NumThreads);
+    for (int i = 0; i < num_points; ++i)
+        for (int c = 0; c < 3; ++c) LUT->data[i*3 + c] = point_planes[c][i];
+    free(points);
+
+    /* Now measure the error against the exact path */
+    int n = LUT3D_CHECK_SIZE * LUT3D_CHECK_SIZE * LUT3D_CHECK_SIZE;
+    float * exact = malloc(n * 3 * sizeof(float));
+    float * baked = malloc(n * 3 * sizeof(float));
+    if (exact == NULL || baked == NULL) {
+        free(exact);
+        free(baked);
+        return 1;
+    }
+    float * exact_planes[3] = {exact, exact + n, exact + n*2};
+    float * baked_planes[3] = {baked, baked + n, baked + n*2};
+    int i = 0;
+    for (int b = 0; b < LUT3D_CHECK_SIZE; ++b)
+    for (int g = 0; g < LUT3D_CHECK_SIZE; ++g)
+    for (int r = 0; r < LUT3D_CHECK_SIZE; ++r, ++i)
+    {
+        exact[i] = LUT3D_ShaperInverse(check_coordinate(LUT, r));
+        exact[n + i] = LUT3D_ShaperInverse(check_coordinate(LUT, g));
+        exact[n*2 + i] = LUT3D_ShaperInverse(check_coordinate(LUT, b));
+    }
+    LUT3D_Apply(LUT, exact_planes, baked_planes, n);
+    render_exact(Context, exact_planes, n, NumThreads);
+
+    double max_error = 0.0, sum_error = 0.0;
+    int max_code_error = 0;
+    for (int i = 0; i < n*3; ++i)
+    {
+        double error = fabs(exact[i] - baked[i]);
+        int code_error = abs(linear_to_sRGB(exact[i]*1.00001) - linear_to_sRGB(baked[i]*1.00001));
+        max_error = MAX(max_error, error);
+        max_code_error = MAX(max_code_error, code_error);
+        sum_error += error;
+    }
+    Context->lut3d_max_error = max_error;
+    Context->lut3d_mean_error = sum_error / (n*3);
+    Context->lut3d_max_code_error = max_code_error;
+
+    free(exact);
+    free(baked);
+    return 0;
+}
+
+
+static double contrast_curve(double I, void * Context)
+{
+    LDRT_Context_t * context = Context;
+    return IPT_curve(do_contrast(IPT_curve_inverse(I), context->contrast_slope, 1.0));
+}
+
+
+/* Compression method like Reinhard but with power */
+static inline float compress(float x)
+{
+    return (x / (1.0f + x));
+}
+static inline float compress_value(float x, float power, float inverse_power, int precision)
+{
+    if (x < 0) return x;
+    if (precision == IPT_PRECISION_FAST) return fastmath_signed_pow_fast(compress(fastmath_signed_pow_fast(x, power)), inverse_power);
+    return powf(compress(powf(x, power)), inverse_power);
+}
+
+/* I don't remember what all this "contrast" code does, but it definitely does do a sloped contrast */
+#define MIDDLE_GREY 0.18
+#define middle_grey (MIDDLE_GREY)
+static double contrast_base(double X, double Power){
+    if (X < 0.0) return 0;
+    if (X < 1.0) return pow(X, Power);
+    else return (X-1.0) * Power + 1.0;
+}static double contrast_scaled(double X, double Power, double Scale){
+    return contrast_base(X * Scale, Power) / Scale;
+}static double do_contrast_about1(double X, double Power, double Scale){
+    return contrast_scaled((X) - (contrast_scaled(1.0, Power, Scale) / Power) + (1.0 / Power), Power, Scale);
+} static double do_contrast(double X, double Power, double Scale){
+    return do_contrast_about1(X/middle_grey, Power, Scale) * middle_grey;
+}
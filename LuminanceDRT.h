@@ -0,0 +1,139 @@
+/*
+    LuminanceDRT - Luminance based image formation
+    Copyright (C) 2022  Ilia Sibiryakov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; strictly version 2 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* libluminancedrt, the image formation as a library (process_data is built on it).
+ *
+ * A context is made once from a set of parameters, which builds (or loads from the
+ * cache) the paths LUT, the IPT matrices and optionally a baked 3D LUT, then it can
+ * be applied to any number of images. Applying doesn't change the context, so any
+ * number of threads can use the same one at once.
+ *
+ * Input is scene linear Rec.709 RGB, output is display linear Rec.709 RGB (0-1),
+ * which still needs the sRGB (or other display) encoding. */
+
+#ifndef _LuminanceDRT_h_
+#define _LuminanceDRT_h_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Only these are exported from the shared library */
+#define LDRT_API __attribute__((visibility("default")))
+
+/* Paths along each axis of the paths LUT if not set */
+#define LDRT_DEFAULT_LUT_RESOLUTION 31
+
+/* How the IPT power curve is worked out when rendering. HIGH is a polynomial
+ * within ~1e-6 of powf, EXACT is powf (slower, no SIMD), FAST is within ~3e-4. */
+#define LDRT_PRECISION_HIGH 0
+#define LDRT_PRECISION_EXACT 1
+#define LDRT_PRECISION_FAST 2
+
+typedef struct {
+    double saturation; /* Saturation factor */
+    double slope; /* Contrast slope (steepness) */
+    double smoothness; /* How much to round the corners of the gamut volume, 0-1 */
+    double exposure; /* Exposure correction in stops */
+    int lut_resolution; /* Of the paths LUT, should be 3n+1 */
+    int lut3d_size; /* Render through a baked 3D LUT of this size, 0 = exact */
+    int precision; /* LDRT_PRECISION_..., 0 = high */
+    int tone_table; /* Do the contrast on I through a 1D table instead of pow, 0 = no */
+    char * cache_dir; /* Where to keep built paths LUTs, NULL = build them every time */
+    int num_threads; /* For building, 0 = all cores */
+} LDRT_Parameters_t;
+
+/* The same defaults as Process_EXR.py */
+LDRT_API void LDRT_DefaultParameters(LDRT_Parameters_t * Parameters);
+
+typedef struct LDRT_Context LDRT_Context_t;
+
+/* Returns NULL on failure */
+LDRT_API LDRT_Context_t * LDRT_Create(LDRT_Parameters_t * Parameters);
+LDRT_API void LDRT_Destroy(LDRT_Context_t * Context);
+
+/* Builds the paths LUT for a set of parameters into Parameters->cache_dir only, so
+ * that contexts made later load it. Returns 0 on success. */
+LDRT_API int LDRT_BuildCache(LDRT_Parameters_t * Parameters);
+
+/* How far the baked 3D LUT is from the exact transform, measured when the context
+ * was made. Returns 1 if the context has no 3D LUT. */
+LDRT_API int LDRT_GetLUT3DError(LDRT_Context_t * Context, double * MaxError, double * MeanError, int * MaxCodeError);
+
+/* How far the tone table is from the contrast curve it was made from, measured
+ * between its points when the context was made (in IPT I). Returns 1 if the context
+ * has no tone table. */
+LDRT_API int LDRT_GetToneTableError(LDRT_Context_t * Context, double * MaxError, double * MaxRelativeError, double * MeanError);
+
+/* Where an image is in memory: channel C of pixel (X, Y) is the float at
+ * channel[C] + Y * row_stride + X * pixel_stride. If is_half is set it's the half
+ * (16 bit float) at half_channel[C] + ..., with the strides in halves. Half images
+ * can only be inputs (LDRT_ApplyRect refuses a half Out), they're converted to float
+ * a tile at a time as they're read. */
+typedef struct {
+    union {
+        float * channel[3];
+        uint16_t * half_channel[3];
+    };
+    ptrdiff_t pixel_stride;
+    ptrdiff_t row_stride;
+    int is_half;
+} LDRT_Image_t;
+
+/* RGBRGB... and separate R, G and B buffers, Width pixels per row */
+LDRT_API LDRT_Image_t LDRT_InterleavedImage(float * Pixels, int Width);
+LDRT_API LDRT_Image_t LDRT_PlanarImage(float * R, float * G, float * B, int Width);
+LDRT_API LDRT_Image_t LDRT_InterleavedHalfImage(uint16_t * Pixels, int Width);
+LDRT_API LDRT_Image_t LDRT_PlanarHalfImage(uint16_t * R, uint16_t * G, uint16_t * B, int Width);
+
+/* Applies the transform to the Width x Height rectangle at (X, Y) of In, putting
+ * the result in the same place in Out, which can be In. Uses NumThreads threads,
+ * 1 = only the calling thread, 0 = all cores. Rows or tiles of an image can be
+ * done from different threads at the same time. Returns 1 (doing nothing) if Out is
+ * a half image, otherwise 0. */
+LDRT_API int LDRT_ApplyRect(LDRT_Context_t * Context, LDRT_Image_t * In, LDRT_Image_t * Out,
+                            int X, int Y, int Width, int Height, int NumThreads);
+
+/* Whole buffers of NumPixels pixels, Out can be In */
+LDRT_API void LDRT_ApplyInterleaved(LDRT_Context_t * Context, float * In, float * Out, size_t NumPixels, int NumThreads);
+LDRT_API void LDRT_ApplyPlanar(LDRT_Context_t * Context, float * const * In, float * const * Out, size_t NumPixels, int NumThreads);
+
+/* Instead of an output image, every run of finished pixels (NumPixels of row Y from
+ * X, in planar RGB) is given to Sink, so it can be encoded straight to wherever it's
+ * going. Sink is called from the threads doing the work, on different rows at once. */
+typedef void (*LDRT_Sink_t)(void * User, float * const * RGB, int X, int Y, int NumPixels);
+
+LDRT_API void LDRT_ApplyToSink(LDRT_Context_t * Context, LDRT_Image_t * In, int X, int Y, int Width, int Height,
+                               LDRT_Sink_t Sink, void * User, int NumThreads);
+
+/* The same, with Exposure (in stops) instead of the context's. Exposure is the only
+ * parameter that doesn't go into anything the context builds, so one context can
+ * render at any exposure. */
+LDRT_API int LDRT_ApplyRectAtExposure(LDRT_Context_t * Context, LDRT_Image_t * In, LDRT_Image_t * Out,
+                                      int X, int Y, int Width, int Height, double Exposure, int NumThreads);
+LDRT_API void LDRT_ApplyToSinkAtExposure(LDRT_Context_t * Context, LDRT_Image_t * In, int X, int Y, int Width, int Height,
+                                         LDRT_Sink_t Sink, void * User, double Exposure, int NumThreads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,516 @@
+/*
+    LuminanceDRT - Luminance based image formation
+    Copyright (C) 2022  Ilia Sibiryakov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; strictly version 2 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "PathLUT.h"
+#include "IPT.h"
+#include "Matrix.h"
+#include "Utilities/Utilities.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+/* Points on the hue rib to white, and in the rounded corner */
+#define PATH_RIB_LENGTH 20
+#define PATH_BEVEL_RESOLUTION 20
+
+/* Finds a constant hue rib along the gamut's top surface. */
+static void find_RGB_hull_rib(double * XYZ_to_RGB, double * RGB_to_XYZ, float * EndRGB, int NumPoints, ColourPath_t * RibOut);
+
+/* Builds the path to white for the chromaticity at R,G in the LUT */
+static void build_path(ColourPath_t * PathOut, int R, int G, int Resolution, double * XYZ_to_RGB, double * RGB_to_XYZ, float CornerSmoothness)
+{
+    float r_chromaticity = ((float)R) / (Resolution-1.0);
+    float g_chromaticity = ((float)G) / (Resolution-1.0);
+
+    /* Restore the RGB value for this chromaticity, and normalise to maxRGB = 1 */
+    float RGB[3] = {r_chromaticity, g_chromaticity, 1.0 - r_chromaticity - g_chromaticity};
+    float max_rgb = MAX(RGB[0], MAX(RGB[1], RGB[2]));
+    for (int c = 0; c < 3; ++c) RGB[c] /= max_rgb;
+
+    /* Generate a path like this:
+     * - Black point
+     * - Maximum intensity colour on the top surface of the gamut
+     * - A hue linear rib until white, at maximum RGB intensity
+     */
+    int rib_length = PATH_RIB_LENGTH;
+    int path_length = rib_length+1;
+    ColourPath_t path;
+    init_ColourPath(&path);
+    /* The black point... */
+    ColourPathAddPointByValues(&path, 0,0,0);
+    /* Now the rib */
+    find_RGB_hull_rib(XYZ_to_RGB, RGB_to_XYZ, RGB, rib_length, &path);
+    /* Now update path distance values, for interpolating along them */
+    ColourPathCalculateDistance(&path, 1.0, 1.0, 1.0);
+
+    /* Now create the rounded path */
+    ColourPath_t * path_final = PathOut;
+    init_ColourPath(path_final);
+    ColourPathAddPoint(path_final, (ColourPathPoint_t){.distance = 0, .value = {0,0,0}});
+
+    int bevel_resolution = PATH_BEVEL_RESOLUTION; /* How many points the rounded section will have */
+    float bevel_scale = CornerSmoothness;
+    float bevel_mid = ColourPathGetDistanceOfPoint(&path, 1);
+    float bevel_start = bevel_mid * (1.0-bevel_scale);
+    float bevel_end = bevel_mid + (bevel_mid - bevel_start);
+    if (bevel_end > ColourPathGetLength(&path)) bevel_end = ColourPathGetLength(&path);
+
+    /* Do bevel... */
+    for (int b = 0; b < bevel_resolution; ++b)
+    {
+        float fac = ((float)b) / (bevel_resolution-1.0);
+        float pos_a = fac * (bevel_mid - bevel_start) + bevel_start;
+        float pos_b = fac * (bevel_end - bevel_mid) + bevel_mid;
+
+        float value_a[3];
+        float value_b[3];
+
+        ColourPathInterpolate(&path, pos_a, value_a);
+        ColourPathInterpolate(&path, pos_b, value_b);
+
+        float value[3];
+        for (int i = 0; i < 3; ++i)
+            value[i] = value_a[i] * (1.0-fac) + value_b[i] * fac;
+
+        ColourPathAddPointByValue(path_final, value);
+    }
+
+    for (int p = 0; p < ColourPathGetNumPoints(&path); ++p)
+    {
+        if (ColourPathGetDistanceOfPoint(&path, p) > bevel_end)
+        {
+            ColourPathAddPoint(path_final, ColourPathGetPoint(&path, p));
+        }
+    }
+
+    /* Convert each point to RGB now, and set luminance as the 'distance'.
+     * The path will be interpolated along using luminance (Y) and will return
+     * the resulting RGB values directly */
+    for (int p = 0; p < ColourPathGetNumPoints(path_final); ++p)
+    {
+        ColourPathPoint_t * point = path_final->points + p;
+        float XYZ[3];
+        IPT_to_XYZ(point->value, XYZ, 1);
+        point->value[0] = XYZ[0];
+        point->value[1] = XYZ[1];
+        point->value[2] = XYZ[2];
+        applyMatrix_f(point->value, XYZ_to_RGB);
+        point->distance = XYZ[1];
+    }
+}
+
+typedef struct {
+    ColourPath_t * paths;
+    int resolution;
+    double * XYZ_to_RGB;
+    double * RGB_to_XYZ;
+    float corner_smoothness;
+} build_job_t;
+
+/* Every path is independent, so each thread builds whole rows of them */
+static void build_row(int R, void * Data)
+{
+    build_job_t * job = Data;
+    for (int g = 0; g < job->resolution; ++g)
+        build_path(job->paths + R*job->resolution + g, R, g, job->resolution, job->XYZ_to_RGB, job->RGB_to_XYZ, job->corner_smoothness);
+}
+
+ColourPath_t * PathLUT_BuildPaths(double * RGB_to_XYZ, float CornerSmoothness, int Resolution, int NumThreads)
+{
+    double XYZ_to_RGB[9];
+    invertMatrix(RGB_to_XYZ, XYZ_to_RGB);
+
+    /* (On the heap cause it would cause instant stack overflows when it's too big) */
+    ColourPath_t * paths = malloc(sizeof(ColourPath_t) * Resolution * Resolution);
+    if (paths == NULL) return NULL;
+
+    build_job_t job = {
+        .paths = paths,
+        .resolution = Resolution,
+        .XYZ_to_RGB = XYZ_to_RGB,
+        .RGB_to_XYZ = RGB_to_XYZ,
+        .corner_smoothness = CornerSmoothness
+    };
+    Util_ParallelFor(Resolution, NumThreads, build_row, &job);
+    return paths;
+}
+
+int PathLUT_Build(PathLUT_t * LUT, double * RGB_to_XYZ, float CornerSmoothness, int Resolution, int NumThreads)
+{
+    ColourPath_t * paths = PathLUT_BuildPaths(RGB_to_XYZ, CornerSmoothness, Resolution, NumThreads);
+    if (paths == NULL) return 1;
+    int result = init_PathLUT(LUT, paths, Resolution);
+    free(paths);
+    return result;
+}
+
+/* Floats per point in the LUT, Y, 1 / the Y to the next point (0 if there's no
+ * segment to interpolate along), then RGB */
+#define POINT_SIZE 5
+
+/* Adds a point to a packed path, unless it's the same as the last one */
+static int add_point(float * Points, int NumPoints, float Y, float * RGB)
+{
+    float * last = Points + (NumPoints-1) * POINT_SIZE;
+    if (NumPoints > 0 && last[0] == Y && last[2] == RGB[0] && last[3] == RGB[1] && last[4] == RGB[2]) return NumPoints;
+    float * point = Points + NumPoints * POINT_SIZE;
+    point[0] = Y;
+    point[1] = 0.0f;
+    if (NumPoints > 0 && Y > last[0]) last[1] = 1.0f / (Y - last[0]);
+    for (int c = 0; c < 3; ++c) point[c+2] = RGB[c];
+    return NumPoints + 1;
+}
+
+/* A point along the segment from A to B, as ColourPathInterpolate works it out */
+static void segment_value(ColourPathPoint_t * A, ColourPathPoint_t * B, float Y, float * Out)
+{
+    float fac = (Y - A->distance) / (B->distance - A->distance);
+    for (int i = 0; i < 3; ++i) Out[i] = A->value[i] * (1.0f-fac) + B->value[i] * fac;
+}
+
+/* Packs a path into points that go up in luminance, giving the same colour at every
+ * luminance as ColourPathInterpolate. That takes the first segment the luminance is
+ * in, which matters where a path dips in luminance (in sharp corners), so those
+ * parts are left out and the path jumps (two points at the same luminance) to where
+ * it next goes higher. Out needs room for twice the path's points, returns how many. */
+static int pack_path(ColourPath_t * Path, float * Out)
+{
+    ColourPathPoint_t * points = Path->points;
+    float length = ColourPathGetLength(Path);
+    float covered = points[0].distance; /* Everything up to here has a colour */
+    int num_points = add_point(Out, 0, points[0].distance, points[0].value);
+
+    for (int p = 0; p < Path->num_points-1; ++p)
+    {
+        float start = MAX(points[p].distance, covered);
+        float end = MIN(points[p+1].distance, length);
+        if (end > start)
+        {
+            float value[3];
+            segment_value(points + p, points + p+1, start, value);
+            num_points = add_point(Out, num_points, start, value);
+            if (end == points[p+1].distance) num_points = add_point(Out, num_points, end, points[p+1].value);
+            else {
+                segment_value(points + p, points + p+1, end, value);
+                num_points = add_point(Out, num_points, end, value);
+            }
+        }
+        covered = MAX(covered, points[p+1].distance);
+    }
+
+    /* From the length on it's the last point */
+    return add_point(Out, num_points, length, points[Path->num_points-1].value);
+}
+
+/* Indexes the points of every path by luminance. Step S starts from the last point
+ * below S / index_scale (found the way lookups find their step, so a lookup never
+ * starts past its point). Returns 0 on success. */
+static int index_paths(PathLUT_t * LUT)
+{
+    int num_paths = LUT->resolution * LUT->resolution;
+    LUT->index = malloc(PathLUT_INDEX_SIZE * num_paths);
+    if (LUT->index == NULL) return 1;
+
+    float max_luminance = 0.0f;
+    for (int p = 0; p < num_paths; ++p)
+        max_luminance = MAX(max_luminance, LUT->points[((p+1) * LUT->num_points - 1) * POINT_SIZE]);
+    LUT->index_scale = (max_luminance > 0.0f) ? PathLUT_INDEX_SIZE / max_luminance : 1.0f;
+
+    for (int p = 0; p < num_paths; ++p)
+    {
+        float * path = LUT->points + p * LUT->num_points * POINT_SIZE;
+        int point = 0;
+        for (int s = 0; s < PathLUT_INDEX_SIZE; ++s)
+        {
+            while (point < LUT->num_points-2 && path[(point+1) * POINT_SIZE] * LUT->index_scale < s) ++point;
+            LUT->index[p * PathLUT_INDEX_SIZE + s] = point;
+        }
+    }
+    return 0;
+}
+
+int init_PathLUT(PathLUT_t * LUT, ColourPath_t * Paths, int Resolution)
+{
+    int num_paths = Resolution * Resolution;
+    LUT->resolution = Resolution;
+    LUT->mapping = NULL;
+    LUT->index = NULL;
+
+    /* Each packed first, to find the longest. Every path gets at least one copy of
+     * its last point, so lookups can always read the point after theirs */
+    int path_size = (ColourPath_MAX_NUM_POINTS * 2 + 1) * POINT_SIZE;
+    float * packed = malloc(sizeof(float) * path_size * num_paths);
+    int * lengths = malloc(sizeof(int) * num_paths);
+    if (packed == NULL || lengths == NULL) {
+        free(packed);
+        free(lengths);
+        return 1;
+    }
+    LUT->num_points = 0;
+    for (int p = 0; p < num_paths; ++p)
+    {
+        lengths[p] = pack_path(Paths + p, packed + p * path_size);
+        LUT->num_points = MAX(LUT->num_points, lengths[p] + 1);
+    }
+
+    /* (Fewer than 256 points, for the index) */
+    LUT->points = (LUT->num_points <= 255) ? malloc(sizeof(float) * POINT_SIZE * LUT->num_points * num_paths) : NULL;
+    if (LUT->points != NULL)
+    {
+        for (int p = 0; p < num_paths; ++p)
+        {
+            float * in = packed + p * path_size;
+            float * out = LUT->points + p * LUT->num_points * POINT_SIZE;
+            memcpy(out, in, sizeof(float) * POINT_SIZE * lengths[p]);
+            for (int i = lengths[p]; i < LUT->num_points; ++i)
+                memcpy(out + i * POINT_SIZE, in + (lengths[p]-1) * POINT_SIZE, sizeof(float) * POINT_SIZE);
+        }
+    }
+
+    free(packed);
+    free(lengths);
+    return (LUT->points == NULL || index_paths(LUT));
+}
+
+void uninit_PathLUT(PathLUT_t * LUT)
+{
+    if (LUT->mapping != NULL) Util_UnmapFile(LUT->mapping, LUT->mapping_size);
+    else free(LUT->points);
+    free(LUT->index);
+    LUT->points = NULL;
+    LUT->index = NULL;
+    LUT->mapping = NULL;
+}
+
+/************************************ Disk cache *************************************/
+
+/* Bump this whenever path generation changes, so old cache files are not used */
+#define PATH_CACHE_VERSION 2
+
+/* Cache file header, followed by the points at header_size */
+typedef struct {
+    char magic[8]; /* "LDRTPATH" */
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t key;
+    int32_t resolution;
+    int32_t num_points;
+    uint64_t data_size;
+    uint8_t padding[24];
+} path_cache_header_t;
+
+/* 64 bit FNV-1a */
+static uint64_t hash_bytes(uint64_t Hash, void * Data, size_t Size)
+{
+    uint8_t * bytes = Data;
+    for (size_t i = 0; i < Size; ++i) {
+        Hash ^= bytes[i];
+        Hash *= 0x100000001b3ULL;
+    }
+    return Hash;
+}
+
+uint64_t PathLUT_CacheKey(double * RGB_to_XYZ, float CornerSmoothness, int Resolution)
+{
+    int32_t version = PATH_CACHE_VERSION;
+    int32_t resolution = Resolution;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    hash = hash_bytes(hash, &version, sizeof(version));
+    hash = hash_bytes(hash, &resolution, sizeof(resolution));
+    hash = hash_bytes(hash, &CornerSmoothness, sizeof(CornerSmoothness));
+    hash = hash_bytes(hash, RGB_to_XYZ, sizeof(double) * 9);
+    return hash;
+}
+
+static void cache_file_name(char * CacheDir, uint64_t Key, char * Out, size_t OutSize)
+{
+    snprintf(Out, OutSize, "%s/paths_%016llx.lut", CacheDir, (unsigned long long)Key);
+}
+
+int PathLUT_LoadCache(PathLUT_t * LUT, char * CacheDir, uint64_t Key)
+{
+    char file_name[4096];
+    cache_file_name(CacheDir, Key, file_name, sizeof(file_name));
+
+    uint64_t size = 0;
+    uint8_t * file = Util_MapFile(file_name, &size);
+    if (file == NULL) return 1;
+
+    path_cache_header_t * header = (path_cache_header_t *)file;
+    if ( size < sizeof(path_cache_header_t)
+      || memcmp(header->magic, "LDRTPATH", 8)
+      || header->version != PATH_CACHE_VERSION
+      || header->key != Key
+      || header->num_points < 1 || header->num_points > 255
+      || header->data_size != sizeof(float) * POINT_SIZE * header->num_points * header->resolution * header->resolution
+      || size != header->header_size + header->data_size )
+    {
+        Util_UnmapFile(file, size);
+        return 1;
+    }
+
+    LUT->resolution = header->resolution;
+    LUT->num_points = header->num_points;
+    LUT->points = (float *)(file + header->header_size);
+    LUT->mapping = file;
+    LUT->mapping_size = size;
+    if (index_paths(LUT)) {
+        uninit_PathLUT(LUT);
+        return 1;
+    }
+    return 0;
+}
+
+int PathLUT_SaveCache(PathLUT_t * LUT, char * CacheDir, uint64_t Key)
+{
+    char file_name[4096], temp_name[4200];
+    cache_file_name(CacheDir, Key, file_name, sizeof(file_name));
+    /* Written to a temporary name and renamed, so other processes never see half a file */
+    snprintf(temp_name, sizeof(temp_name), "%s.%i.tmp", file_name, (int)getpid());
+
+    path_cache_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "LDRTPATH", 8);
+    header.version = PATH_CACHE_VERSION;
+    header.header_size = sizeof(header);
+    header.key = Key;
+    header.resolution = LUT->resolution;
+    header.num_points = LUT->num_points;
+    header.data_size = sizeof(float) * POINT_SIZE * LUT->num_points * LUT->resolution * LUT->resolution;
+
+    FILE * file = fopen(temp_name, "wb");
+    if (file == NULL) return 1;
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1
+          && fwrite(LUT->points, header.data_size, 1, file) == 1;
+    ok = (fclose(file) == 0) && ok;
+
+    if (!ok || rename(temp_name, file_name) != 0) {
+        remove(temp_name);
+        return 1;
+    }
+    return 0;
+}
+
+/* Interpolates one path at luminance Y, from the last point at or below it */
+static inline void sample_path(float * Path, int NumPoints, int Point, float Y, float * Out)
+{
+    /* The last point is a copy, so stopping before it still gets the end of the path */
+    while (Point < NumPoints-2 && Path[(Point+1) * POINT_SIZE] <= Y) ++Point;
+
+    /* Below the first point (or NaN) the factor is 0, past the end it's 0 as well */
+    float * a = Path + Point * POINT_SIZE;
+    float fac = (Y - a[0]) * a[1];
+    fac = (fac > 0.0f) ? fac : 0.0f;
+    for (int i = 0; i < 3; ++i)
+        Out[i] = a[i+2] * (1.0f-fac) + a[POINT_SIZE+i+2] * fac;
+}
+
+void PathLUT_Lookup(PathLUT_t * LUT, float * RGB, float Y, float * Out)
+{
+    int res = LUT->resolution;
+
+    /* Index the LUT */
+    float sum = (RGB[0] + RGB[1] + RGB[2]);
+    if (sum == 0.0) sum = 1.0; /* Just to division by zero if it's a black pixel */
+    float r = RGB[0] / sum * (res-1.0) * 0.999999; /* The 0.99999 is just to avoid going to the very edge of the LUT and breaking my interpolation. TODO: fix this. */
+    float g = RGB[1] / sum * (res-1.0) * 0.999999;
+    int ir = r;
+    int ig = g;
+
+    /* Weights */
+    float w_r = r - ir;
+    float w_g = g - ig;
+
+    /* Where to start along the paths */
+    float step = Y * LUT->index_scale;
+    int is = (step > 0.0f) ? (int)MIN(step, PathLUT_INDEX_SIZE-1) : 0;
+
+    /* Interpolate along four paths, then blend the resulting value... */
+    int num_points = LUT->num_points;
+    int path_size = num_points * POINT_SIZE;
+    int p00_index = ir * res + ig;
+    float * p00_path = LUT->points + p00_index * path_size;
+    uint8_t * p00_start = LUT->index + p00_index * PathLUT_INDEX_SIZE + is;
+    float p01[3], p11[3], p00[3], p10[3];
+    sample_path(p00_path, num_points, p00_start[0], Y, p00);
+    sample_path(p00_path + res * path_size, num_points, p00_start[res * PathLUT_INDEX_SIZE], Y, p10);
+    sample_path(p00_path + path_size, num_points, p00_start[PathLUT_INDEX_SIZE], Y, p01);
+    sample_path(p00_path + (res+1) * path_size, num_points, p00_start[(res+1) * PathLUT_INDEX_SIZE], Y, p11);
+
+    for (int c = 0; c < 3; ++c)
+    {
+        Out[c] = (p00[c] * (1.0-w_g) + p01[c] * w_g) * (1.0-w_r)
+               + (p10[c] * (1.0-w_g) + p11[c] * w_g) * w_r;
+    }
+}
+
+void find_RGB_hull_rib(double * XYZ_to_RGB, double * RGB_to_XYZ, float * EndRGB, int NumPoints, ColourPath_t * RibOut)
+{
+    /* Convert to perceptual space. Yeah too many lines of code. */
+    float white_XYZ[3] = {1,1,1};
+    float end_XYZ[3] = {EndRGB[0], EndRGB[1], EndRGB[2]};
+    applyMatrix_f(white_XYZ, RGB_to_XYZ);
+    applyMatrix_f(end_XYZ, RGB_to_XYZ);
+    float white_CAM[3];     /* Perceptual coordinate of white */
+    float end_CAM[3];       /* Perceptual coordinate of the end point */
+    XYZ_to_IPT(white_XYZ, white_CAM, 1);
+    XYZ_to_IPT(end_XYZ, end_CAM, 1);
+
+    for (int i = 0; i < NumPoints; ++i)
+    {
+        float progress = ((float)i) / (NumPoints-1.0f);
+
+        /* Interpolate between the white point and the colour point in perceptual space... */
+        float result[3];
+        for (int j = 0; j < 3; ++j)
+        {
+            result[j] = white_CAM[j] * progress + end_CAM[j] * (1.0f - progress);
+        }
+
+        /* Convert back to RGB... */
+        IPT_to_XYZ(result, result, 1);
+        applyMatrix_f(result, XYZ_to_RGB);
+
+        /* Normalise so maxRGB = 1, this places te point on the hull's 'canopy' (maximum output brightness) */
+        float max_rgb = MAX(result[0], MAX(result[1], result[2]));
+        for (int j = 0; j < 3; ++j)
+        {
+            /* Normalise */
+            result[j] /= max_rgb;
+    
+            /* Because some colours (THE REC709 BLUE PRIMARY) curve so strongly in perceptual space,
+             * there is no straight line to white, so I clip negative channels to bring the path
+             * back on to the edge of the gamut. In this case clipping is fine because
+             * distances and precision don't matter, the path just needs to be brought to the
+             * edge and will be interpolated on later. */
+            if (result[j] < 0.0) result[j] = 0.0;
+        }
+
+        /* Convert back to perceptual space */
+        applyMatrix_f(result, RGB_to_XYZ);
+        XYZ_to_IPT(result, result, 1);
+
+        /* Output the point to the colour path. */
+        ColourPathAddPointByValue(RibOut, result);
+    }
+}
@@ -0,0 +1,79 @@
+/*
+    LuminanceDRT - Luminance based image formation
+    Copyright (C) 2022  Ilia Sibiryakov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; strictly version 2 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* The 'paths' LUT is an exposure invariant (2D) LUT to find the 'path to white'
+ * for a given chromaticity within the destination RGB space, it uses by RGB chromaticity for
+ * 2D indexing - the same formula as xyY, except with RGB as inputs instead of XYZ. The main
+ * issue is the very bad perceptual uniformity, other than that, works fine. Also only half of
+ * it is actually used.
+ *
+ * For rendering the paths are packed into one array, each only as long as the points
+ * it needs (the longest one's count, shorter ones repeat their last point), which
+ * is what the lookup interpolates between. So it's exactly the generated paths,
+ * which only need 20 to 40 points each, where resampling them evenly took over 100
+ * to get within a code value. */
+
+#ifndef _PathLUT_h_
+#define _PathLUT_h_
+
+#include <stdint.h>
+
+#include "ColourPath.h"
+
+/* Luminance steps of the index into each path */
+#define PathLUT_INDEX_SIZE 32
+
+typedef struct {
+    int resolution; /* Paths along each chromaticity axis */
+    int num_points; /* Per path */
+    float * points; /* [r][g][point][Y, 1/(Y to the next point), R, G, B], going up
+                     * in luminance Y. A lookup reads four paths, so a path's points
+                     * are together */
+    uint8_t * index; /* [r][g][step], the point each luminance step starts from, so
+                      * a lookup only has a point or two to step through */
+    float index_scale; /* PathLUT_INDEX_SIZE / the highest luminance */
+    void * mapping; /* If loaded from the cache, the mapped file */
+    uint64_t mapping_size;
+} PathLUT_t;
+
+/* Generates the paths for an RGB space and packs them, using NumThreads threads
+ * (0 = all cores). Resolution should be 3n+1 so that the whitepoint falls on an
+ * integer coordinate. Returns 0 on success. */
+int PathLUT_Build(PathLUT_t * LUT, double * RGB_to_XYZ, float CornerSmoothness, int Resolution, int NumThreads);
+
+/* Only generates the paths, as they are before packing, into a Resolution x
+ * Resolution array (indexed [r][g]) to free. Returns NULL on failure. */
+ColourPath_t * PathLUT_BuildPaths(double * RGB_to_XYZ, float CornerSmoothness, int Resolution, int NumThreads);
+
+/* Packs a Resolution x Resolution array of paths (indexed [r][g], with luminance
+ * as the distance and RGB as the values). Returns 0 on success. */
+int init_PathLUT(PathLUT_t * LUT, ColourPath_t * Paths, int Resolution);
+void uninit_PathLUT(PathLUT_t * LUT);
+
+/* Built LUTs can be kept in a directory of cache files, named by a hash of everything
+ * that goes into building them. Loaded ones are memory mapped. Both return 0 on
+ * success, load fails if there's no matching file. */
+uint64_t PathLUT_CacheKey(double * RGB_to_XYZ, float CornerSmoothness, int Resolution);
+int PathLUT_LoadCache(PathLUT_t * LUT, char * CacheDir, uint64_t Key);
+int PathLUT_SaveCache(PathLUT_t * LUT, char * CacheDir, uint64_t Key);
+
+/* Finds the output RGB for a colour with chromaticity from RGB (which must not be
+ * negative) and compressed luminance Y */
+void PathLUT_Lookup(PathLUT_t * LUT, float * RGB, float Y, float * Out);
+
+#endif
@@ -1,9 +1,5 @@
-import OpenEXR
-import numpy
-import Imath
 import sys
 import os
-import array
 import argparse
 import math
 
@@ -12,6 +8,15 @@ slope = 1.7
 smoothness = 0.4
 saturation = 1.0
 out_path = "result.bmp"
+threads = 0
+lut3d = 0
+precision = "high"
+tone_table = False
+cache = None
+lut_resolution = 31
+memory = 0
+dither = False
+bit_depth = 0
 
 # Construct the argument parser
 ap = argparse.ArgumentParser()
@@ -25,7 +30,25 @@ ap.add_argument("--smoothness", type=float, required=False,
 ap.add_argument("--saturation", type=float, required=False,
    help="Saturation factor, default is " + str(saturation))
 ap.add_argument("--output", type=str, required=False,
-   help="Specify output path/filename, ending in .bmp")
+   help="Specify output path/filename, ending in .bmp, .ppm, .png, .tif, .pfm or .exr")
+ap.add_argument("--threads", type=int, required=False,
+   help="Number of threads to render with, default is all cores")
+ap.add_argument("--lut3d", type=int, required=False,
+   help="Bake the transform into a 3D LUT of this size (e.g. 65) and render through it, faster but approximate")
+ap.add_argument("--precision", type=str, required=False, choices=["exact", "high", "fast"],
+   help="How the IPT power curve is calculated: exact (powf), high (within ~1e-6, the default) or fast (within ~3e-4)")
+ap.add_argument("--tone-table", action="store_true",
+   help="Do the contrast through a 1D table instead of working it out per pixel, slightly faster")
+ap.add_argument("--cache", type=str, required=False,
+   help="Directory to keep generated path LUTs in, so they are only built once per set of parameters")
+ap.add_argument("--lut-resolution", type=int, required=False,
+   help="Resolution of the paths LUT, should be 3n+1, default is " + str(lut_resolution))
+ap.add_argument("--memory", type=int, required=False,
+   help="Render in strips so the image buffers use roughly this many MiB, default is no limit")
+ap.add_argument("--dither", action="store_true",
+   help="Ordered dither the 8-bit output, hides banding in smooth gradients")
+ap.add_argument("--bit-depth", type=int, required=False,
+   help="Bits per channel of the output: 8 or 16 for ppm, png and tif, 16 (half) or 32 for exr, default is 8 (exr 16)")
 ap.add_argument("--file", type=str, required=True,
    help="Path to an EXR file")
 args = vars(ap.parse_args())
@@ -40,52 +63,34 @@ if (args['slope']): slope = args['slope']
 if (args['smoothness']): smoothness = args['smoothness']
 if (args['exposure']): exposure = args['exposure']
 if (args['output']): out_path = args['output']
+if (args['threads']): threads = args['threads']
+if (args['lut3d']): lut3d = args['lut3d']
+if (args['precision']): precision = args['precision']
+if (args['tone_table']): tone_table = True
+if (args['cache']): cache = args['cache']
+if (args['lut_resolution']): lut_resolution = args['lut_resolution']
+if (args['memory']): memory = args['memory']
+if (args['dither']): dither = True
+if (args['bit_depth']): bit_depth = args['bit_depth']
 
 print("smoothness = " + str(smoothness))
 print("slope = " + str(slope))
 print("exposure = " + str(exposure))
 print("saturation = " + str(saturation))
 
-pt = Imath.PixelType(Imath.PixelType.FLOAT)
-
-exr_file = OpenEXR.InputFile(input_file_path)
-
-red = array.array('f', exr_file.channel('R', pt))
-green = array.array('f', exr_file.channel('G', pt))
-blue = array.array('f', exr_file.channel('B', pt))
-
-#just making an array of the same size as all channels together cauz i dont know how to use array module or python at all
-result_buffer = array.array('f', red + blue + green) 
-
-print("length = " + str(len(result_buffer)))
-
-dw = exr_file.header()['dataWindow']
-image_width = dw.max.x - dw.min.x + 1
-image_height = dw.max.y - dw.min.y + 1
-
-print("width = " + str(image_width))
-print("height = " + str(image_height))
-
-print(type(result_buffer).__name__)
-
-for i in range (0, image_height*image_width):
-    result_buffer[i * 3] = red[i]
-    result_buffer[i*3+1] = green[i]
-    result_buffer[i*3+2] = blue[i]
-
-# binary reference to the float data in RGB
-as_bytes = bytes(result_buffer)
-# save it to a file
-with open("binary_data", "wb") as binary_file:
-    # Write bytes to file
-    binary_file.write(as_bytes)
-
-os.system("./process_data binary_data " + str(image_width)
-                                        + " " + str(image_height)
+# process_data reads the EXR itself, the size is taken from the file
+os.system("./process_data \"" + input_file_path + "\" 0 0"
                                         + " " + str(saturation)
                                         + " " + str(slope)
                                         + " " + str(smoothness)
                                         + " " + str(exposure)
-                                        + " " + str(out_path))
-
-os.remove("binary_data")
\ No newline at end of file
+                                        + " " + str(out_path)
+                                        + " --threads " + str(threads)
+                                        + " --lut3d " + str(lut3d)
+                                        + " --precision " + precision
+                                        + (" --tone-table" if tone_table else "")
+                                        + " --lut-resolution " + str(lut_resolution)
+                                        + " --memory " + str(memory)
+                                        + (" --dither" if dither else "")
+                                        + " --bit-depth " + str(bit_depth)
+                                        + ((" --cache " + str(cache)) if cache else ""))
@@ -0,0 +1,223 @@
+/*
+    LuminanceDRT - Luminance based image formation
+    Copyright (C) 2022  Ilia Sibiryakov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; strictly version 2 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "Profile.h"
+
+#ifdef LDRT_PROFILE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+/* Most spans kept per thread for the trace, the rest are only counted */
+#define PROFILE_MAX_EVENTS (1 << 20)
+
+static char * stage_names[PROFILE_NUM_STAGES] = {
+    "load", "lut build", "lut3d bake", "exposure", "ipt", "contrast+saturation",
+    "path lookup", "lut3d", "encode", "write"
+};
+
+typedef struct {
+    uint64_t start, end;
+    int stage;
+} profile_event_t;
+
+/* Util_ParallelFor starts new threads every call, so a thread's record is given
+ * back when it ends and the next new thread takes the lowest free one. Records are
+ * never taken off the list, there's one per worker slot (as many as ran at once). */
+typedef struct profile_thread {
+    int index;
+    int free;
+    uint64_t total_ns[PROFILE_NUM_STAGES];
+    uint64_t spans[PROFILE_NUM_STAGES];
+    profile_event_t * events;
+    int num_events, max_events;
+    uint64_t dropped_events;
+    struct profile_thread * next;
+} profile_thread_t;
+
+int profile_enabled = 0;
+static int profile_trace = 0;
+static uint64_t profile_start;
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static profile_thread_t * profile_threads = NULL;
+static int profile_num_threads = 0;
+static _Thread_local profile_thread_t * this_thread = NULL;
+static pthread_key_t thread_key; /* Only for release_thread when the thread ends */
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+
+static void release_thread(void * Thread)
+{
+    profile_thread_t * thread = Thread;
+    pthread_mutex_lock(&profile_lock);
+    thread->free = 1;
+    pthread_mutex_unlock(&profile_lock);
+}
+
+static void make_thread_key()
+{
+    pthread_key_create(&thread_key, release_thread);
+}
+
+static profile_thread_t * get_thread()
+{
+    if (this_thread != NULL) return this_thread;
+    pthread_once(&thread_key_once, make_thread_key);
+
+    pthread_mutex_lock(&profile_lock);
+    profile_thread_t * thread = NULL;
+    for (profile_thread_t * t = profile_threads; t != NULL; t = t->next)
+        if (t->free && (thread == NULL || t->index < thread->index)) thread = t;
+    if (thread == NULL && (thread = calloc(1, sizeof(profile_thread_t))) != NULL) {
+        thread->index = profile_num_threads++;
+        thread->next = profile_threads;
+        profile_threads = thread;
+    }
+    if (thread != NULL) thread->free = 0;
+    pthread_mutex_unlock(&profile_lock);
+
+    if (thread == NULL) return NULL;
+    pthread_setspecific(thread_key, thread);
+    return (this_thread = thread);
+}
+
+void Profile_Record(int Stage, uint64_t Start)
+{
+    if (!profile_enabled) return;
+    uint64_t end = Profile_Now();
+    profile_thread_t * thread = get_thread();
+    if (thread == NULL) return;
+    thread->total_ns[Stage] += end - Start;
+    ++thread->spans[Stage];
+    if (!profile_trace) return;
+
+    if (thread->num_events == thread->max_events)
+    {
+        int max_events = (thread->max_events == 0) ? 4096 : thread->max_events * 2;
+        profile_event_t * events = NULL;
+        if (max_events <= PROFILE_MAX_EVENTS) events = realloc(thread->events, sizeof(profile_event_t) * max_events);
+        if (events == NULL) {
+            ++thread->dropped_events;
+            return;
+        }
+        thread->events = events;
+        thread->max_events = max_events;
+    }
+    thread->events[thread->num_events++] = (profile_event_t) {.start = Start, .end = end, .stage = Stage};
+}
+
+int Profile_Enable(int Trace)
+{
+    profile_trace = Trace;
+    profile_enabled = 1;
+    profile_start = Profile_Now();
+    return 0;
+}
+
+static void write_stages(FILE * File, uint64_t * TotalNs, uint64_t * Spans, char * Indent)
+{
+    int first = 1;
+    fprintf(File, "[");
+    for (int s = 0; s < PROFILE_NUM_STAGES; ++s)
+    {
+        if (Spans[s] == 0) continue;
+        fprintf(File, "%s\n%s{\"stage\": \"%s\", \"total_ms\": %.3f, \"spans\": %llu, \"mean_us\": %.3f}",
+                first ? "" : ",", Indent, stage_names[s], TotalNs[s] * 1e-6, (unsigned long long)Spans[s],
+                TotalNs[s] * 1e-3 / Spans[s]);
+        first = 0;
+    }
+    fprintf(File, "]");
+}
+
+int Profile_WriteJSON(char * Path)
+{
+    FILE * file = fopen(Path, "w");
+    if (file == NULL) return 1;
+
+    uint64_t total_ns[PROFILE_NUM_STAGES] = {0}, spans[PROFILE_NUM_STAGES] = {0}, dropped = 0;
+    for (profile_thread_t * t = profile_threads; t != NULL; t = t->next)
+    {
+        for (int s = 0; s < PROFILE_NUM_STAGES; ++s) {
+            total_ns[s] += t->total_ns[s];
+            spans[s] += t->spans[s];
+        }
+        dropped += t->dropped_events;
+    }
+
+    /* Stage times are thread time, added up over all the threads */
+    fprintf(file, "{\n  \"wall_ms\": %.3f,\n  \"threads_used\": %i,\n", (Profile_Now() - profile_start) * 1e-6, profile_num_threads);
+    if (dropped) fprintf(file, "  \"trace_spans_dropped\": %llu,\n", (unsigned long long)dropped);
+    fprintf(file, "  \"stages\": ");
+    write_stages(file, total_ns, spans, "    ");
+    fprintf(file, ",\n  \"threads\": [");
+    for (int i = 0; i < profile_num_threads; ++i)
+    {
+        profile_thread_t * t = profile_threads;
+        while (t->index != i) t = t->next;
+        fprintf(file, "%s\n    {\"thread\": %i, \"stages\": ", i ? "," : "", i);
+        write_stages(file, t->total_ns, t->spans, "      ");
+        fprintf(file, "}");
+    }
+    fprintf(file, "\n  ]\n}\n");
+    return fclose(file) != 0;
+}
+
+int Profile_WriteTrace(char * Path)
+{
+    FILE * file = fopen(Path, "w");
+    if (file == NULL) return 1;
+
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    int first = 1;
+    for (profile_thread_t * t = profile_threads; t != NULL; t = t->next)
+    {
+        fprintf(file, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %i, \"args\": {\"name\": \"worker %i\"}}",
+                first ? "" : ",", t->index, t->index);
+        first = 0;
+        for (int e = 0; e < t->num_events; ++e)
+        {
+            profile_event_t * event = &t->events[e];
+            fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %i, \"ts\": %.3f, \"dur\": %.3f}",
+                    stage_names[event->stage], t->index, (event->start - profile_start) * 1e-3, (event->end - event->start) * 1e-3);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    return fclose(file) != 0;
+}
+
+#else
+
+int Profile_Enable(int Trace)
+{
+    (void)Trace;
+    return 1;
+}
+
+int Profile_WriteJSON(char * Path)
+{
+    (void)Path;
+    return 1;
+}
+
+int Profile_WriteTrace(char * Path)
+{
+    (void)Path;
+    return 1;
+}
+
+#endif
@@ -0,0 +1,85 @@
+/*
+    LuminanceDRT - Luminance based image formation
+    Copyright (C) 2022  Ilia Sibiryakov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; strictly version 2 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* Per stage timing of the render, for seeing where the time goes on real images.
+ *
+ * Only there when built with LDRT_PROFILE defined (PROFILE=1 ./build.sh), otherwise
+ * PROFILE_BEGIN and PROFILE_END are nothing. Even when built in it does nothing
+ * until Profile_Enable is called.
+ *
+ * Every thread adds up its own time and number of spans per stage, with no
+ * locking. With tracing on, every span is also kept (up to a limit per thread) for
+ * a Chrome trace (chrome://tracing or ui.perfetto.dev). */
+
+#ifndef _Profile_h_
+#define _Profile_h_
+
+#include <stdint.h>
+
+enum {
+    PROFILE_LOAD, /* Reading or decoding the input */
+    PROFILE_LUT_BUILD, /* Making or loading the paths LUT */
+    PROFILE_LUT3D_BAKE,
+    PROFILE_EXPOSURE, /* Loading pixels into the tile with exposure */
+    PROFILE_IPT, /* RGB to IPT and back */
+    PROFILE_CONTRAST_SATURATION,
+    PROFILE_PATH_LOOKUP,
+    PROFILE_LUT3D, /* Rendering through the 3D LUT instead of the last 4 */
+    PROFILE_ENCODE, /* Storing or encoding (to sRGB) rendered pixels */
+    PROFILE_WRITE, /* Finishing rows of the output file */
+    PROFILE_NUM_STAGES
+};
+
+#ifdef LDRT_PROFILE
+
+#include <time.h>
+
+extern int profile_enabled;
+
+static inline uint64_t Profile_Now()
+{
+    if (!profile_enabled) return 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* Adds the time from Start (Profile_Now) to now to Stage */
+void Profile_Record(int Stage, uint64_t Start);
+
+#define PROFILE_BEGIN(Stage) uint64_t profile_start_##Stage = Profile_Now()
+#define PROFILE_END(Stage) Profile_Record(Stage, profile_start_##Stage)
+
+#else
+
+#define PROFILE_BEGIN(Stage)
+#define PROFILE_END(Stage)
+
+#endif
+
+/* Starts recording, keeping every span if Trace is set. Returns 1 if profiling
+ * isn't built in. */
+int Profile_Enable(int Trace);
+
+/* Totals per stage, overall and per thread. Returns 0 on success. */
+int Profile_WriteJSON(char * Path);
+
+/* The spans in Chrome's trace event format. Returns 0 on success. */
+int Profile_WriteTrace(char * Path);
+
+#endif
@@ -22,180 +22,258 @@ This is the main program that does the image formation
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <math.h>
+#include <string.h>
+#include <strings.h>
 #include <unistd.h>
-
-#include "Matrix.h"
-#include "ColourPath.h"
-#include "IPT.h"
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "EXR.h"
+#include "ImageWriter.h"
+#include "LuminanceDRT.h"
+#include "Profile.h"
 #include "Utilities/Utilities.h"
 
 #define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
 #define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
 
-/* Functions used by the code */
-double do_contrast(double X, double Power, double Scale);
+/* Strips are a multiple of this many rows (and of the EXR chunk size), enough
+ * for each one to be spread across the threads */
+#define STRIP_ROWS_UNIT 16
+
+/* Parameter sets the daemon keeps contexts for if not set */
+#define DAEMON_DEFAULT_CONTEXTS 4
+
+/* Settings that come after the positional arguments */
+typedef struct {
+    int num_threads; /* 0 = use all cores */
+    int lut3d_size; /* Render through a baked 3D LUT of this size, 0 = exact */
+    int precision; /* Of the IPT power curve, LDRT_PRECISION_... */
+    int tone_table; /* Do the contrast through a 1D table */
+    char * cache_dir; /* Where to keep built path LUTs */
+    int lut_resolution; /* Paths along each axis of the paths LUT */
+    int max_memory_mib; /* Roughly how much the image buffers can use, 0 = no limit */
+    int dither; /* Ordered dither the 8-bit output */
+    int sync; /* Wait for each output file to reach the disk */
+    int bit_depth; /* Of the output, 0 = the format's default */
+    /* Batch mode, frames are either FIRST to LAST of a pair of patterns or a list */
+    char * in_pattern, * out_pattern;
+    int first_frame, last_frame;
+    char * frame_list;
+    int raw_width, raw_height; /* Of raw (not EXR) frames */
+    int half_input; /* Raw input is half (16 bit) float RGB */
+    int max_contexts; /* Daemon mode, how many parameter sets to keep ready */
+    char * profile_path, * trace_path; /* Where to write the profile and Chrome trace */
+} options_t;
+
+/* Defaults, then any options from argv[First] on. Returns 0 on success, 1 (with a
+ * message) if an option has a bad value. */
+static int parse_options(options_t * Options, int argc, char ** argv, int First);
+/* Only the options in argv, on top of what's already set, returns the same */
+static int apply_options(options_t * Options, int argc, char ** argv, int First);
+
+/* Parameters are the SATURATION SLOPE SMOOTHNESS EXPOSURE arguments */
+static LDRT_Parameters_t context_parameters(char ** Parameters, options_t * Options);
+/* Returns NULL on failure */
+static LDRT_Context_t * create_context(char ** Parameters, options_t * Options);
+
+/* Inputs and outputs starting with this are POSIX shared memory objects
+ * (shm:/name) of interleaved float RGB, for the daemon's clients */
+#define SHARED_MEMORY_PREFIX "shm:"
+
+/* The image being rendered, either an EXR (read as planar RGB a strip at a time)
+ * or raw interleaved float or half RGB, in a file or shared memory, which is mapped
+ * and rendered from directly. Half EXRs are kept half, the library converts them. */
+typedef struct {
+    char * path;
+    int is_exr;
+    EXRImage_t exr;
+    void * raw;
+    uint64_t raw_size;
+    int is_half;
+    int width, height;
+} source_t;
+
+/* Bytes per pixel of the output, 0 (with a message) if it can't be written */
+static int output_pixel_bytes(char * OutPath, options_t * Options);
+
+/* Width, Height and Half are for raw input. Returns 0 on success. */
+static int open_source(source_t * Source, char * Path, int Width, int Height, int Half);
+static void close_source(source_t * Source);
+
+/* Renders the whole source to an image file, or to shared memory as display linear
+ * float RGB, at Exposure stops (whatever the context was made with). Returns 0 on
+ * success. */
+static int render_image(LDRT_Context_t * Context, source_t * Source, char * OutPath, double Exposure, options_t * Options);
+
+/* Where rendered pixels are encoded to, for encode_pixels */
+typedef struct {
+    ImageWriter_t * writer;
+    int row_offset; /* Image row of the first row rendered */
+} encode_target_t;
+
+static void encode_pixels(void * Target, float * const * RGB, int X, int Y, int NumPixels);
+
+/* Renders a sequence of frames with one context, see the usage in main */
+static int run_batch(LDRT_Context_t * Context, options_t * Options);
+
+/* Takes render jobs on a Unix domain socket until killed, see the usage in main */
+static int run_daemon(char * SocketPath, options_t * Options);
+
+/* If --profile or --trace were given, starts profiling, and writes them at the end */
+static void start_profile(options_t * Options);
+static void finish_profile(options_t * Options);
 
-/* Compresses a value from 0-infinity to 0-1
- * Passing 1 to power = very smooth, higher values = sharper roll off */
-float compress_value(float x, float power);
-float uncompress_value(float x, float power); /* Inverse */
+int main(int argc, char ** argv)
+{
+    /* Standalone mode that only builds the path LUT into a cache directory, so renders
+     * don't have to: process_data --build-cache DIR SMOOTHNESS [--threads N] [--lut-resolution N] */
+    if (argc >= 4 && !strcmp(argv[1], "--build-cache"))
+    {
+        LDRT_Parameters_t parameters;
+        LDRT_DefaultParameters(&parameters);
+        parameters.cache_dir = argv[2];
+        parameters.smoothness = atof(argv[3]);
+        for (int a = 4; a < argc; ++a) {
+            if (!strcmp(argv[a], "--threads") && a+1 < argc) parameters.num_threads = atoi(argv[++a]);
+            else if (!strcmp(argv[a], "--lut-resolution") && a+1 < argc) parameters.lut_resolution = atoi(argv[++a]);
+        }
+        return LDRT_BuildCache(&parameters);
+    }
 
-/* Finds a constant hue rib along the gamut's top surface. */
-void find_RGB_hull_rib(double * XYZ_to_RGB, double * RGB_to_XYZ, float * EndRGB, int NumPoints, ColourPath_t * RibOut);
+    /* Batch mode, builds the transform once and renders a sequence of frames:
+     *   process_data --batch SATURATION SLOPE SMOOTHNESS EXPOSURE
+     *       (--frames INPUT OUTPUT FIRST LAST | --list FILE) [--size WIDTH HEIGHT] [options]
+     * INPUT and OUTPUT are patterns with one printf integer (like shot.%04d.exr), a list
+     * file has an INPUT OUTPUT pair on each line. --size is for raw frames. */
+    if (argc >= 6 && !strcmp(argv[1], "--batch"))
+    {
+        options_t options;
+        if (parse_options(&options, argc, argv, 6)) return 1;
+        start_profile(&options);
+        LDRT_Context_t * context = create_context(argv + 2, &options);
+        if (context == NULL) return 1;
+        int error = run_batch(context, &options);
+        LDRT_Destroy(context);
+        finish_profile(&options);
+        return error;
+    }
 
+    /* Daemon mode, keeps the contexts of recent parameter sets and renders jobs sent
+     * to a Unix domain socket, several at once:
+     *   process_data --daemon SOCKET [--contexts N] [options]
+     * A job is a line of the same arguments as a single image, with options on top of
+     * the daemon's, and is answered with a line of OK SECONDS or ERROR. */
+    if (argc >= 3 && !strcmp(argv[1], "--daemon"))
+    {
+        options_t options;
+        if (parse_options(&options, argc, argv, 3)) return 1;
+        return run_daemon(argv[2], &options);
+    }
 
-/* The 'paths' LUT is an exposure invariant (2D) LUT to find the 'path to white'
- * for a given chromaticity within the destination RGB space, it uses by RGB chromaticity for
- * 2D indexing - the same formula as xyY, except with RGB as inputs instead of XYZ. The main
- * issue is the very bad perceptual uniformity, other than that, works fine. Also only half of
- * it is actually used.
- * 
- * (Resultion should be 3n+1 so that the whitepoint falls on an integer coordinate)
- */
-#define LUT_RESOLUTION 31
-ColourPath_t paths[LUT_RESOLUTION][LUT_RESOLUTION];
-/* (I put it as a global variable cause it would cause instant stack overflows when it's too big) */
+    options_t options;
+    if (parse_options(&options, argc, argv, 9)) return 1;
+    if (output_pixel_bytes(argv[8], &options) == 0) return 1;
+    start_profile(&options);
 
+    source_t source;
+    if (open_source(&source, argv[1], atoi(argv[2]), atoi(argv[3]), options.half_input)) return 1;
 
-#include <time.h>
-#define CREATE_TIMER(TName) clock_t start##TName, diff##TName; int msec##TName;
-#define START_TIMER(TName) start##TName = clock();
-#define END_TIMER(TName) diff##TName=clock()-start##TName;msec##TName=diff##TName*1000/CLOCKS_PER_SEC;
-#define GET_TIMER_RESULT(TName) (float)(msec##TName)
+    LDRT_Context_t * context = create_context(argv + 4, &options);
+    if (context == NULL) return 1;
 
-int main(int argc, char ** argv)
+    int error = render_image(context, &source, argv[8], atof(argv[7]), &options);
+
+    close_source(&source);
+    LDRT_Destroy(context);
+    finish_profile(&options);
+    return error;
+}
+
+
+static void start_profile(options_t * Options)
 {
-    /* Open the data */
-    float * colour_image = Util_OpenFileToMemory(argv[1], 1000000, NULL);
-    int image_width = atoi(argv[2]);
-    int image_height = atoi(argv[3]);
-    float contrast_slope = atof(argv[5]);
-    float saturation_factor = atof(argv[4]) * sqrt(contrast_slope);
-    float compression_smoothness = 1.05; /* 1 = smoothest, higher values are sharper */
-    float exposure_factor = pow(2.0, atof(argv[7]));
-    float corner_smoothness = atof(argv[6]);
-    char * out_path = argv[8];
-
-    /* Apply exposure */
-    for (int i = 0; i < 3*image_height*image_width; ++i) {
-        colour_image[i] *= exposure_factor;
-    }
-
-    /* Rec709 will be our RGB space */
-    double RGB_to_XYZ[9] = {
-        0.4124564, 0.3575761, 0.1804375,
-        0.2126729, 0.7151522, 0.0721750,
-        0.0193339, 0.1191920, 0.9503041
-    };
-    double XYZ_to_RGB[9];
-    invertMatrix(RGB_to_XYZ, XYZ_to_RGB);
-
-    /* Find the highest saturation distance of the gamut in IPT */
-    float highest_saturation = 0.0;
-    for (int p = 0; p < 3; ++p) {
-        float value[3];
-        Util_HSVToRGB(p / 3.0, 1.0, 1.0, value);
-        applyMatrix_f(value, RGB_to_XYZ);
-        XYZ_to_IPT(value, value, 1);
-        value[1] /= value[0];
-        value[2] /= value[0];
-        float saturation = sqrt(value[1]*value[1] + value[2]*value[2]);
-        if (saturation > highest_saturation) highest_saturation = saturation;
-    }
-    highest_saturation *= 1.03; /* A little safety margin */
-
-
-    /***********************************************************/
-    /***************** Create the LUT now... *******************/
-    /***********************************************************/
-
-    /* Generate paths */
-    for (int r = 0; r < LUT_RESOLUTION; ++r)
-    {
-        float r_chromaticity = ((float)r) / (LUT_RESOLUTION-1.0);
-        for (int g = 0; g < LUT_RESOLUTION; ++g)
-        {
-            float g_chromaticity = ((float)g) / (LUT_RESOLUTION-1.0);
-
-            /* Restore the RGB value for this chromaticity, and normalise to maxRGB = 1 */
-            float RGB[3] = {r_chromaticity, g_chromaticity, 1.0 - r_chromaticity - g_chromaticity};
-            float max_rgb = MAX(RGB[0], MAX(RGB[1], RGB[2]));
-            for (int c = 0; c < 3; ++c) RGB[c] /= max_rgb;
-
-            /* Generate a path like this:
-             * - Black point
-             * - Maximum intensity colour on the top surface of the gamut
-             * - A hue linear rib until white, at maximum RGB intensity
-             */
-            int rib_length = 20;
-            int path_length = rib_length+1;
-            ColourPath_t path;
-            init_ColourPath(&path);
-            /* The black point... */
-            ColourPathAddPointByValues(&path, 0,0,0);
-            /* Now the rib */
-            find_RGB_hull_rib(XYZ_to_RGB, RGB_to_XYZ, RGB, rib_length, &path);
-            /* Now update path distance values, for interpolating along them */
-            ColourPathCalculateDistance(&path, 1.0, 1.0, 1.0);
-
-            /* Now create the rounded path */
-            ColourPath_t * path_final = &paths[r][g];
-            init_ColourPath(path_final);
-            ColourPathAddPoint(path_final, (ColourPathPoint_t){.distance = 0, .value = {0,0,0}});
-
-            int bevel_resolution = 20; /* How many points the rounded section will have */
-            float bevel_scale = corner_smoothness;
-            float bevel_mid = ColourPathGetDistanceOfPoint(&path, 1);
-            float bevel_start = bevel_mid * (1.0-bevel_scale);
-            float bevel_end = bevel_mid + (bevel_mid - bevel_start);
-            if (bevel_end > ColourPathGetLength(&path)) bevel_end = ColourPathGetLength(&path);
-
-            /* Do bevel... */
-            for (int b = 0; b < bevel_resolution; ++b)
-            {
-                float fac = ((float)b) / (bevel_resolution-1.0);
-                float pos_a = fac * (bevel_mid - bevel_start) + bevel_start;
-                float pos_b = fac * (bevel_end - bevel_mid) + bevel_mid;
-
-                float value_a[3];
-                float value_b[3];
-
-                ColourPathInterpolate(&path, pos_a, value_a);
-                ColourPathInterpolate(&path, pos_b, value_b);
-
-                float value[3];
-                for (int i = 0; i < 3; ++i)
-                    value[i] = value_a[i] * (1.0-fac) + value_b[i] * fac;
-
-                ColourPathAddPointByValue(path_final, value);
-            }
+    if (Options->profile_path == NULL && Options->trace_path == NULL) return;
+    if (Profile_Enable(Options->trace_path != NULL)) {
+        printf("Built without profiling, build with PROFILE=1 ./build.sh for --profile and --trace\n");
+        Options->profile_path = Options->trace_path = NULL;
+    }
+}
 
-            for (int p = 0; p < ColourPathGetNumPoints(&path); ++p)
-            {
-                if (ColourPathGetDistanceOfPoint(&path, p) > bevel_end)
-                {
-                    ColourPathAddPoint(path_final, ColourPathGetPoint(&path, p));
-                }
-            }
+static void finish_profile(options_t * Options)
+{
+    if (Options->profile_path != NULL && Profile_WriteJSON(Options->profile_path))
+        printf("Could not write %s\n", Options->profile_path);
+    if (Options->trace_path != NULL && Profile_WriteTrace(Options->trace_path))
+        printf("Could not write %s\n", Options->trace_path);
+}
 
-            /* Convert each point to RGB now, and set luminance as the 'distance'.
-             * The path will be interpolated along using luminance (Y) and will return
-             * the resulting RGB values directly */
-            for (int p = 0; p < ColourPathGetNumPoints(path_final); ++p)
-            {
-                ColourPathPoint_t * point = path_final->points + p;
-                float XYZ[3];
-                IPT_to_XYZ(point->value, XYZ, 1);
-                point->value[0] = XYZ[0];
-                point->value[1] = XYZ[1];
-                point->value[2] = XYZ[2];
-                applyMatrix_f(point->value, XYZ_to_RGB);
-                point->distance = XYZ[1];
-            }
+
+static int is_shared_memory(char * Path)
+{
+    return !strncmp(Path, SHARED_MEMORY_PREFIX, strlen(SHARED_MEMORY_PREFIX));
+}
+
+static int output_pixel_bytes(char * OutPath, options_t * Options)
+{
+    if (is_shared_memory(OutPath)) return sizeof(float) * 3;
+    int pixel_bytes = ImageWriter_PixelBytes(ImageWriter_FormatFromPath(OutPath), Options->bit_depth);
+    if (pixel_bytes == 0) printf("Can't write %s at that bit depth (formats are bmp, ppm, png, tif, pfm and exr)\n", OutPath);
+    return pixel_bytes;
+}
+
+static int open_source(source_t * Source, char * Path, int Width, int Height, int Half)
+{
+    *Source = (source_t) {.path = Path, .width = Width, .height = Height, .is_half = Half};
+    char * extension = strrchr(Path, '.');
+    Source->is_exr = (!is_shared_memory(Path) && extension != NULL && !strcasecmp(extension, ".exr"));
+    if (Source->is_exr)
+    {
+        if (EXR_Open(&Source->exr, Path)) {
+            printf("Could not open %s (must be a scanline EXR with R, G and B)\n", Path);
+            return 1;
         }
+        Source->width = Source->exr.width;
+        Source->height = Source->exr.height;
+        Source->is_half = EXR_IsHalf(&Source->exr);
+        return 0;
     }
 
+    if (is_shared_memory(Path)) Source->raw = Util_MapSharedMemory(Path + strlen(SHARED_MEMORY_PREFIX), &Source->raw_size, 0);
+    else Source->raw = Util_MapFile(Path, &Source->raw_size);
+    size_t pixel_bytes = (Half ? sizeof(uint16_t) : sizeof(float)) * 3;
+    if (Source->raw == NULL || Width < 1 || Height < 1 || Source->raw_size < pixel_bytes * Width * Height) {
+        printf("Could not open %s (should be %ix%i %s RGB)\n", Path, Width, Height, Half ? "half" : "float");
+        close_source(Source);
+        return 1;
+    }
+    return 0;
+}
+
+static void close_source(source_t * Source)
+{
+    if (Source->is_exr) EXR_Close(&Source->exr);
+    else Util_UnmapFile(Source->raw, Source->raw_size);
+    Source->raw = NULL;
+}
+
+static int render_image(LDRT_Context_t * Context, source_t * Source, char * OutPath, double Exposure, options_t * Options)
+{
+    int num_threads = Options->num_threads;
+    int image_width = Source->width;
+    int image_height = Source->height;
+    int is_exr = Source->is_exr;
+    int is_half = Source->is_half;
+    size_t in_pixel_bytes = (is_half ? sizeof(uint16_t) : sizeof(float)) * 3;
+
+    int to_memory = is_shared_memory(OutPath);
+    int out_format = ImageWriter_FormatFromPath(OutPath);
+    int out_pixel_bytes = output_pixel_bytes(OutPath, Options);
+    if (out_pixel_bytes == 0) return 1;
+
 
 /*
 
@@ -209,218 +287,728 @@ ____ ____ _  _ ____ ____ ___ _ ____ _  _
 
 */
 
-    for (int p = 0; p < (image_height*image_width*3); p+=3)
-    {
-        float * pix = colour_image + p;
-
-        /* Unfortunately, I must do this due to negative blue  */
-        for (int c = 0; c < 3; ++c) if (pix[c] < 0.0) pix[c] = 0.0;
-
-        applyMatrix_f(pix, RGB_to_XYZ);
-        XYZ_to_IPT(pix, pix, 1);
+    /* How many rows to render at a time. Without a memory limit it's the whole image,
+     * otherwise as many rows as fit, in whole render bands (and EXR chunks, which are
+     * 1, 16 or 32 rows). EXRs are decoded into a planar RGB buffer, raw input is
+     * mapped, and the output file is mapped (or buffered for PNG), all let go of after
+     * each strip, but a strip of them is in memory while it's rendered. */
+    int strip_unit = MAX(STRIP_ROWS_UNIT, is_exr ? Source->exr.lines_per_chunk : 1);
+    size_t row_bytes = (size_t)image_width * (in_pixel_bytes + out_pixel_bytes);
+    int strip_rows = image_height;
+    if (Options->max_memory_mib > 0) {
+        size_t fit_rows = (size_t)Options->max_memory_mib * 1024 * 1024 / row_bytes / strip_unit * strip_unit;
+        strip_rows = MIN((size_t)image_height, MAX(fit_rows, (size_t)strip_unit));
+    }
 
+    /* The output is encoded as it's rendered, so only EXRs need an input buffer */
+    size_t strip_pixels = (size_t)image_width * strip_rows;
+    void * strip = NULL;
+    if (is_exr && (strip = malloc(in_pixel_bytes * strip_pixels)) == NULL) {
+        printf("Out of memory\n");
+        return 1;
+    }
 
-        /* Expand saturation from (very approximate) footprint boundry */
-        if (pix[0] < 0.0001f) pix[0] = 0.0001f; /* For safety */
-        pix[1] /= pix[0];
-        pix[2] /= pix[0];
-        float saturation_before = sqrt(pix[1]*pix[1] + pix[2]*pix[2]);
-        if (saturation_before >= 0.00001)
-        {
-            float saturation_expanded = uncompress_value(saturation_before / highest_saturation, 1.0) * highest_saturation;
-            pix[1] *= pix[0] * (saturation_expanded/saturation_before);
-            pix[2] *= pix[0] * (saturation_expanded/saturation_before);
+    LDRT_Image_t in;
+    if (is_exr && is_half) {
+        uint16_t * halves = strip;
+        in = LDRT_PlanarHalfImage(halves, halves + strip_pixels, halves + strip_pixels * 2, image_width);
+    }
+    else if (is_exr) {
+        float * floats = strip;
+        in = LDRT_PlanarImage(floats, floats + strip_pixels, floats + strip_pixels * 2, image_width);
+    }
+    else if (is_half) in = LDRT_InterleavedHalfImage(Source->raw, image_width);
+    else in = LDRT_InterleavedImage(Source->raw, image_width);
+
+    int error = 1;
+    ImageWriter_t writer;
+    int writer_open = 0;
+    float * out_memory = NULL;
+    uint64_t out_size = 0;
+    if (to_memory) {
+        out_memory = Util_MapSharedMemory(OutPath + strlen(SHARED_MEMORY_PREFIX), &out_size, 1);
+        if (out_memory == NULL || out_size < sizeof(float) * 3 * (uint64_t)image_width * image_height) {
+            printf("Could not open %s (should be %ix%i float RGB)\n", OutPath, image_width, image_height);
+            goto done;
         }
-        else
-        {
-            pix[1] *= pix[0];
-            pix[2] *= pix[0];
+    }
+    else {
+        if (ImageWriter_Open(&writer, OutPath, out_format, Options->bit_depth, image_width, image_height, strip_rows)) {
+            printf("Could not create %s\n", OutPath);
+            goto done;
         }
+        writer_open = 1;
+        writer.dither = Options->dither;
+        writer.sync = Options->sync;
+    }
 
+    for (int row = 0; row < image_height; row += strip_rows)
+    {
+        int num_rows = MIN(strip_rows, image_height - row);
+        size_t num_pixels = (size_t)image_width * num_rows;
+
+        /* EXR strips are decoded to the top of the buffer, raw input is all there */
+        int in_row = row;
+        if (is_exr) {
+            PROFILE_BEGIN(PROFILE_LOAD);
+            int read_error = is_half ? EXR_ReadRGBHalf(&Source->exr, row, row + num_rows, in.half_channel, 1, num_threads)
+                                     : EXR_ReadRGB(&Source->exr, row, row + num_rows, in.channel, 1, num_threads);
+            PROFILE_END(PROFILE_LOAD);
+            if (read_error) {
+                printf("Could not read %s\n", Source->path);
+                goto done;
+            }
+            in_row = 0;
+        }
 
-        /* Do the slope contrast */
-        pix[0] = IPT_curve(do_contrast(IPT_curve_inverse(pix[0]), contrast_slope, 1.0));
-        /* Do saturation */
-        pix[1] *= saturation_factor;
-        pix[2] *= saturation_factor;
-
+        if (to_memory) {
+            LDRT_Image_t out = LDRT_InterleavedImage(out_memory + (size_t)(row - in_row) * image_width * 3, image_width);
+            LDRT_ApplyRectAtExposure(Context, &in, &out, 0, in_row, image_width, num_rows, Exposure, num_threads);
+        }
+        else {
+            /* Render straight into the output file */
+            encode_target_t target = {.writer = &writer, .row_offset = row - in_row};
+            LDRT_ApplyToSinkAtExposure(Context, &in, 0, in_row, image_width, num_rows, encode_pixels, &target, Exposure, num_threads);
+        }
 
-        /* Contract saturation to footprint boundry */
-        if (saturation_before >= 0.00001)
-        {
-            pix[1] /= pix[0];
-            pix[2] /= pix[0];
-            float saturation_expanded = sqrt(pix[1]*pix[1] + pix[2]*pix[2]);
-            float saturation_contracted = compress_value(saturation_expanded / highest_saturation, 1.0) * highest_saturation;
-            pix[1] *= pix[0] * (saturation_contracted/saturation_expanded);
-            pix[2] *= pix[0] * (saturation_contracted/saturation_expanded);
+        if (!is_exr) Util_ReleaseMappedRange((uint8_t *)Source->raw + (size_t)row * image_width * in_pixel_bytes, in_pixel_bytes * num_pixels);
+        PROFILE_BEGIN(PROFILE_WRITE);
+        int write_error = writer_open && ImageWriter_WriteRows(&writer, row, num_rows);
+        PROFILE_END(PROFILE_WRITE);
+        if (write_error) {
+            printf("Could not write %s\n", OutPath);
+            goto done;
         }
+    }
+    error = 0;
+
+done:
+    free(strip);
+    Util_UnmapFile(out_memory, out_size);
+    PROFILE_BEGIN(PROFILE_WRITE);
+    int close_error = writer_open && ImageWriter_Close(&writer);
+    PROFILE_END(PROFILE_WRITE);
+    if (close_error && !error) {
+        printf("Could not write %s\n", OutPath);
+        error = 1;
+    }
+    return error;
+}
 
 
-        IPT_to_XYZ(pix, pix, 1);
+static int parse_options(options_t * Options, int argc, char ** argv, int First)
+{
+    *Options = (options_t) {
+        .lut_resolution = LDRT_DEFAULT_LUT_RESOLUTION,
+        .max_contexts = DAEMON_DEFAULT_CONTEXTS
+    };
+    return apply_options(Options, argc, argv, First);
+}
 
-        /* Grab the luminance */
-        float Y = compress_value(pix[1], compression_smoothness);
-        applyMatrix_f(pix, XYZ_to_RGB);
+static int apply_options(options_t * Options, int argc, char ** argv, int First)
+{
+    for (int a = First; a < argc; ++a) {
+        if (!strcmp(argv[a], "--threads") && a+1 < argc) Options->num_threads = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--lut3d") && a+1 < argc) Options->lut3d_size = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--precision") && a+1 < argc) {
+            ++a;
+            if (!strcmp(argv[a], "high")) Options->precision = LDRT_PRECISION_HIGH;
+            else if (!strcmp(argv[a], "exact")) Options->precision = LDRT_PRECISION_EXACT;
+            else if (!strcmp(argv[a], "fast")) Options->precision = LDRT_PRECISION_FAST;
+            else {
+                printf("Bad argument --precision %s (precisions are high, exact and fast)\n", argv[a]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[a], "--tone-table")) Options->tone_table = 1;
+        else if (!strcmp(argv[a], "--cache") && a+1 < argc) Options->cache_dir = argv[++a];
+        else if (!strcmp(argv[a], "--lut-resolution") && a+1 < argc) Options->lut_resolution = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--memory") && a+1 < argc) Options->max_memory_mib = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--dither")) Options->dither = 1;
+        else if (!strcmp(argv[a], "--sync")) Options->sync = 1;
+        else if (!strcmp(argv[a], "--bit-depth") && a+1 < argc) Options->bit_depth = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--list") && a+1 < argc) Options->frame_list = argv[++a];
+        else if (!strcmp(argv[a], "--frames") && a+4 < argc) {
+            Options->in_pattern = argv[++a];
+            Options->out_pattern = argv[++a];
+            Options->first_frame = atoi(argv[++a]);
+            Options->last_frame = atoi(argv[++a]);
+        }
+        else if (!strcmp(argv[a], "--size") && a+2 < argc) {
+            Options->raw_width = atoi(argv[++a]);
+            Options->raw_height = atoi(argv[++a]);
+        }
+        else if (!strcmp(argv[a], "--half")) Options->half_input = 1;
+        else if (!strcmp(argv[a], "--contexts") && a+1 < argc) Options->max_contexts = atoi(argv[++a]);
+        else if (!strcmp(argv[a], "--profile") && a+1 < argc) Options->profile_path = argv[++a];
+        else if (!strcmp(argv[a], "--trace") && a+1 < argc) Options->trace_path = argv[++a];
+    }
+    Options->max_contexts = MAX(Options->max_contexts, 1);
+    Options->lut_resolution = MAX(Options->lut_resolution, 2);
+    return 0;
+}
 
-        /* Clip negative channels, as footprint compression. This is a todo. */
-        for (int c = 0; c < 3; ++c) if (pix[c] < 0.0) pix[c] = 0.0;
+static LDRT_Parameters_t context_parameters(char ** Parameters, options_t * Options)
+{
+    return (LDRT_Parameters_t) {
+        .saturation = atof(Parameters[0]),
+        .slope = atof(Parameters[1]),
+        .smoothness = atof(Parameters[2]),
+        .exposure = atof(Parameters[3]),
+        .lut_resolution = Options->lut_resolution,
+        .lut3d_size = Options->lut3d_size,
+        .precision = Options->precision,
+        .tone_table = Options->tone_table,
+        .cache_dir = Options->cache_dir,
+        .num_threads = Options->num_threads
+    };
+}
 
-        /* Index the LUT */
-        float sum = (pix[0] + pix[1] + pix[2]);
-        if (sum == 0.0) sum = 1.0; /* Just to division by zero if it's a black pixel */
-        float r = pix[0] / sum * (LUT_RESOLUTION-1.0) * 0.999999; /* The 0.99999 is just to avoid going to the very edge of the LUT and breaking my interpolation. TODO: fix this. */
-        float g = pix[1] / sum * (LUT_RESOLUTION-1.0) * 0.999999;
-        int ir = r;
-        int ig = g;
+static LDRT_Context_t * create_context(char ** Parameters, options_t * Options)
+{
+    LDRT_Parameters_t parameters = context_parameters(Parameters, Options);
+    LDRT_Context_t * context = LDRT_Create(&parameters);
+    if (context == NULL) {
+        printf("Could not create the transform\n");
+        return NULL;
+    }
 
-        /* Interpolate along four paths, then blend the resulting value... */
+    double max_error, mean_error;
+    int max_code_error;
+    if (!LDRT_GetLUT3DError(context, &max_error, &mean_error, &max_code_error))
+        printf("3D LUT %i^3: max error %.6f (%i sRGB code values), mean error %.6f\n",
+               Options->lut3d_size, max_error, max_code_error, mean_error);
+    double max_relative_error;
+    if (!LDRT_GetToneTableError(context, &max_error, &max_relative_error, &mean_error))
+        printf("Tone table: max error %.3g (relative %.3g), mean error %.3g\n", max_error, max_relative_error, mean_error);
+    return context;
+}
 
-        /* Weights */
-        float w_r = r - ir;
-        float w_g = g - ig;
+static void encode_pixels(void * Target, float * const * RGB, int X, int Y, int NumPixels)
+{
+    encode_target_t * target = Target;
+    ImageWriter_Encode(target->writer, RGB, target->row_offset + Y, X, NumPixels);
+}
 
-        float p01[3], p11[3], p00[3], p10[3];
-        ColourPathInterpolate(&paths[ir][ig], Y, p00);
-        ColourPathInterpolate(&paths[ir+1][ig], Y, p10);
-        ColourPathInterpolate(&paths[ir][ig+1], Y, p01);
-        ColourPathInterpolate(&paths[ir+1][ig+1], Y, p11);
 
-        for (int c = 0; c < 3; ++c)
-        {
-            pix[c] = (p00[c] * (1.0-w_g) + p01[c] * w_g) * (1.0-w_r)
-                   + (p10[c] * (1.0-w_g) + p11[c] * w_g) * w_r;
-        }
+/***************************** Batch mode *****************************/
+
+/* Frames go through three stages, each on its own thread: reading (decoding into
+ * memory and creating the output file), rendering, and writing. Frames are handed
+ * between them through queues, so while frame N renders, N+1 is read and N-1
+ * written. There are only as many frames as stages, which bounds the memory. */
+#define BATCH_FRAMES_IN_FLIGHT 3
+#define BATCH_PATH_SIZE 4096
+
+typedef struct {
+    char in_path[BATCH_PATH_SIZE], out_path[BATCH_PATH_SIZE];
+    void * pixels; /* Planar for EXRs, interleaved for raw, half or float */
+    size_t capacity; /* Bytes */
+    LDRT_Image_t in;
+    int width, height;
+    ImageWriter_t writer;
+    int error; /* The stages after one that failed skip the frame */
+} frame_t;
+
+typedef struct {
+    options_t * options;
+    int num_frames;
+    char * list; /* The list file, paths point into it */
+    char ** list_paths; /* Input and output of each frame */
+    Util_Queue_t free_frames, read_frames, rendered_frames;
+    double start_time;
+    int num_failed;
+} batch_t;
+
+/* Patterns must have exactly one integer conversion, as they go to printf */
+static int check_frame_pattern(char * Pattern)
+{
+    int conversions = 0;
+    for (char * p = Pattern; *p; ++p)
+    {
+        if (*p != '%') continue;
+        if (*++p == '%') continue;
+        while (*p >= '0' && *p <= '9') ++p;
+        if (*p != 'd') return 1;
+        ++conversions;
     }
+    return (conversions != 1);
+}
 
+/* Lines are INPUT OUTPUT, blank lines and ones starting with # are skipped */
+static int load_frame_list(batch_t * Batch, char * Path)
+{
+    Batch->list = Util_OpenFileToMemory(Path, 64, NULL);
+    if (Batch->list == NULL) return 1;
 
+    int max_lines = 1;
+    for (char * c = Batch->list; *c; ++c) max_lines += (*c == '\n');
+    Batch->list_paths = malloc(sizeof(char *) * 2 * max_lines);
+    if (Batch->list_paths == NULL) return 1;
 
-    uint8_t * bmp = malloc(image_height*image_width*3);
-    for (int p = 0; p < (image_height*image_width*3); p += 3)
+    char * save = NULL;
+    for (char * line = strtok_r(Batch->list, "\r\n", &save); line != NULL; line = strtok_r(NULL, "\r\n", &save))
     {
-        bmp[ p ] = linear_to_sRGB(colour_image[ p ]*1.00001); /* The tiny multiplier makes values able to reach RGB 255 */
-        bmp[p+1] = linear_to_sRGB(colour_image[p+1]*1.00001);
-        bmp[p+2] = linear_to_sRGB(colour_image[p+2]*1.00001);
+        while (*line == ' ' || *line == '\t') ++line;
+        if (*line == 0 || *line == '#') continue;
+        char * out = line + strcspn(line, " \t");
+        if (*out == 0) return 1;
+        *out++ = 0;
+        out += strspn(out, " \t");
+        char * end = out + strlen(out);
+        while (end > out && (end[-1] == ' ' || end[-1] == '\t')) *--end = 0;
+        if (*out == 0) return 1;
+        Batch->list_paths[Batch->num_frames*2] = line;
+        Batch->list_paths[Batch->num_frames*2 + 1] = out;
+        ++Batch->num_frames;
     }
-
-    Util_WriteBitmap(bmp, image_width, image_height, out_path, 0);
-
     return 0;
 }
 
+static int frame_paths(batch_t * Batch, int Index, frame_t * Frame)
+{
+    int in_length, out_length;
+    if (Batch->list != NULL) {
+        in_length = snprintf(Frame->in_path, BATCH_PATH_SIZE, "%s", Batch->list_paths[Index*2]);
+        out_length = snprintf(Frame->out_path, BATCH_PATH_SIZE, "%s", Batch->list_paths[Index*2 + 1]);
+    } else {
+        int number = Batch->options->first_frame + Index;
+        in_length = snprintf(Frame->in_path, BATCH_PATH_SIZE, Batch->options->in_pattern, number);
+        out_length = snprintf(Frame->out_path, BATCH_PATH_SIZE, Batch->options->out_pattern, number);
+    }
+    if (in_length >= BATCH_PATH_SIZE || out_length >= BATCH_PATH_SIZE) {
+        printf("Frame %i: path too long\n", Index);
+        return 1;
+    }
+    return 0;
+}
 
+/* Decodes the whole frame and creates the output */
+static int read_frame(batch_t * Batch, frame_t * Frame)
+{
+    options_t * options = Batch->options;
+    char * extension = strrchr(Frame->in_path, '.');
+    int is_exr = (extension != NULL && !strcasecmp(extension, ".exr"));
+
+    EXRImage_t exr;
+    int is_half = options->half_input;
+    if (is_exr) {
+        if (EXR_Open(&exr, Frame->in_path)) {
+            printf("Could not open %s (must be a scanline EXR with R, G and B)\n", Frame->in_path);
+            return 1;
+        }
+        Frame->width = exr.width;
+        Frame->height = exr.height;
+        is_half = EXR_IsHalf(&exr);
+    } else {
+        Frame->width = options->raw_width;
+        Frame->height = options->raw_height;
+        if (Frame->width < 1 || Frame->height < 1) {
+            printf("%s isn't an EXR, raw frames need --size\n", Frame->in_path);
+            return 1;
+        }
+    }
 
+    /* Frames are usually all the same size, so the buffer is kept */
+    size_t num_pixels = (size_t)Frame->width * Frame->height;
+    size_t size = num_pixels * 3 * (is_half ? sizeof(uint16_t) : sizeof(float));
+    if (size > Frame->capacity) {
+        free(Frame->pixels);
+        Frame->pixels = malloc(size);
+        Frame->capacity = (Frame->pixels == NULL) ? 0 : size;
+    }
+    if (Frame->pixels == NULL) {
+        printf("Out of memory\n");
+        if (is_exr) EXR_Close(&exr);
+        return 1;
+    }
 
+    int error = 0;
+    PROFILE_BEGIN(PROFILE_LOAD);
+    if (is_exr && is_half) {
+        uint16_t * pixels = Frame->pixels;
+        Frame->in = LDRT_PlanarHalfImage(pixels, pixels + num_pixels, pixels + num_pixels * 2, Frame->width);
+        error = EXR_ReadRGBHalf(&exr, 0, Frame->height, Frame->in.half_channel, 1, options->num_threads);
+        EXR_Close(&exr);
+    } else if (is_exr) {
+        float * pixels = Frame->pixels;
+        Frame->in = LDRT_PlanarImage(pixels, pixels + num_pixels, pixels + num_pixels * 2, Frame->width);
+        error = EXR_ReadRGB(&exr, 0, Frame->height, Frame->in.channel, 1, options->num_threads);
+        EXR_Close(&exr);
+    } else {
+        if (is_half) Frame->in = LDRT_InterleavedHalfImage(Frame->pixels, Frame->width);
+        else Frame->in = LDRT_InterleavedImage(Frame->pixels, Frame->width);
+        FILE * file = fopen(Frame->in_path, "rb");
+        error = (file == NULL || fread(Frame->pixels, 1, size, file) != size);
+        if (file != NULL) fclose(file);
+    }
+    PROFILE_END(PROFILE_LOAD);
+    if (error) {
+        printf("Could not read %s\n", Frame->in_path);
+        return 1;
+    }
 
+    int format = ImageWriter_FormatFromPath(Frame->out_path);
+    if (ImageWriter_PixelBytes(format, options->bit_depth) == 0) {
+        printf("Can't write %s at that bit depth (formats are bmp, ppm, png, tif, pfm and exr)\n", Frame->out_path);
+        return 1;
+    }
+    if (ImageWriter_Open(&Frame->writer, Frame->out_path, format, options->bit_depth, Frame->width, Frame->height, Frame->height)) {
+        printf("Could not create %s\n", Frame->out_path);
+        return 1;
+    }
+    Frame->writer.dither = options->dither;
+    Frame->writer.sync = options->sync;
+    return 0;
+}
 
+static void * batch_reader(void * Data)
+{
+    batch_t * batch = Data;
+    for (int i = 0; i < batch->num_frames; ++i)
+    {
+        frame_t * frame = Util_QueuePop(&batch->free_frames);
+        frame->error = frame_paths(batch, i, frame) || read_frame(batch, frame);
+        Util_QueuePush(&batch->read_frames, frame);
+    }
+    Util_QueuePush(&batch->read_frames, NULL);
+    return NULL;
+}
 
+static void * batch_writer(void * Data)
+{
+    batch_t * batch = Data;
+    int num_done = 0;
+    frame_t * frame;
+    while ((frame = Util_QueuePop(&batch->rendered_frames)) != NULL)
+    {
+        if (!frame->error) {
+            PROFILE_BEGIN(PROFILE_WRITE);
+            int error = ImageWriter_WriteRows(&frame->writer, 0, frame->height);
+            error |= ImageWriter_Close(&frame->writer);
+            PROFILE_END(PROFILE_WRITE);
+            if (error) {
+                printf("Could not write %s\n", frame->out_path);
+                frame->error = 1;
+            }
+        }
+        batch->num_failed += frame->error;
+        ++num_done;
+        printf("%i/%i %s%s, %.2f fps\n", num_done, batch->num_frames, frame->out_path,
+               frame->error ? " FAILED" : "", num_done / (Util_GetSeconds() - batch->start_time));
+        Util_QueuePush(&batch->free_frames, frame);
+    }
+    return NULL;
+}
 
+static int run_batch(LDRT_Context_t * Context, options_t * Options)
+{
+    batch_t batch = {.options = Options};
+    if (Options->frame_list != NULL) {
+        if (load_frame_list(&batch, Options->frame_list)) {
+            printf("Could not read the frame list %s (lines should be INPUT OUTPUT)\n", Options->frame_list);
+            return 1;
+        }
+    }
+    else if (Options->in_pattern != NULL) {
+        if (check_frame_pattern(Options->in_pattern) || check_frame_pattern(Options->out_pattern)) {
+            printf("Frame patterns need one integer, like frame.%%04d.exr\n");
+            return 1;
+        }
+        batch.num_frames = MAX(Options->last_frame - Options->first_frame + 1, 0);
+    }
+    else {
+        printf("Batch mode needs --frames INPUT OUTPUT FIRST LAST or --list FILE\n");
+        return 1;
+    }
 
+    frame_t frames[BATCH_FRAMES_IN_FLIGHT] = {0};
+    if (Util_InitQueue(&batch.free_frames, BATCH_FRAMES_IN_FLIGHT)
+        || Util_InitQueue(&batch.read_frames, BATCH_FRAMES_IN_FLIGHT + 1) /* And the end */
+        || Util_InitQueue(&batch.rendered_frames, BATCH_FRAMES_IN_FLIGHT + 1)) return 1;
+    for (int f = 0; f < BATCH_FRAMES_IN_FLIGHT; ++f) Util_QueuePush(&batch.free_frames, &frames[f]);
 
+    batch.start_time = Util_GetSeconds();
+    pthread_t reader, writer;
+    if (pthread_create(&reader, NULL, batch_reader, &batch)) return 1;
+    if (pthread_create(&writer, NULL, batch_writer, &batch)) return 1;
 
+    /* Rendering is on this thread (and the ones it spreads each frame across) */
+    frame_t * frame;
+    while ((frame = Util_QueuePop(&batch.read_frames)) != NULL)
+    {
+        if (!frame->error) {
+            encode_target_t target = {.writer = &frame->writer};
+            LDRT_ApplyToSink(Context, &frame->in, 0, 0, frame->width, frame->height, encode_pixels, &target, Options->num_threads);
+        }
+        Util_QueuePush(&batch.rendered_frames, frame);
+    }
+    Util_QueuePush(&batch.rendered_frames, NULL);
+
+    pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+    double seconds = Util_GetSeconds() - batch.start_time;
+    printf("%i frames in %.2f s, %.2f fps", batch.num_frames, seconds, batch.num_frames / seconds);
+    if (batch.num_failed) printf(", %i failed", batch.num_failed);
+    printf("\n");
+
+    for (int f = 0; f < BATCH_FRAMES_IN_FLIGHT; ++f) free(frames[f].pixels);
+    Util_FreeQueue(&batch.free_frames);
+    Util_FreeQueue(&batch.read_frames);
+    Util_FreeQueue(&batch.rendered_frames);
+    Util_CloseFileFromMemory(batch.list);
+    free(batch.list_paths);
+    return (batch.num_failed != 0);
+}
 
 
-
-
-
-
-/* Compression method like Reinhard but with power */
-float compress(float x)
+/***************************** Daemon mode *****************************/
+
+/* Every connection gets a thread, which runs its jobs one after another, so jobs
+ * from different connections run at the same time (each spread across the threads
+ * given with --threads as well). Contexts are shared between them, kept for the
+ * most recently used parameter sets. One that is pushed out while jobs are using it
+ * is destroyed when the last of them is done. */
+#define DAEMON_LINE_SIZE 8192
+#define DAEMON_MAX_ARGUMENTS 64
+
+typedef struct {
+    LDRT_Parameters_t parameters;
+    LDRT_Context_t * context; /* NULL while it's being created */
+    int failed;
+    int users; /* Jobs holding it */
+    int cached; /* Still in the list, else it goes with the last user */
+    uint64_t last_used;
+} daemon_context_t;
+
+typedef struct {
+    options_t * options; /* Jobs' options go on top of these */
+    pthread_mutex_t lock;
+    pthread_cond_t created;
+    daemon_context_t ** contexts; /* max_contexts of them, NULL = free */
+    uint64_t num_uses;
+} daemon_t;
+
+typedef struct {
+    daemon_t * daemon;
+    int fd;
+} daemon_connection_t;
+
+/* Only what changes the context, the cache directory and threads don't, and the
+ * exposure is the job's */
+static int same_parameters(LDRT_Parameters_t * A, LDRT_Parameters_t * B)
 {
-    return (x / (1.0 + x));
+    return A->saturation == B->saturation && A->slope == B->slope
+        && A->smoothness == B->smoothness
+        && A->lut_resolution == B->lut_resolution && A->lut3d_size == B->lut3d_size
+        && A->precision == B->precision && A->tone_table == B->tone_table;
 }
-float uncompress(float x) /* Inverse */
+
+/* Drops the least recently used context nobody is using, returns its slot or -1 */
+static int evict_context(daemon_t * Daemon)
 {
-    return -(x / (x - 1.0));
+    int oldest = -1;
+    for (int i = 0; i < Daemon->options->max_contexts; ++i)
+    {
+        daemon_context_t * context = Daemon->contexts[i];
+        if (context == NULL) return i;
+        if (context->users == 0 && (oldest < 0 || context->last_used < Daemon->contexts[oldest]->last_used)) oldest = i;
+    }
+    if (oldest >= 0) {
+        LDRT_Destroy(Daemon->contexts[oldest]->context);
+        free(Daemon->contexts[oldest]);
+        Daemon->contexts[oldest] = NULL;
+    }
+    return oldest;
 }
-float compress_value(float x, float power)
+
+static void release_context(daemon_t * Daemon, daemon_context_t * Context)
 {
-    if (x < 0) return x;
-    return powf(compress(pow(x, power)), 1.0f/power);
+    pthread_mutex_lock(&Daemon->lock);
+    if (--Context->users == 0 && !Context->cached) {
+        LDRT_Destroy(Context->context);
+        free(Context);
+    }
+    pthread_mutex_unlock(&Daemon->lock);
 }
-float uncompress_value(float x, float power)
+
+/* A context for the parameters, made if there isn't one (jobs that want the same
+ * one meanwhile wait for it). Returns NULL on failure. */
+static daemon_context_t * acquire_context(daemon_t * Daemon, LDRT_Parameters_t * Parameters)
 {
-    if (x >= 1.0) return INFINITY;
-    if (x <= 0.0) return x;
-    return powf(uncompress(pow(x, 1.0f/power)), power);
+    pthread_mutex_lock(&Daemon->lock);
+    daemon_context_t * context = NULL;
+    for (int i = 0; i < Daemon->options->max_contexts && context == NULL; ++i)
+        if (Daemon->contexts[i] != NULL && same_parameters(&Daemon->contexts[i]->parameters, Parameters))
+            context = Daemon->contexts[i];
+
+    if (context != NULL)
+    {
+        ++context->users;
+        context->last_used = ++Daemon->num_uses;
+        while (context->context == NULL && !context->failed) pthread_cond_wait(&Daemon->created, &Daemon->lock);
+        pthread_mutex_unlock(&Daemon->lock);
+        if (context->failed) {
+            release_context(Daemon, context);
+            return NULL;
+        }
+        return context;
+    }
+
+    context = calloc(1, sizeof(daemon_context_t));
+    if (context == NULL) {
+        pthread_mutex_unlock(&Daemon->lock);
+        return NULL;
+    }
+    context->parameters = *Parameters;
+    context->parameters.cache_dir = NULL; /* Points into the job */
+    context->users = 1;
+    context->last_used = ++Daemon->num_uses;
+    int slot = evict_context(Daemon);
+    if (slot >= 0) {
+        Daemon->contexts[slot] = context;
+        context->cached = 1;
+    }
+    pthread_mutex_unlock(&Daemon->lock);
+
+    /* Made without the lock, other jobs carry on */
+    LDRT_Context_t * made = LDRT_Create(Parameters);
+
+    pthread_mutex_lock(&Daemon->lock);
+    context->context = made;
+    if (made == NULL) {
+        printf("Could not create the transform\n");
+        context->failed = 1;
+        if (context->cached) {
+            Daemon->contexts[slot] = NULL;
+            context->cached = 0;
+        }
+    }
+    pthread_cond_broadcast(&Daemon->created);
+    pthread_mutex_unlock(&Daemon->lock);
+
+    if (made == NULL) {
+        release_context(Daemon, context);
+        return NULL;
+    }
+    return context;
 }
 
-/* I don't remember what all this "contrast" code does, but it definitely does do a sloped contrast */
-#define MIDDLE_GREY 0.18
-#define middle_grey (MIDDLE_GREY)
-#define linear_start (MIDDLE_GREY/3.5)
-double _do_power_contrast(double x, double power, double pivot){
-    x /= pivot;
-    if (x < 1.0) x = pow(x, power);
-    else {
-        x = (x-1.0) * power + 1.0;
-    }
-    x *= pivot;
-    return x;
-}double do_power_contrast(double x, double power){
-    x = _do_power_contrast(x, power, linear_start);
-    x /= _do_power_contrast(middle_grey, power, linear_start);
-    x *= middle_grey;
-    return x;
-}double contrast_base(double X, double Power){
-    if (X < 0.0) return 0;
-    if (X < 1.0) return pow(X, Power);
-    else return (X-1.0) * Power + 1.0;
-}double contrast_scaled(double X, double Power, double Scale){
-    return contrast_base(X * Scale, Power) / Scale;
-}double do_contrast_about1(double X, double Power, double Scale){
-    return contrast_scaled((X) - (contrast_scaled(1.0, Power, Scale) / Power) + (1.0 / Power), Power, Scale);
-} double do_contrast(double X, double Power, double Scale){
-    return do_contrast_about1(X/middle_grey, Power, Scale) * middle_grey;
+/* Argv is INPUT WIDTH HEIGHT SATURATION SLOPE SMOOTHNESS EXPOSURE OUTPUT [options] */
+static int daemon_job(daemon_t * Daemon, int argc, char ** argv)
+{
+    if (argc < 8) {
+        printf("Jobs are INPUT WIDTH HEIGHT SATURATION SLOPE SMOOTHNESS EXPOSURE OUTPUT [options]\n");
+        return 1;
+    }
+    options_t options = *Daemon->options;
+    if (apply_options(&options, argc, argv, 8)) return 1;
+
+    source_t source;
+    if (open_source(&source, argv[0], atoi(argv[1]), atoi(argv[2]), options.half_input)) return 1;
+
+    /* Exposure is applied per job, so changing it doesn't need another context */
+    LDRT_Parameters_t parameters = context_parameters(argv + 3, &options);
+    double exposure = parameters.exposure;
+    parameters.exposure = 0.0;
+    daemon_context_t * context = acquire_context(Daemon, &parameters);
+    int error = (context == NULL) || render_image(context->context, &source, argv[7], exposure, &options);
+
+    if (context != NULL) release_context(Daemon, context);
+    close_source(&source);
+    return error;
 }
 
-void find_RGB_hull_rib(double * XYZ_to_RGB, double * RGB_to_XYZ, float * EndRGB, int NumPoints, ColourPath_t * RibOut)
+/* Jobs are lines, arguments are split on spaces and tabs */
+static void * daemon_connection(void * Data)
 {
-    /* Convert to perceptual space. Yeah too many lines of code. */
-    float white_XYZ[3] = {1,1,1};
-    float end_XYZ[3] = {EndRGB[0], EndRGB[1], EndRGB[2]};
-    applyMatrix_f(white_XYZ, RGB_to_XYZ);
-    applyMatrix_f(end_XYZ, RGB_to_XYZ);
-    float white_CAM[3];     /* Perceptual coordinate of white */
-    float end_CAM[3];       /* Perceptual coordinate of the end point */
-    XYZ_to_IPT(white_XYZ, white_CAM, 1);
-    XYZ_to_IPT(end_XYZ, end_CAM, 1);
-
-    for (int i = 0; i < NumPoints; ++i)
+    daemon_connection_t * connection = Data;
+    FILE * stream = fdopen(connection->fd, "r");
+    if (stream == NULL) close(connection->fd);
+
+    char line[DAEMON_LINE_SIZE];
+    while (stream != NULL && fgets(line, sizeof(line), stream) != NULL)
     {
-        float progress = ((float)i) / (NumPoints-1.0f);
+        double start = Util_GetSeconds();
+        char * arguments[DAEMON_MAX_ARGUMENTS];
+        int num_arguments = 0;
+        char * save = NULL;
+        for (char * a = strtok_r(line, " \t\r\n", &save); a != NULL && num_arguments < DAEMON_MAX_ARGUMENTS; a = strtok_r(NULL, " \t\r\n", &save))
+            arguments[num_arguments++] = a;
+        if (num_arguments == 0) continue;
+
+        int error = daemon_job(connection->daemon, num_arguments, arguments);
+        double seconds = Util_GetSeconds() - start;
+        printf("%s %s, %.3f s\n", arguments[0], error ? "FAILED" : "done", seconds);
+        if (error) dprintf(connection->fd, "ERROR\n");
+        else dprintf(connection->fd, "OK %.6f\n", seconds);
+    }
 
-        /* Interpolate between the white point and the colour point in perceptual space... */
-        float result[3];
-        for (int j = 0; j < 3; ++j)
-        {
-            result[j] = white_CAM[j] * progress + end_CAM[j] * (1.0f - progress);
-        }
+    if (stream != NULL) fclose(stream);
+    free(connection);
+    return NULL;
+}
 
-        /* Convert back to RGB... */
-        IPT_to_XYZ(result, result, 1);
-        applyMatrix_f(result, XYZ_to_RGB);
-
-        /* Normalise so maxRGB = 1, this places te point on the hull's 'canopy' (maximum output brightness) */
-        float max_rgb = MAX(result[0], MAX(result[1], result[2]));
-        for (int j = 0; j < 3; ++j)
-        {
-            /* Normalise */
-            result[j] /= max_rgb;
-    
-            /* Because some colours (THE REC709 BLUE PRIMARY) curve so strongly in perceptual space,
-             * there is no straight line to white, so I clip negative channels to bring the path
-             * back on to the edge of the gamut. In this case clipping is fine because
-             * distances and precision don't matter, the path just needs to be brought to the
-             * edge and will be interpolated on later. */
-            if (result[j] < 0.0) result[j] = 0.0;
-        }
+static int run_daemon(char * SocketPath, options_t * Options)
+{
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(SocketPath) >= sizeof(address.sun_path)) {
+        printf("Socket path %s is too long\n", SocketPath);
+        return 1;
+    }
+    strcpy(address.sun_path, SocketPath);
+
+    /* A socket left over from before is in the way */
+    struct stat st;
+    if (stat(SocketPath, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(SocketPath);
+
+    /* Jobs read and write any path the daemon can, so only its own user can connect
+     * (the socket is made 0600, nothing else is running yet to mind the umask) */
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    mode_t umask_before = umask(0177);
+    int bind_error = (listener < 0) || bind(listener, (struct sockaddr *)&address, sizeof(address));
+    umask(umask_before);
+    if (bind_error || listen(listener, SOMAXCONN)) {
+        printf("Could not listen on %s\n", SocketPath);
+        return 1;
+    }
 
-        /* Convert back to perceptual space */
-        applyMatrix_f(result, RGB_to_XYZ);
-        XYZ_to_IPT(result, result, 1);
+    daemon_t daemon = {.options = Options};
+    daemon.contexts = calloc(Options->max_contexts, sizeof(daemon_context_t *));
+    if (daemon.contexts == NULL) return 1;
+    pthread_mutex_init(&daemon.lock, NULL);
+    pthread_cond_init(&daemon.created, NULL);
 
-        /* Output the point to the colour path. */
-        ColourPathAddPointByValue(RibOut, result);
+    /* A client hanging up before its answer shouldn't end the daemon */
+    signal(SIGPIPE, SIG_IGN);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    printf("Listening on %s\n", SocketPath);
+
+    for (;;)
+    {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            printf("Could not accept a connection\n");
+            break;
+        }
+        daemon_connection_t * connection = malloc(sizeof(daemon_connection_t));
+        pthread_t thread;
+        pthread_attr_t attributes;
+        pthread_attr_init(&attributes);
+        pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+        if (connection == NULL) close(fd);
+        else {
+            *connection = (daemon_connection_t) {.daemon = &daemon, .fd = fd};
+            if (pthread_create(&thread, &attributes, daemon_connection, connection)) {
+                close(fd);
+                free(connection);
+            }
+        }
+        pthread_attr_destroy(&attributes);
     }
-}
\ No newline at end of file
+
+    close(listener);
+    unlink(SocketPath);
+    return 1;
+}
@@ -0,0 +1,79 @@
+/*
+    LuminanceDRT - Luminance based image formation
+    Copyright (C) 2022  Ilia Sibiryakov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; strictly version 2 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <math.h>
+
+#include "SRGB.h"
+#include "Utilities/Utilities.h"
+
+/* What the table has to match */
+static int reference(float X)
+{
+    return linear_to_sRGB(X*1.00001);
+}
+
+static float from_bits(uint32_t Bits)
+{
+    float f;
+    memcpy(&f, &Bits, 4);
+    return f;
+}
+
+void init_SRGBTable(SRGBTable_t * Table)
+{
+    /* Binary search for the lowest float giving each code value (positive floats sort
+     * the same as their bits) */
+    Table->threshold[0] = 0.0f;
+    for (int code = 1; code < 256; ++code)
+    {
+        uint32_t low = 0, high = 0x40000000; /* 0 to 2 */
+        while (low < high) {
+            uint32_t mid = low + (high - low) / 2;
+            if (reference(from_bits(mid)) >= code) high = mid;
+            else low = mid + 1;
+        }
+        Table->threshold[code] = from_bits(low);
+    }
+    Table->threshold[256] = INFINITY;
+
+    for (int code = 0; code < 256; ++code)
+        Table->step_scale[code] = 1.0f / (Table->threshold[code+1] - Table->threshold[code]);
+
+    for (int b = 0; b < SRGB_NUM_BUCKETS; ++b)
+        Table->bucket[b] = reference(from_bits((uint32_t)(SRGB_BUCKET_BASE + b) << SRGB_BUCKET_SHIFT));
+
+    /* Interpolating between these is linear in the mantissa, which is linear in X
+     * within each power of 2 */
+    for (int i = 0; i <= SRGB_CURVE_SIZE; ++i) {
+        double x = from_bits((uint32_t)(SRGB_CURVE_BASE + i) << SRGB_CURVE_SHIFT);
+        Table->curve16[i] = (1.055 * pow(x, 1.0/2.4) - 0.055) * 65535.0;
+    }
+
+    /* 8x8 Bayer matrix, from the 2x2 one {0, 2, 3, 1} with the lowest coordinate bits
+     * deciding the highest digit */
+    for (int y = 0; y < 8; ++y)
+    for (int x = 0; x < 8; ++x)
+    {
+        int value = 0;
+        for (int bit = 0; bit < 3; ++bit) {
+            int bx = (x >> bit) & 1, by = (y >> bit) & 1;
+            value = value*4 + (((bx ^ by) << 1) | by);
+        }
+        Table->dither[y][x] = (value + 0.5f) / 64.0f;
+    }
+}
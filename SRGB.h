@@ -0,0 +1,89 @@
+/*
+    LuminanceDRT - Luminance based image formation
+    Copyright (C) 2022  Ilia Sibiryakov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; strictly version 2 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* Table based linear -> 8-bit sRGB, giving exactly the same code values as
+ * linear_to_sRGB(X*1.00001) (the multiplier lets values reach 255), without any
+ * pow or double maths per pixel.
+ *
+ * The table has the lowest linear value of each code value. The top bits of the
+ * float (exponent and 7 bits of mantissa) index a table of which code value that
+ * range of floats starts at, and no range is wide enough to contain more than one
+ * step, so it's one lookup and one comparison.
+ *
+ * 16-bit values are interpolated from a table of the curve spaced the same way
+ * (exponent and 8 bits of mantissa), within a small fraction of a code value. */
+
+#ifndef _SRGB_h_
+#define _SRGB_h_
+
+#include <stdint.h>
+#include <string.h>
+
+/* Buckets cover floats from 2^-12 (below the first step) to 1 */
+#define SRGB_BUCKET_SHIFT 16
+#define SRGB_BUCKET_BASE ((127 - 12) << (23 - SRGB_BUCKET_SHIFT))
+#define SRGB_NUM_BUCKETS (12 << (23 - SRGB_BUCKET_SHIFT))
+
+/* The 16-bit curve covers 2^-9 (below the end of the linear part) to 1 */
+#define SRGB_CURVE_SHIFT 15
+#define SRGB_CURVE_BASE ((127 - 9) << (23 - SRGB_CURVE_SHIFT))
+#define SRGB_CURVE_SIZE (9 << (23 - SRGB_CURVE_SHIFT))
+
+typedef struct {
+    float threshold[257]; /* Lowest value of each code value, 256 is infinity */
+    float step_scale[256]; /* 1 / width of each step, for dithering */
+    uint8_t bucket[SRGB_NUM_BUCKETS];
+    float dither[8][8]; /* Ordered (Bayer) dither thresholds, 0-1 */
+    float curve16[SRGB_CURVE_SIZE + 1]; /* sRGB * 65535 at the start of each range */
+} SRGBTable_t;
+
+void init_SRGBTable(SRGBTable_t * Table);
+
+static inline uint8_t SRGB_Encode(SRGBTable_t * Table, float X)
+{
+    if (!(X >= Table->threshold[1])) return 0; /* Also catches NaN */
+    if (X >= Table->threshold[255]) return 255;
+    uint32_t bits;
+    memcpy(&bits, &X, 4);
+    int code = Table->bucket[(bits >> SRGB_BUCKET_SHIFT) - SRGB_BUCKET_BASE];
+    return code + (X >= Table->threshold[code+1]);
+}
+
+/* Rounds up instead of down when X is further than Dither (0-1) into its step */
+static inline uint8_t SRGB_EncodeDithered(SRGBTable_t * Table, float X, float Dither)
+{
+    int code = SRGB_Encode(Table, X);
+    if (code == 255) return 255;
+    return code + ((X - Table->threshold[code]) * Table->step_scale[code] > Dither);
+}
+
+/* Rounded to the nearest 16-bit code value */
+static inline uint16_t SRGB_Encode16(SRGBTable_t * Table, float X)
+{
+    if (!(X > 0.0f)) return 0;
+    if (X >= 1.0f) return 65535;
+    if (X < 0.0031308f) return X * (12.92f * 65535.0f) + 0.5f;
+    uint32_t bits;
+    memcpy(&bits, &X, 4);
+    int index = (bits >> SRGB_CURVE_SHIFT) - SRGB_CURVE_BASE;
+    float fraction = (bits & ((1 << SRGB_CURVE_SHIFT) - 1)) * (1.0f / (1 << SRGB_CURVE_SHIFT));
+    float * curve = Table->curve16 + index;
+    return curve[0] + (curve[1] - curve[0]) * fraction + 0.5f;
+}
+
+#endif
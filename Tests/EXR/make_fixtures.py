@@ -0,0 +1,276 @@
+# Writes the EXR fixtures in this directory, with an encoder of its own so the
+# decoder in EXR.c is checked against something other than itself. Each NAME.exr
+# has a NAME.exr.ref next to it: int width, int height, then interleaved RGB floats
+# (Y for all three if there's no RGB). Run it from this directory.
+import struct, zlib, random, heapq
+
+HALF, FLOAT = 1, 2
+
+def pack_str(s): return s.encode() + b'\0'
+def attr(name, typ, data): return pack_str(name) + pack_str(typ) + struct.pack('<i', len(data)) + data
+
+def half_bits(v): return struct.unpack('<H', struct.pack('<e', v))[0]
+
+# ---------------- predictor / RLE ----------------
+def predictor(raw):
+    t = bytes(raw[0::2]) + bytes(raw[1::2])
+    t = bytearray(t)
+    for i in range(len(t) - 1, 0, -1):
+        t[i] = (t[i] - t[i-1] + 128 + 256) & 255
+    return bytes(t)
+
+def rle(data):
+    out = bytearray(); i = 0; n = len(data)
+    while i < n:
+        j = i + 1
+        while j < n and data[j] == data[i] and j - i < 128: j += 1
+        if j - i >= 3:
+            out.append(j - i - 1); out.append(data[i]); i = j
+        else:
+            j = i
+            while j < n and j - i < 127 and not (j + 2 < n and data[j] == data[j+1] == data[j+2]): j += 1
+            if j == i: j = i + 1
+            out.append((-(j - i)) & 255); out += data[i:j]; i = j
+    return bytes(out)
+
+# ---------------- PIZ ----------------
+def wenc14(a, b):
+    def s16(x): x &= 0xffff; return x - 65536 if x >= 32768 else x
+    a_s, b_s = s16(a), s16(b)
+    m = s16((a_s + b_s) >> 1); d = s16(a_s - b_s)
+    return m & 0xffff, d & 0xffff
+
+def wenc16(a, b):
+    ao = (a + 0x8000) & 0xffff
+    m = (ao + b) >> 1
+    d = ao - b
+    if d < 0: m = (m + 0x8000) & 0xffff
+    d &= 0xffff
+    return m, d
+
+def wav2_encode(buf, base, nx, ox, ny, oy, mx):
+    wenc = wenc14 if mx < (1 << 14) else wenc16
+    n = min(nx, ny); p = 1; p2 = 2
+    while p2 <= n:
+        py = base; ey = base + oy * (ny - p2)
+        oy1, oy2, ox1, ox2 = oy*p, oy*p2, ox*p, ox*p2
+        while py <= ey:
+            px = py; ex = py + ox * (nx - p2)
+            while px <= ex:
+                p01 = px + ox1; p10 = px + oy1; p11 = p10 + ox1
+                i00, i01 = wenc(buf[px], buf[p01])
+                i10, i11 = wenc(buf[p10], buf[p11])
+                buf[px], buf[p10] = wenc(i00, i10)
+                buf[p01], buf[p11] = wenc(i01, i11)
+                px += ox2
+            if nx & p:
+                p10 = px + oy1
+                i00, buf[p10] = wenc(buf[px], buf[p10]); buf[px] = i00
+            py += oy2
+        if ny & p:
+            px = py; ex = py + ox * (nx - p2)
+            while px <= ex:
+                p01 = px + ox1
+                i00, buf[p01] = wenc(buf[px], buf[p01]); buf[px] = i00
+                px += ox2
+        p = p2; p2 <<= 1
+
+class Bits:
+    def __init__(s): s.out = bytearray(); s.c = 0; s.lc = 0; s.n = 0
+    def put(s, nbits, v):
+        s.c = (s.c << nbits) | (v & ((1 << nbits) - 1)); s.lc += nbits; s.n += nbits
+        while s.lc >= 8:
+            s.lc -= 8; s.out.append((s.c >> s.lc) & 255)
+        s.c &= (1 << s.lc) - 1
+    def flush(s):
+        if s.lc: s.out.append((s.c << (8 - s.lc)) & 255); s.lc = 0
+
+def canonical(lengths):
+    n = [0]*59
+    for l in lengths.values(): n[l] += 1
+    c = 0
+    for i in range(58, 0, -1):
+        nc = (c + n[i]) >> 1; n[i] = c; c = nc
+    codes = {}
+    for sym in sorted(lengths):
+        l = lengths[sym]
+        codes[sym] = (n[l], l); n[l] += 1
+    return codes
+
+def huf_lengths(freq):
+    heap = [(f, i, [s]) for i, (s, f) in enumerate(sorted(freq.items()))]
+    heapq.heapify(heap)
+    lengths = {s: 0 for s in freq}
+    if len(heap) == 1: lengths[heap[0][2][0]] = 1; return lengths
+    k = len(heap)
+    while len(heap) > 1:
+        f1, _, s1 = heapq.heappop(heap); f2, _, s2 = heapq.heappop(heap)
+        for s in s1 + s2: lengths[s] += 1
+        heapq.heappush(heap, (f1 + f2, k, s1 + s2)); k += 1
+    return lengths
+
+def huf_compress(data):
+    freq = {}
+    for v in data: freq[v] = freq.get(v, 0) + 1
+    im = min(freq); iM = max(freq) + 1
+    rlc = iM
+    freq[rlc] = 1
+    lengths = huf_lengths(freq)
+    assert max(lengths.values()) <= 58
+    codes = canonical(lengths)
+    # table
+    tb = Bits(); sym = im
+    while sym <= iM:
+        l = lengths.get(sym, 0)
+        if l == 0:
+            zr = 1
+            while sym < iM and zr < 255 + 6:
+                if lengths.get(sym + 1, 0) > 0: break
+                sym += 1; zr += 1
+            if zr >= 2:
+                if zr >= 6: tb.put(6, 63); tb.put(8, zr - 6)
+                else: tb.put(6, 59 + zr - 2)
+                sym += 1; continue
+        tb.put(6, l); sym += 1
+    tb.flush()
+    # data
+    db = Bits()
+    def code(s):
+        c, l = codes[s]; db.put(l, c)
+    i = 0
+    while i < len(data):
+        s = data[i]; run = 0
+        while i + run + 1 < len(data) and data[i + run + 1] == s and run < 255: run += 1
+        c, l = codes[s]; rl = codes[rlc][1]
+        if l + rl + 8 < l * run:
+            code(s); code(rlc); db.put(8, run)
+        else:
+            for _ in range(run + 1): code(s)
+        i += run + 1
+    nbits = db.n; db.flush()
+    return struct.pack('<iiiii', im, iM, len(tb.out), nbits, 0) + bytes(tb.out) + bytes(db.out)
+
+def piz(raw, channels, width, nlines):
+    # lines -> per channel planes of 16 bit words
+    words = struct.unpack('<%dH' % (len(raw)//2), raw)
+    planes = []
+    pos = 0
+    per = [width * (1 if t == HALF else 2) for (_, t) in channels]
+    chw = [[] for _ in channels]
+    for y in range(nlines):
+        for ci in range(len(channels)):
+            chw[ci] += words[pos:pos+per[ci]]; pos += per[ci]
+    buf = []
+    for w in chw: buf += w
+    bitmap = bytearray(8192)
+    for v in buf: bitmap[v >> 3] |= 1 << (v & 7)
+    bitmap[0] &= ~1 & 255
+    lut = [0]*65536; k = 0
+    for i in range(65536):
+        if i == 0 or bitmap[i >> 3] & (1 << (i & 7)): lut[i] = k; k += 1
+    mx = k - 1
+    buf = [lut[v] for v in buf]
+    base = 0
+    for ci, (_, t) in enumerate(channels):
+        size = 1 if t == HALF else 2
+        for j in range(size):
+            wav2_encode(buf, base + j, width, size, nlines, width * size, mx)
+        base += width * nlines * size
+    mn, mxnz = 8191, 0
+    for i in range(8192):
+        if bitmap[i]: mn = min(mn, i); mxnz = max(mxnz, i)
+    out = struct.pack('<HH', mn, mxnz)
+    if mn <= mxnz: out += bytes(bitmap[mn:mxnz+1])
+    h = huf_compress(buf)
+    return out + struct.pack('<i', len(h)) + h
+
+LINES = {0: 1, 1: 1, 2: 1, 3: 16, 4: 32}
+
+def write(path, comp, channels, values, width, height, minx=0, miny=0):
+    """channels: list of (name, type) sorted; values[name][y][x] floats"""
+    hdr = struct.pack('<ii', 20000630, 2)
+    cl = b''
+    for name, t in channels: cl += pack_str(name) + struct.pack('<iBBBBii', t, 0, 0, 0, 0, 1, 1)
+    cl += b'\0'
+    hdr += attr('channels', 'chlist', cl)
+    hdr += attr('compression', 'compression', bytes([comp]))
+    hdr += attr('dataWindow', 'box2i', struct.pack('<iiii', minx, miny, minx + width - 1, miny + height - 1))
+    hdr += attr('displayWindow', 'box2i', struct.pack('<iiii', 0, 0, width - 1, height - 1))
+    hdr += attr('lineOrder', 'lineOrder', bytes([0]))
+    hdr += attr('pixelAspectRatio', 'float', struct.pack('<f', 1))
+    hdr += attr('screenWindowCenter', 'v2f', struct.pack('<ff', 0, 0))
+    hdr += attr('screenWindowWidth', 'float', struct.pack('<f', 1))
+    hdr += b'\0'
+    lpc = LINES[comp]
+    nchunks = (height + lpc - 1) // lpc
+    chunks = []
+    compressed = 0
+    for ci in range(nchunks):
+        y0 = ci * lpc; nl = min(lpc, height - y0)
+        raw = b''
+        for y in range(y0, y0 + nl):
+            for name, t in channels:
+                vs = values[name][y]
+                if t == HALF: raw += struct.pack('<%dH' % width, *[half_bits(v) for v in vs])
+                else: raw += struct.pack('<%df' % width, *vs)
+        if comp == 0: packed = raw
+        elif comp == 1: packed = rle(predictor(raw))
+        elif comp in (2, 3): packed = zlib.compress(predictor(raw))
+        else: packed = piz(raw, channels, width, nl)
+        if len(packed) >= len(raw): packed = raw
+        else: compressed += 1
+        chunks.append(struct.pack('<ii', miny + y0, len(packed)) + packed)
+    off = len(hdr) + 8 * nchunks
+    table = b''
+    for c in chunks: table += struct.pack('<Q', off); off += len(c)
+    open(path, 'wb').write(hdr + table + b''.join(chunks))
+    return compressed, nchunks
+
+def quant(v, t):
+    return struct.unpack('<e', struct.pack('<e', v))[0] if t == HALF else struct.unpack('<f', struct.pack('<f', v))[0]
+
+
+# Odd sizes, so wavelet passes and the last chunks of ZIP and PIZ are partial
+WIDTH, HEIGHT = 23, 53
+
+def fixture(comp, kind):
+    random.seed(comp * 7 + len(kind))
+    if kind == 'mixed': channels = [('A', HALF), ('B', FLOAT), ('G', HALF), ('R', HALF)]
+    elif kind == 'half': channels = [('B', HALF), ('G', HALF), ('R', HALF)]
+    elif kind == 'float': channels = [('B', FLOAT), ('G', FLOAT), ('R', FLOAT)]
+    else: channels = [('Y', HALF)]
+    values = {}
+    for name, t in channels:
+        rows = []
+        for y in range(HEIGHT):
+            row = []
+            for x in range(WIDTH):
+                # Smooth with flat runs and some noise. Every chunk has to come out
+                # smaller, so values stay in [0.5, 4) or PIZ's bitmap gets too big for
+                # an image this small
+                if (x // 5 + y // 3) % 4 == 0: v = 1.5
+                elif random.random() < 0.1: v = random.randrange(32, 256) / 64.0
+                else: v = 0.5 + (x * y * (1 + ord(name) % 3) % 97) / 32.0
+                row.append(quant(v, t))
+            rows.append(row)
+        values[name] = rows
+    path = '%s_%s.exr' % (['none', 'rle', 'zips', 'zip', 'piz'][comp], kind)
+    compressed, nchunks = write(path, comp, channels, values, WIDTH, HEIGHT, -3, 5)
+    if comp and compressed != nchunks: print('%s: %d of %d chunks stored uncompressed' % (path, nchunks - compressed, nchunks))
+    names = ['R', 'G', 'B'] if kind != 'grey' else ['Y'] * 3
+    with open(path + '.ref', 'wb') as f:
+        f.write(struct.pack('<ii', WIDTH, HEIGHT))
+        for y in range(HEIGHT):
+            for x in range(WIDTH):
+                f.write(struct.pack('<3f', *[values[n][y][x] for n in names]))
+
+if __name__ == '__main__':
+    fixture(0, 'half')
+    fixture(1, 'half')
+    fixture(1, 'mixed')
+    fixture(2, 'half')
+    fixture(3, 'mixed')
+    fixture(3, 'grey')
+    fixture(4, 'half')
+    fixture(4, 'mixed')
+    fixture(4, 'float')
@@ -0,0 +1,65 @@
+/*
+    LuminanceDRT - Luminance based image formation
+    Copyright (C) 2022  Ilia Sibiryakov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; strictly version 2 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "ToneTable.h"
+
+/* Points between each pair of table points the error is checked at */
+#define TONETABLE_CHECK_STEPS 16
+
+/* Input of table point I */
+static double point_input(int I)
+{
+    int steps = 1 << TONETABLE_OCTAVE_BITS;
+    return ldexp(1.0 + (double)(I % steps) / steps, TONETABLE_MIN_EXPONENT + I / steps);
+}
+
+int init_ToneTable(ToneTable_t * Table, double (*Function)(double X, void * User), void * User)
+{
+    Table->values = malloc(sizeof(float) * TONETABLE_SIZE);
+    if (Table->values == NULL) return 1;
+    for (int i = 0; i < TONETABLE_SIZE; ++i) Table->values[i] = Function(point_input(i), User);
+
+    double max_error = 0.0, max_relative_error = 0.0, sum_error = 0.0;
+    int n = 0;
+    for (int i = 0; i < TONETABLE_SIZE - 1; ++i)
+    {
+        double start = point_input(i), end = point_input(i + 1);
+        for (int s = 1; s < TONETABLE_CHECK_STEPS; ++s, ++n)
+        {
+            float x = start + (end - start) * s / TONETABLE_CHECK_STEPS;
+            double exact = Function(x, User);
+            double error = fabs(ToneTable_Lookup(Table, x) - exact);
+            max_error = fmax(max_error, error);
+            if (exact != 0.0) max_relative_error = fmax(max_relative_error, error / fabs(exact));
+            sum_error += error;
+        }
+    }
+    Table->max_error = max_error;
+    Table->max_relative_error = max_relative_error;
+    Table->mean_error = sum_error / n;
+    return 0;
+}
+
+void uninit_ToneTable(ToneTable_t * Table)
+{
+    free(Table->values);
+    Table->values = NULL;
+}
@@ -0,0 +1,70 @@
+/*
+    LuminanceDRT - Luminance based image formation
+    Copyright (C) 2022  Ilia Sibiryakov
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; strictly version 2 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* A 1D table of a smooth function of a positive value, for curves that are too
+ * slow to work out per pixel. The shaper is the float's own bits: every octave from
+ * 2^TONETABLE_MIN_EXPONENT up has 2^TONETABLE_OCTAVE_BITS evenly spaced points, so
+ * the index and the interpolation weight come straight from the exponent and the
+ * top bits of the mantissa, with no log. Spacing is relative (1/64 of the value),
+ * so it's as dense in the shadows as in the highlights.
+ *
+ * Values from TONETABLE_MAX_INPUT up aren't covered, the caller works those out
+ * itself. Values below the range are looked up as the bottom of it. */
+
+#ifndef _ToneTable_h_
+#define _ToneTable_h_
+
+#include <stdint.h>
+#include <string.h>
+
+#define TONETABLE_OCTAVE_BITS 6
+#define TONETABLE_MIN_EXPONENT -14
+#define TONETABLE_NUM_OCTAVES 24
+#define TONETABLE_SIZE ((TONETABLE_NUM_OCTAVES << TONETABLE_OCTAVE_BITS) + 1)
+#define TONETABLE_MIN_INPUT 0x1p-14f
+#define TONETABLE_MAX_INPUT 0x1p10f /* 2^(MIN_EXPONENT + NUM_OCTAVES) */
+
+/* Float bits of the lowest input, and how far to shift to get the index */
+#define TONETABLE_BASE_BITS ((uint32_t)(127 + TONETABLE_MIN_EXPONENT) << 23)
+#define TONETABLE_SHIFT (23 - TONETABLE_OCTAVE_BITS)
+
+typedef struct {
+    float * values; /* TONETABLE_SIZE */
+    /* Measured against the function when it was made, between the points */
+    double max_error, max_relative_error, mean_error;
+} ToneTable_t;
+
+/* Fills a table with Function, and measures how far off interpolating it is.
+ * Returns 0 on success. */
+int init_ToneTable(ToneTable_t * Table, double (*Function)(double X, void * User), void * User);
+void uninit_ToneTable(ToneTable_t * Table);
+
+/* X must be below TONETABLE_MAX_INPUT */
+static inline float ToneTable_Lookup(ToneTable_t * Table, float X)
+{
+    if (!(X > TONETABLE_MIN_INPUT)) X = TONETABLE_MIN_INPUT; /* Also catches NaN */
+    uint32_t bits;
+    memcpy(&bits, &X, 4);
+    bits -= TONETABLE_BASE_BITS;
+    uint32_t index = bits >> TONETABLE_SHIFT;
+    float weight = (bits & ((1u << TONETABLE_SHIFT) - 1)) * (1.0f / (1u << TONETABLE_SHIFT));
+    float * v = Table->values + index;
+    return v[0] + (v[1] - v[0]) * weight;
+}
+
+#endif
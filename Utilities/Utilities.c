@@ -19,8 +19,16 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "Utilities.h"
 #include "../Matrix.h"
@@ -79,6 +87,81 @@ void Util_CloseFileFromMemory(void * File)
     free(File);
 }
 
+void * Util_MapFile(char * Path, uint64_t * SizeOut)
+{
+    int fd = open(Path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    void * data = NULL;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) data = NULL;
+        else if (SizeOut != NULL) *SizeOut = st.st_size;
+    }
+
+    close(fd); /* The mapping stays valid */
+    return data;
+}
+
+void * Util_MapSharedMemory(char * Name, uint64_t * SizeOut, int Writable)
+{
+    int fd = shm_open(Name, Writable ? O_RDWR : O_RDONLY, 0);
+    if (fd < 0) return NULL;
+
+    void * data = NULL;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        data = mmap(NULL, st.st_size, Writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) data = NULL;
+        else if (SizeOut != NULL) *SizeOut = st.st_size;
+    }
+
+    close(fd);
+    return data;
+}
+
+void Util_UnmapFile(void * Data, uint64_t Size)
+{
+    if (Data != NULL) munmap(Data, Size);
+}
+
+void * Util_CreateMappedFile(char * Path, uint64_t Size)
+{
+    int fd = open(Path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return NULL;
+
+    /* The space is taken now, so a full disk fails here instead of faulting on a write */
+    void * data = NULL;
+    if (Size > 0 && posix_fallocate(fd, 0, Size) == 0)
+    {
+        data = mmap(NULL, Size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) data = NULL;
+    }
+
+    close(fd);
+    return data;
+}
+
+int Util_CloseMappedFile(void * Data, uint64_t Size, int Sync)
+{
+    if (Data == NULL) return 0;
+    int error = (Sync && msync(Data, Size, MS_SYNC) != 0);
+    error |= (munmap(Data, Size) != 0);
+    return error;
+}
+
+void Util_ReleaseMappedRange(void * Start, uint64_t Size)
+{
+    /* Only whole pages inside the range */
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)Start + page-1) / page * page;
+    uintptr_t end = ((uintptr_t)Start + Size) / page * page;
+    if (end > start) madvise((void *)start, end - start, MADV_DONTNEED);
+}
+
 double sRGB_to_linear(uint8_t CodeValue)
 {
     return decode_sRGB(CodeValue);
@@ -105,18 +188,159 @@ void Util_HSVToRGB(float H, float S, float V, float * RGBOut)
     RGBOut[2] = V * hsv_mix(1.0, hsv_constrain(fabs(hsv_fract(H + 0.3333333) * 6.0 - 3.0) - 1.0, 0.0, 1.0), S);
 }
 
+int Util_GetNumCPUs()
+{
+    long num = sysconf(_SC_NPROCESSORS_ONLN);
+    return (num < 1) ? 1 : (int)num;
+}
+
+typedef struct {
+    void (*func)(int, void *);
+    void * data;
+    int num_jobs;
+    atomic_int next_job;
+} parallel_for_t;
+
+static void * parallel_for_worker(void * Arg)
+{
+    parallel_for_t * pf = Arg;
+    int job;
+    while ((job = atomic_fetch_add(&pf->next_job, 1)) < pf->num_jobs)
+        pf->func(job, pf->data);
+    return NULL;
+}
+
+void Util_ParallelFor(int NumJobs, int NumThreads, void (*Func)(int Job, void * Data), void * Data)
+{
+    if (NumThreads <= 0) NumThreads = Util_GetNumCPUs();
+    if (NumThreads > NumJobs) NumThreads = NumJobs;
+    if (NumThreads < 1) NumThreads = 1;
+
+    parallel_for_t pf = {.func = Func, .data = Data, .num_jobs = NumJobs};
+    atomic_init(&pf.next_job, 0);
+
+    /* Extra threads, the calling thread is the first worker. Without room
+     * for the thread handles it simply does every job itself */
+    pthread_t * threads = malloc(sizeof(pthread_t) * NumThreads);
+    if (threads == NULL) NumThreads = 1;
+    int num_started = 0;
+    for (int t = 1; t < NumThreads; ++t)
+        if (pthread_create(&threads[num_started], NULL, parallel_for_worker, &pf) == 0) ++num_started;
+
+    parallel_for_worker(&pf);
+
+    for (int t = 0; t < num_started; ++t) pthread_join(threads[t], NULL);
+    free(threads);
+}
+
+double Util_GetSeconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+int Util_InitQueue(Util_Queue_t * Queue, int Capacity)
+{
+    Queue->items = malloc(sizeof(void *) * Capacity);
+    if (Queue->items == NULL) return 1;
+    Queue->capacity = Capacity;
+    Queue->first = 0;
+    Queue->count = 0;
+    pthread_mutex_init(&Queue->lock, NULL);
+    pthread_cond_init(&Queue->changed, NULL);
+    return 0;
+}
+
+void Util_FreeQueue(Util_Queue_t * Queue)
+{
+    pthread_mutex_destroy(&Queue->lock);
+    pthread_cond_destroy(&Queue->changed);
+    free(Queue->items);
+    Queue->items = NULL;
+}
+
+/* Both ends wait on the same condition, there's only ever a producer and a consumer
+ * so broadcasting costs nothing */
+void Util_QueuePush(Util_Queue_t * Queue, void * Item)
+{
+    pthread_mutex_lock(&Queue->lock);
+    while (Queue->count == Queue->capacity) pthread_cond_wait(&Queue->changed, &Queue->lock);
+    Queue->items[(Queue->first + Queue->count) % Queue->capacity] = Item;
+    ++Queue->count;
+    pthread_cond_broadcast(&Queue->changed);
+    pthread_mutex_unlock(&Queue->lock);
+}
+
+void * Util_QueuePop(Util_Queue_t * Queue)
+{
+    pthread_mutex_lock(&Queue->lock);
+    while (Queue->count == 0) pthread_cond_wait(&Queue->changed, &Queue->lock);
+    void * item = Queue->items[Queue->first];
+    Queue->first = (Queue->first + 1) % Queue->capacity;
+    --Queue->count;
+    pthread_cond_broadcast(&Queue->changed);
+    pthread_mutex_unlock(&Queue->lock);
+    return item;
+}
+
 void Util_WriteBitmap(unsigned char * data, int width, int height, char * filename, int Invert)
 {
-    int rowbytes = width*3+(4-(width*3%4))%4, imagesize = rowbytes*height, y;
-    uint16_t header[] = {0x4D42,0,0,0,0,26,0,12,0,width,height,1,24};
-    *((uint32_t *)(header+1)) = 26 + imagesize-((4-(width*3%4))%4);
-    FILE * file = fopen(filename, "wb"); fwrite(header, 1, 26, file);
-    if (file) {
-        for (int i = 0; i < width*height; ++i) {int t = data[i*3]; data[i*3] = data[i*3+2]; data[i*3+2] = t;}
-        if (!Invert)
-            for (y = height-1; y >= 0; --y) fwrite(data+(y*width*3), rowbytes, 1, file);
-        else
-            for (y = 0; y < height; ++y) fwrite(data+(y*width*3), rowbytes, 1, file);
-        fwrite(data, width*3, 1, file); fclose(file);
+    /* Rows go in one at a time so Invert can flip them, the data isn't modified */
+    Util_Bitmap_t bmp;
+    if (Util_CreateBitmap(&bmp, filename, width, height)) return;
+    for (int y = 0; y < height; ++y)
+        Util_WriteBitmapRows(&bmp, data + (size_t)y * width * 3, Invert ? (height-1 - y) : y, 1);
+    Util_CloseBitmap(&bmp);
+}
+
+int Util_CreateBitmap(Util_Bitmap_t * BMP, char * Path, int Width, int Height)
+{
+    /* The header only has 16 bits for the size */
+    if (Width < 1 || Height < 1 || Width > 65535 || Height > 65535) return 1;
+
+    BMP->width = Width;
+    BMP->height = Height;
+    BMP->row_bytes = Width*3 + (4-(Width*3%4))%4;
+    BMP->size = 26 + (uint64_t)BMP->row_bytes*Height;
+    BMP->data = Util_CreateMappedFile(Path, BMP->size);
+    if (BMP->data == NULL) return 1;
+
+    uint16_t header[] = {0x4D42,0,0,0,0,26,0,12,0,Width,Height,1,24};
+    uint32_t file_size = BMP->size;
+    memcpy(header+1, &file_size, 4);
+    memcpy(BMP->data, header, 26);
+    return 0;
+}
+
+uint8_t * Util_BitmapRow(Util_Bitmap_t * BMP, int Y)
+{
+    /* Rows are stored bottom up */
+    return BMP->data + 26 + (size_t)(BMP->height-1 - Y) * BMP->row_bytes;
+}
+
+void Util_WriteBitmapRows(Util_Bitmap_t * BMP, unsigned char * Data, int RowStart, int NumRows)
+{
+    for (int y = 0; y < NumRows; ++y)
+    {
+        unsigned char * in = Data + (size_t)y * BMP->width * 3;
+        uint8_t * out = Util_BitmapRow(BMP, RowStart + y);
+        for (int x = 0; x < BMP->width; ++x) {
+            out[x*3+0] = in[x*3+2];
+            out[x*3+1] = in[x*3+1];
+            out[x*3+2] = in[x*3+0];
+        }
     }
 }
+
+void Util_ReleaseBitmapRows(Util_Bitmap_t * BMP, int RowStart, int NumRows)
+{
+    Util_ReleaseMappedRange(Util_BitmapRow(BMP, RowStart + NumRows-1), (size_t)NumRows * BMP->row_bytes);
+}
+
+int Util_CloseBitmap(Util_Bitmap_t * BMP)
+{
+    int error = Util_CloseMappedFile(BMP->data, BMP->size, 0);
+    BMP->data = NULL;
+    return error;
+}
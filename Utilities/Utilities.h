@@ -20,6 +20,7 @@
 #define _Utilities_h_
 
 #include <stdint.h>
+#include <pthread.h>
 
 /* Reads a file to memory, will fail if size over MaxMiB. SizeOut in bytes, can
  * be NULL if u dont need it. Always puts a zero byte at the end for string purposes. */
@@ -27,6 +28,27 @@ void * Util_OpenFileToMemory(char * Path, uint64_t MaxMiB, uint64_t * SizeOut);
 /* Frees a file opened with previous function */
 void Util_CloseFileFromMemory(void * File);
 
+/* Maps a file read-only into memory, returns NULL on failure. Unmap with the size. */
+void * Util_MapFile(char * Path, uint64_t * SizeOut);
+void Util_UnmapFile(void * Data, uint64_t Size);
+
+/* Maps an existing POSIX shared memory object (Name is like /name), read-only or
+ * for writing, returns NULL on failure. Unmap with Util_UnmapFile. */
+void * Util_MapSharedMemory(char * Name, uint64_t * SizeOut, int Writable);
+
+/* Creates (or truncates) a file of Size bytes and maps it for writing, returns NULL
+ * on failure. What's written to it ends up in the file, close it with the size. */
+void * Util_CreateMappedFile(char * Path, uint64_t Size);
+/* Unmaps a file from Util_CreateMappedFile, the kernel writes it out in its own
+ * time. With Sync it waits for that instead, and returns 0 only if it all got to
+ * the disk. */
+int Util_CloseMappedFile(void * Data, uint64_t Size, int Sync);
+
+/* Lets go of the pages of part of a mapping that has been used, to keep the memory
+ * use down when going through a big file. The contents stay the same (it's in the
+ * page cache, or the file) and are paged back in if they're touched again. */
+void Util_ReleaseMappedRange(void * Start, uint64_t Size);
+
 /* sRGB transfer function */
 double sRGB_to_linear(uint8_t CodeValue);
 uint8_t linear_to_sRGB(double LinearValue);
@@ -34,7 +56,53 @@ uint8_t linear_to_sRGB(double LinearValue);
 /* HSV to RGB */
 void Util_HSVToRGB(float H, float S, float V, float * RGBOut);
 
-/* Writes a bitmap from an rgb int8 image */
+/* Number of CPU cores available */
+int Util_GetNumCPUs();
+
+/* Runs Func(Job, Data) for every Job in 0..NumJobs-1 across NumThreads threads
+ * (0 = all cores). Jobs are handed out dynamically, the calling thread works too. */
+void Util_ParallelFor(int NumJobs, int NumThreads, void (*Func)(int Job, void * Data), void * Data);
+
+/* Seconds from a monotonic clock, for measuring how long things take */
+double Util_GetSeconds();
+
+/* Fixed size queue of pointers for handing work between threads, pushing blocks
+ * while it's full and popping while it's empty */
+typedef struct {
+    void ** items;
+    int capacity, first, count;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} Util_Queue_t;
+
+/* Returns 0 on success */
+int Util_InitQueue(Util_Queue_t * Queue, int Capacity);
+void Util_FreeQueue(Util_Queue_t * Queue);
+void Util_QueuePush(Util_Queue_t * Queue, void * Item);
+void * Util_QueuePop(Util_Queue_t * Queue);
+
+/* Writes a bitmap from an rgb int8 image, Invert flips it. Data isn't modified. */
 void Util_WriteBitmap(unsigned char * data, int width, int height, char * filename, int Invert);
 
+/* A bitmap file that is mapped into memory while it's written, pixels can be put
+ * straight into it, a row or strip at a time, in any order */
+typedef struct {
+    uint8_t * data; /* The whole file */
+    uint64_t size;
+    int width, height;
+    int row_bytes; /* Including padding */
+} Util_Bitmap_t;
+
+/* Creates the file at its full size and maps it, returns 0 on success */
+int Util_CreateBitmap(Util_Bitmap_t * BMP, char * Path, int Width, int Height);
+/* Row Y (counted from the top) in the file, stored as BGR */
+uint8_t * Util_BitmapRow(Util_Bitmap_t * BMP, int Y);
+/* Copies NumRows rows of rgb int8 pixels in, starting at RowStart. Data isn't
+ * modified. */
+void Util_WriteBitmapRows(Util_Bitmap_t * BMP, unsigned char * Data, int RowStart, int NumRows);
+/* Releases the pages of rows that are finished, see Util_ReleaseMappedRange */
+void Util_ReleaseBitmapRows(Util_Bitmap_t * BMP, int RowStart, int NumRows);
+/* Writes out and unmaps the file, returns 0 on success */
+int Util_CloseBitmap(Util_Bitmap_t * BMP);
+
 #endif
\ No newline at end of file
@@ -1,9 +1,37 @@
-gcc -c -O3 ColourPath.c
-gcc -c -O3 IPT.c
-gcc -c -O3 Matrix.c
-gcc -c -O3 Utilities/Utilities.c
-gcc -c -O3 Program.c
+# PROFILE=1 ./build.sh builds in the per stage profiling (--profile and --trace)
+FLAGS="-O3"
+if [ "$PROFILE" = "1" ]; then FLAGS="$FLAGS -DLDRT_PROFILE"; fi
 
-gcc *.o -o process_data
+# libluminancedrt, static and shared
+gcc -c $FLAGS -fPIC -fvisibility=hidden ColourPath.c
+gcc -c $FLAGS -fPIC -fvisibility=hidden Half.c
+gcc -c $FLAGS -fPIC -fvisibility=hidden IPT.c
+gcc -c $FLAGS -fPIC -fvisibility=hidden LUT3D.c
+gcc -c $FLAGS -fPIC -fvisibility=hidden LuminanceDRT.c
+gcc -c $FLAGS -fPIC -fvisibility=hidden Matrix.c
+gcc -c $FLAGS -fPIC -fvisibility=hidden PathLUT.c
+gcc -c $FLAGS -fPIC -fvisibility=hidden Profile.c
+gcc -c $FLAGS -fPIC -fvisibility=hidden ToneTable.c
+gcc -c $FLAGS -fPIC -fvisibility=hidden Utilities/Utilities.c
 
-rm *.o
\ No newline at end of file
+LIBRARY_OBJECTS="ColourPath.o Half.o IPT.o LUT3D.o LuminanceDRT.o Matrix.o PathLUT.o Profile.o ToneTable.o Utilities.o"
+rm -f libluminancedrt.a
+ar rcs libluminancedrt.a $LIBRARY_OBJECTS
+gcc -shared $LIBRARY_OBJECTS -o libluminancedrt.so -lm -lpthread
+rm *.o
+
+# process_data, benchmark, accuracy and exr_check
+gcc -c $FLAGS EXR.c
+gcc -c $FLAGS ImageWriter.c
+gcc -c $FLAGS SRGB.c
+gcc -c $FLAGS Program.c
+gcc -c $FLAGS Benchmark.c
+gcc -c $FLAGS Accuracy.c
+gcc -c $FLAGS EXRCheck.c
+
+gcc Program.o EXR.o ImageWriter.o SRGB.o libluminancedrt.a -o process_data -lm -lpthread -lz
+gcc Benchmark.o ImageWriter.o SRGB.o libluminancedrt.a -o benchmark -lm -lpthread -lz
+gcc Accuracy.o EXR.o SRGB.o libluminancedrt.a -o accuracy -lm -lpthread -lz
+gcc EXRCheck.o EXR.o libluminancedrt.a -o exr_check -lm -lpthread -lz
+
+rm *.o